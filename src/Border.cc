@@ -1,22 +1,10 @@
 #include "Border.h"
 #include "Client.h"
 #include "Manager.h"
+#include "Theme.h"
 
 // Some shaping mods due to Jacques Garrigue, garrigue@kurims.kyoto-u.ac.jp
 
-// These are degenerate initialisations, don't change them
-XftFont *Border::m_tabFont = 0;
-XftColor *Border::m_xftColour = 0;
-int *Border::m_tabWidth = 0;
-GC *Border::m_drawGC = 0;
-
-unsigned long *Border::m_foregroundPixel;
-unsigned long *Border::m_backgroundPixel;
-unsigned long *Border::m_frameBackgroundPixel;
-unsigned long *Border::m_buttonBackgroundPixel;
-unsigned long *Border::m_borderPixel;
-Pixmap Border::m_backgroundPixmap = None;
-
 class BorderRectangle { // must resemble XRectangle in storage
 
 public:
@@ -41,8 +29,7 @@ public:
     unsigned short width, height;
 };
 
-declareList(RectangleList, BorderRectangle);
-implementList(RectangleList, BorderRectangle);
+typedef List<BorderRectangle> RectangleList;
 
 class BorderRectangleList: public RectangleList {
 
@@ -65,6 +52,21 @@ void BorderRectangleList::append(int x, int y, int w, int h) {
     append(BorderRectangle(x, y, w, h));
 }
 
+static Region toRegion(BorderRectangleList &rl) {
+    Region r = XCreateRegion();
+    for (int i = 0; i < rl.count(); ++i) {
+        XUnionRectWithRegion(rl.item(i).xrectangle(), r, r);
+    }
+    return r;
+}
+
+static void destroyRegion(Region &r) {
+    if (r) {
+        XDestroyRegion(r);
+        r = 0;
+    }
+}
+
 Border::Border(Client *const c, Window child) :
     m_client(c),
     m_parent(0),
@@ -73,21 +75,37 @@ Border::Border(Client *const c, Window child) :
     m_button(0),
     m_resize(0),
     m_label(0),
-    m_xftDraw(0),
+    m_tabPixmap(None),
+    m_tabPixmapHeight(0),
+    m_tabDraw(0),
+    m_renderedLabel(0),
+    m_damaged(False),
+    m_shapeW(-1),
+    m_shapeH(-1),
+    m_shapeTabHeight(-1),
+    m_shapeActive(-1),
     m_prevW(-1),
     m_prevH(-1),
     m_tabHeight(-1)
 {
-    m_parent = root();
-    if (!m_drawGC) {
-        initialiseStatics(c->windowManager());
+    for (int kind = ShapeBounding; kind <= ShapeClip; ++kind) {
+        m_parentBase[kind] = m_frame[kind] = m_tabShape[kind] = 0;
+        m_parentApplied[kind] = m_tabApplied[kind] = 0;
     }
+
+    m_parent = root();
     m_feedback = 0;
     m_fedback = False;
 }
 
 Border::~Border() {
     if (m_parent != root()) {
+        windowManager()->unregisterWindow(m_parent, m_client);
+        windowManager()->unregisterWindow(m_tab, m_client);
+        windowManager()->unregisterWindow(m_button, m_client);
+        windowManager()->unregisterWindow(m_resize, m_client);
+        windowManager()->unregisterWindow(m_feedback, m_client);
+
         if (!m_parent) {
             fprintf(stderr, "wmx: zero parent in Border::~Border\n");
         } else {
@@ -102,150 +120,28 @@ Border::~Border() {
             if (m_feedback) {
                 XDestroyWindow(display(), m_feedback);
             }
-            if (m_xftDraw) {
-                XftDrawDestroy(m_xftDraw);
-            }
         }
     }
 
-    //!!! remind me why we don't delete these windows if m_parent == root() ?
-
-    if (m_label) {
-        free(m_label);
-    }
-}
-
-void Border::initialiseStatics(WindowManager *wm) {
-    if (m_drawGC) {
-        return;
-    }
-    // fprintf(stderr, "Border::initialiseStatics: initialising\n");
-
-    XGCValues *values;
-
-    m_drawGC = (GC*) malloc(wm->screensTotal() * sizeof(GC));
-    m_xftColour = (XftColor*) malloc(wm->screensTotal() * sizeof(XftColor));
-    m_tabWidth = (int*) malloc(wm->screensTotal() * sizeof(int));
-    m_foregroundPixel = (unsigned long*) malloc(wm->screensTotal() * sizeof(unsigned long));
-    m_backgroundPixel = (unsigned long*) malloc(wm->screensTotal() * sizeof(unsigned long));
-    m_frameBackgroundPixel = (unsigned long*) malloc(wm->screensTotal() * sizeof(unsigned long));
-    m_buttonBackgroundPixel = (unsigned long*) malloc(wm->screensTotal() * sizeof(unsigned long));
-    m_borderPixel = (unsigned long*) malloc(wm->screensTotal() * sizeof(unsigned long));
-
-    values = (XGCValues*) malloc(wm->screensTotal() * sizeof(XGCValues));
-
-    if (sizeof(BorderRectangle) != sizeof(XRectangle)) {
-        wm->fatal("internal error: border rectangle and X rectangle have different storage requirements -- bailing out");
+    if (m_tabPixmap) {
+        windowManager()->theme().releaseDraw(m_tabPixmap);
+        XFreePixmap(display(), m_tabPixmap);
     }
-
-    char *fi = strdup(CONFIG_FRAME_FONT);
-    char *ffi = fi, *tokstr = fi;
-    while ((fi = strtok(tokstr, ","))) {
-
-        // fprintf(stderr, "fi = \"%s\"\n", fi);
-        tokstr = 0;
-        int ascent = 0, height = 0;
-
-        // We have to query the font twice, because ascent and height
-        // are not returned properly when querying with a rotated matrix
-
-        FcPattern *pattern = FcPatternCreate();
-        FcPatternAddString(pattern, FC_FAMILY, (FcChar8*) fi);
-        FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
-        FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_DEMIBOLD);
-        FcPatternAddInteger(pattern, FC_PIXEL_SIZE, CONFIG_FRAME_FONT_SIZE);
-        FcConfigSubstitute(FcConfigGetCurrent(), pattern, FcMatchPattern);
-
-        FcResult result = FcResultMatch;
-        FcPattern *match = FcFontMatch(FcConfigGetCurrent(), pattern, &result);
-
-        if (!match || result != FcResultMatch) {
-            FcPatternDestroy(pattern);
-            if (match) {
-                FcPatternDestroy(match);
-            }
-            continue;
-        }
-
-        XftFont *refFont = XftFontOpenPattern(wm->display(), match);
-        if (!refFont) {
-            FcPatternDestroy(pattern);
-            FcPatternDestroy(match);
-            continue;
-        }
-
-        ascent = refFont->ascent;
-        height = refFont->height;
-        // fprintf(stderr, "tab font ascent=%d, height=%d\n", ascent, height);
-
-        XftFontClose(wm->display(), refFont);
-
-        FcMatrix matrix;
-        FcMatrixInit(&matrix);
-        FcMatrixRotate(&matrix, 0, 1);
-        FcPatternAddMatrix(pattern, FC_MATRIX, &matrix);
-
-        result = FcResultMatch;
-        match = FcFontMatch(FcConfigGetCurrent(), pattern, &result);
-
-        FcPatternDestroy(pattern);
-
-        if (!match || result != FcResultMatch) {
-            if (match) {
-                FcPatternDestroy(match);
-            }
-            continue;
-        }
-
-        m_tabFont = XftFontOpenPattern(wm->display(), match);
-        // fprintf(stderr, "tab font ascent = %d\n", m_tabFont->ascent);
-        if (!m_tabFont) {
-            FcPatternDestroy(match);
-        } else {
-            m_tabFont->ascent = ascent;
-            m_tabFont->height = height;
-            break;
-        }
+    if (m_renderedLabel) {
+        free(m_renderedLabel);
     }
 
-    free(ffi);
-
-    if (!m_tabFont) {
-        wm->fatal("couldn't load default rotated Xft font, bailing out");
+    forgetShapes();
+    for (int kind = ShapeBounding; kind <= ShapeClip; ++kind) {
+        destroyRegion(m_parentBase[kind]);
+        destroyRegion(m_frame[kind]);
+        destroyRegion(m_tabShape[kind]);
     }
 
-    for (int i = 0; i < wm->screensTotal(); i++) {
-
-        m_tabWidth[i] = -1;
-
-        m_foregroundPixel[i] = wm->allocateColour(i, CONFIG_TAB_FOREGROUND, "tab foreground");
-        m_backgroundPixel[i] = wm->allocateColour(i, CONFIG_TAB_BACKGROUND, "tab background");
-        m_frameBackgroundPixel[i] = wm->allocateColour(i, CONFIG_FRAME_BACKGROUND, "frame background");
-        m_buttonBackgroundPixel[i] = wm->allocateColour(i, CONFIG_BUTTON_BACKGROUND, "button background");
-        m_borderPixel[i] = wm->allocateColour(i, CONFIG_BORDERS, "border");
-
-        XftColorAllocName(wm->display(), XDefaultVisual(wm->display(), i), XDefaultColormap(wm->display(), i), CONFIG_TAB_FOREGROUND, &m_xftColour[i]);
-
-        // fprintf(stderr, "tab font height = %d\n", (int) m_tabFont->height);
-        m_tabWidth[i] = m_tabFont->height + (CONFIG_TAB_MARGIN * 2);
-
-        if (m_tabWidth[i] < TAB_TOP_HEIGHT * 2 + 8) {
-            m_tabWidth[i] = TAB_TOP_HEIGHT * 2 + 8;
-        }
-
-        values[i].foreground = m_foregroundPixel[i];
-        values[i].background = m_backgroundPixel[i];
-        values[i].function = GXcopy;
-        values[i].line_width = 0;
-        values[i].subwindow_mode = IncludeInferiors;
-
-        m_drawGC[i] = XCreateGC( wm->display(), wm->mroot(i), GCForeground | GCBackground | GCFunction | GCLineWidth | GCSubwindowMode, &values[i]);
-
-        if (!m_drawGC[i]) {
-            wm->fatal("couldn't allocate border GC");
-        }
+    //!!! remind me why we don't delete these windows if m_parent == root() ?
 
-        m_backgroundPixmap = None;
+    if (m_label) {
+        free(m_label);
     }
 }
 
@@ -255,18 +151,12 @@ Boolean Border::hasWindow(Window w) {
     );
 }
 
-Pixmap Border::backgroundPixmap(WindowManager *wm) {
-    if (!m_drawGC) {
-        Border::initialiseStatics(wm);
-    }
-    return m_backgroundPixmap;
+ThemeScreen& Border::theme() {
+    return windowManager()->theme().screen(screen());
 }
 
-GC Border::drawGC(WindowManager *wm, int screen) {
-    if (!m_drawGC) {
-        Border::initialiseStatics(wm);
-    }
-    return m_drawGC[screen];
+int Border::tabWidth() {
+    return theme().tabWidth;
 }
 
 void Border::fatal(char *s) {
@@ -290,10 +180,45 @@ Window Border::root() {
 }
 
 void Border::expose(XExposeEvent *e) {
-    if (e && (e->window != m_tab)) {
+    if (!e) {
+        drawLabel();
+        return;
+    }
+    if (e->window != m_tab) {
         return;
     }
-    drawLabel();
+
+    // collect the parts and copy once, at the last of them
+    if (!m_damaged) {
+        m_damage.x = e->x;
+        m_damage.y = e->y;
+        m_damage.width = e->width;
+        m_damage.height = e->height;
+        m_damaged = True;
+    } else {
+        int x2 = m_damage.x + m_damage.width, y2 = m_damage.y + m_damage.height;
+        if (e->x + e->width > x2) {
+            x2 = e->x + e->width;
+        }
+        if (e->y + e->height > y2) {
+            y2 = e->y + e->height;
+        }
+        if (e->x < m_damage.x) {
+            m_damage.x = e->x;
+        }
+        if (e->y < m_damage.y) {
+            m_damage.y = e->y;
+        }
+        m_damage.width = x2 - m_damage.x;
+        m_damage.height = y2 - m_damage.y;
+    }
+    if (e->count > 0) {
+        return;
+    }
+
+    m_damaged = False;
+    renderLabel();
+    copyLabel(m_damage.x, m_damage.y, m_damage.width, m_damage.height);
 }
 
 int Border::yIndent() {
@@ -307,15 +232,53 @@ int Border::xIndent() {
     if (m_client->isBorderless()) {
         return 0;
     }
-    return isTransient() ? TRANSIENT_FRAME_WIDTH + 1 : m_tabWidth[screen()] + FRAME_WIDTH + 1;
+    return isTransient() ? TRANSIENT_FRAME_WIDTH + 1 : tabWidth() + FRAME_WIDTH + 1;
 }
 
 void Border::drawLabel() {
-    if (m_label) {
-        XClearWindow(display(), m_tab);
-        // fprintf(stderr, "coords: %d,%d / label: \"%s\"\n", (int)(2 + m_tabFont->ascent), (int)(m_tabHeight - 1), m_label);
-        XftDrawStringUtf8( m_xftDraw, &m_xftColour[screen()], m_tabFont, CONFIG_TAB_MARGIN + m_tabFont->ascent, m_tabHeight - 1, (FcChar8*) m_label, strlen(m_label));
+    renderLabel();
+    copyLabel(0, 0, tabWidth(), m_tabPixmapHeight);
+}
+
+void Border::renderLabel() {
+    if (!m_label || !m_tab) {
+        return;
+    }
+    int height = m_tabHeight + 2 + tabWidth();
+    if (m_tabPixmap && height == m_tabPixmapHeight && m_renderedLabel && !strcmp(m_renderedLabel, m_label)) {
+        return;
+    }
+
+    Theme &t = windowManager()->theme();
+    if (!m_tabPixmap || height != m_tabPixmapHeight) {
+        if (m_tabPixmap) {
+            t.releaseDraw(m_tabPixmap);
+            XFreePixmap(display(), m_tabPixmap);
+        }
+        m_tabPixmap = XCreatePixmap(display(), m_tab, tabWidth(), height, DefaultDepth(display(), screen()));
+        m_tabPixmapHeight = height;
+        m_tabDraw = t.acquireDraw(screen(), m_tabPixmap);
     }
+
+    XftFont *font = t.tabFont();
+    XFillRectangle(display(), m_tabPixmap, theme().tabGC, 0, 0, tabWidth(), height);
+    // fprintf(stderr, "coords: %d,%d / label: \"%s\"\n", (int)(2 + font->ascent), (int)(m_tabHeight - 1), m_label);
+    XftDrawStringUtf8(m_tabDraw, &theme().tabText, font, CONFIG_TAB_MARGIN + font->ascent, m_tabHeight - 1, (FcChar8*) m_label, strlen(m_label));
+
+    if (m_renderedLabel) {
+        free(m_renderedLabel);
+    }
+    m_renderedLabel = NewString(m_label);
+}
+
+// The rest of the tab is plain background, which the server has
+// already painted
+
+void Border::copyLabel(int x, int y, int w, int h) {
+    if (!m_tabPixmap) {
+        return;
+    }
+    XCopyArea(display(), m_tabPixmap, m_tab, theme().tabGC, x, y, w, h, x, y);
 }
 
 Boolean Border::isTransient(void) {
@@ -327,19 +290,16 @@ Boolean Border::isFixedSize(void) {
 }
 
 int Border::getRotatedTextWidth(char *text) {
-    XGlyphInfo extents;
-    XftTextExtentsUtf8(display(), m_tabFont, (FcChar8*) text, strlen(text), &extents);
-    // fprintf(stderr, "extents width=%d height=%d\n", (int)extents.width, (int)extents.height);
-    return extents.height;
+    return windowManager()->textCache().extents(display(), windowManager()->theme().tabFont(), text, strlen(text)).height;
 }
 
 void Border::fixTabHeight(int maxHeight) {
     m_tabHeight = 0x7fff;
-    maxHeight -= m_tabWidth[screen()];  // for diagonal
+    maxHeight -= tabWidth();  // for diagonal
 
     // At least we need the button and its box.
-    if (maxHeight < m_tabWidth[screen()] + 2) {
-        maxHeight = m_tabWidth[screen()] + 2;
+    if (maxHeight < tabWidth() + 2) {
+        maxHeight = tabWidth() + 2;
     }
     // fprintf(stderr, "client label: \"%s\"\n", m_client->label());
 
@@ -349,7 +309,7 @@ void Border::fixTabHeight(int maxHeight) {
     m_label = NewString(m_client->label());
 
     if (m_label) {
-        m_tabHeight = getRotatedTextWidth(m_label) + 6 + m_tabWidth[screen()];
+        m_tabHeight = getRotatedTextWidth(m_label) + 6 + tabWidth();
     }
     // fprintf(stderr, "my label: \"%s\"\n", m_label);
 
@@ -361,7 +321,7 @@ void Border::fixTabHeight(int maxHeight) {
     }
 
     int len = strlen(m_label);
-    m_tabHeight = getRotatedTextWidth(m_label) + 6 + m_tabWidth[screen()];
+    m_tabHeight = getRotatedTextWidth(m_label) + 6 + tabWidth();
     if (m_tabHeight <= maxHeight) {
         return;
     }
@@ -371,7 +331,7 @@ void Border::fixTabHeight(int maxHeight) {
         // (incorrect for utf8)
         strncpy(newLabel, m_label, len - 1);
         strcpy(newLabel + len - 1, "...");
-        m_tabHeight = getRotatedTextWidth(newLabel) + 6 + m_tabWidth[screen()];
+        m_tabHeight = getRotatedTextWidth(newLabel) + 6 + tabWidth();
         --len;
     } while (m_tabHeight > maxHeight && len > 2);
 
@@ -447,165 +407,233 @@ void Border::setTransientFrameVisibility(Boolean visible, int w, int h) {
 }
 
 void Border::shapeParent(int w, int h) {
-    int i;
-    int mainRect;
-    BorderRectangleList rl;
-
+    // a normal frame is shaped together with its tab, in updateShapes
     if (isTransient()) {
         shapeTransientParent(w, h);
-        return;
-    }
-    if (m_client->isBorderless()) {
-        return;
     }
+}
+
+// The pieces a normal frame is shaped from.  The parent is the base
+// plus, while the client is active, the frame.
+
+void Border::parentRectangles(int w, int h, BorderRectangleList &bounding, BorderRectangleList &clip) {
+    int i;
+    int mainRect;
+    BorderRectangleList &rl = bounding;
 
     // Bounding rectangles -- clipping will be the same except for child window border
 
     // top of tab
-    rl.append(0, 0, w + m_tabWidth[screen()] + 1, TAB_TOP_HEIGHT + 2);
+    rl.append(0, 0, w + tabWidth() + 1, TAB_TOP_HEIGHT + 2);
     // struts in tab, left...
-    rl.append(0, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 1);
+    rl.append(0, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, tabWidth() - TAB_TOP_HEIGHT * 2 - 1);
     // ...and right
-    rl.append(m_tabWidth[screen()] - TAB_TOP_HEIGHT, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 1);
+    rl.append(tabWidth() - TAB_TOP_HEIGHT, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, tabWidth() - TAB_TOP_HEIGHT * 2 - 1);
     mainRect = rl.count();
     rl.append(xIndent() - 1, yIndent() - 1, w + 2, h + 2);
     // main tab
-    rl.append(0, m_tabWidth[screen()] - TAB_TOP_HEIGHT, m_tabWidth[screen()] + 2, m_tabHeight - m_tabWidth[screen()] + TAB_TOP_HEIGHT);
+    rl.append(0, tabWidth() - TAB_TOP_HEIGHT, tabWidth() + 2, m_tabHeight - tabWidth() + TAB_TOP_HEIGHT);
 
     // diagonal
-    for (i = 1; i < m_tabWidth[screen()] - 1; ++i) {
+    for (i = 1; i < tabWidth() - 1; ++i) {
         int y = m_tabHeight + i - 1;
         /* JG: Check position */
         if (y < h) {
-            rl.append(i, y, m_tabWidth[screen()] - i + 2, 1);
+            rl.append(i, y, tabWidth() - i + 2, 1);
         }
     }
 
-    XShapeCombineRectangles(display(), m_parent, ShapeBounding, 0, 0, rl.xrectangles(), rl.count(), ShapeSet, YXSorted);
+    for (i = 0; i < rl.count(); ++i) {
+        clip.append(rl.item(i));
+    }
+    clip.item(mainRect).x++;
+    clip.item(mainRect).y++;
+    clip.item(mainRect).width -= 2;
+    clip.item(mainRect).height -= 2;
+}
+
+void Border::frameRectangles(int w, int h, BorderRectangleList &bounding, BorderRectangleList &clip) {
+    BorderRectangleList &rl = bounding;
 
-    rl.item(mainRect).x++;
-    rl.item(mainRect).y++;
-    rl.item(mainRect).width -= 2;
-    rl.item(mainRect).height -= 2;
+    // Bounding rectangles
 
-    XShapeCombineRectangles(display(), m_parent, ShapeClip, 0, 0, rl.xrectangles(), rl.count(), ShapeSet, YXSorted);
+    rl.append(tabWidth() + w + 1, 0, FRAME_WIDTH + 1, FRAME_WIDTH);
+    rl.append(tabWidth() + 2, TAB_TOP_HEIGHT + 2, w, FRAME_WIDTH - TAB_TOP_HEIGHT - 2);
+    // for button
+    int ww = tabWidth() - TAB_TOP_HEIGHT * 2 - 4;
+    rl.append((tabWidth() + 2 - ww) / 2, (tabWidth() + 2 - ww) / 2, ww, ww);
+    rl.append(tabWidth() + 2, FRAME_WIDTH, FRAME_WIDTH - 2, m_tabHeight + tabWidth() - FRAME_WIDTH - 2);
+
+    int final = rl.count() - 1;
+    rl.append(rl.item(final).x - 1, rl.item(final).y + rl.item(final).height, rl.item(final).width + 1, h - rl.item(final).height + 2);
+
+    // Clip rectangles
+
+    clip.append(tabWidth() + w + 1, 1, FRAME_WIDTH, FRAME_WIDTH - 1);
+    clip.append(tabWidth() + 2, TAB_TOP_HEIGHT + 2, w, FRAME_WIDTH - TAB_TOP_HEIGHT - 2);
+    // for button
+    ww = tabWidth() - TAB_TOP_HEIGHT * 2 - 6;
+    clip.append((tabWidth() + 2 - ww) / 2, (tabWidth() + 2 - ww) / 2, ww, ww);
+    clip.append(tabWidth() + 2, FRAME_WIDTH, FRAME_WIDTH - 2, h - FRAME_WIDTH);
+    clip.append(tabWidth() + 2, h, FRAME_WIDTH - 2, FRAME_WIDTH + 1);
 }
 
-void Border::shapeTab(int w, int h) {
+void Border::tabRectangles(int w, int h, BorderRectangleList &bounding, BorderRectangleList &clip) {
     int i;
-    BorderRectangleList rl;
-
-    if (isTransient() || m_client->isBorderless()) {
-        return;
-    }
+    BorderRectangleList &rl = bounding;
 
     // Bounding rectangles
 
-    rl.append(0, 0, w + m_tabWidth[screen()] + 1, TAB_TOP_HEIGHT + 2);
-    rl.append(0, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 1);
-    rl.append(m_tabWidth[screen()] - TAB_TOP_HEIGHT, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 1);
-    rl.append(0, m_tabWidth[screen()] - TAB_TOP_HEIGHT, m_tabWidth[screen()] + 2, m_tabHeight - m_tabWidth[screen()] + TAB_TOP_HEIGHT);
+    rl.append(0, 0, w + tabWidth() + 1, TAB_TOP_HEIGHT + 2);
+    rl.append(0, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, tabWidth() - TAB_TOP_HEIGHT * 2 - 1);
+    rl.append(tabWidth() - TAB_TOP_HEIGHT, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 2, tabWidth() - TAB_TOP_HEIGHT * 2 - 1);
+    rl.append(0, tabWidth() - TAB_TOP_HEIGHT, tabWidth() + 2, m_tabHeight - tabWidth() + TAB_TOP_HEIGHT);
 
-    for (i = 1; i < m_tabWidth[screen()] - 1; ++i) {
+    for (i = 1; i < tabWidth() - 1; ++i) {
         int y = m_tabHeight + i - 1;
         /* JG: Check position */
         if (y <= h) {
-            rl.append(i, y, m_tabWidth[screen()] - i + 2, 1);
+            rl.append(i, y, tabWidth() - i + 2, 1);
         }
     }
 
-    XShapeCombineRectangles(display(), m_tab, ShapeBounding, 0, 0, rl.xrectangles(), rl.count(), ShapeSet, YXSorted);
-
-    rl.remove_all();
-
     // Clipping rectangles
 
-    rl.append(1, 1, w + m_tabWidth[screen()] - 1, TAB_TOP_HEIGHT);
-    rl.append(1, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT, m_tabWidth[screen()] + TAB_TOP_HEIGHT * 2 - 1);
-    rl.append(m_tabWidth[screen()] - TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT, m_tabWidth[screen()] + TAB_TOP_HEIGHT * 2 - 1);
-    rl.append(1, m_tabWidth[screen()] - TAB_TOP_HEIGHT + 1, m_tabWidth[screen()], m_tabHeight - m_tabWidth[screen()] + TAB_TOP_HEIGHT - 1);
+    clip.append(1, 1, w + tabWidth() - 1, TAB_TOP_HEIGHT);
+    clip.append(1, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT, tabWidth() + TAB_TOP_HEIGHT * 2 - 1);
+    clip.append(tabWidth() - TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT + 1, TAB_TOP_HEIGHT, tabWidth() + TAB_TOP_HEIGHT * 2 - 1);
+    clip.append(1, tabWidth() - TAB_TOP_HEIGHT + 1, tabWidth(), m_tabHeight - tabWidth() + TAB_TOP_HEIGHT - 1);
 
-    for (i = 1; i < m_tabWidth[screen()] - 2; ++i) {
+    for (i = 1; i < tabWidth() - 2; ++i) {
         int y = m_tabHeight + i - 1;
         /* JG: Check position */
         if (y < h) {
-            rl.append(i + 1, y, m_tabWidth[screen()] - i, 1);
+            clip.append(i + 1, y, tabWidth() - i, 1);
         }
     }
+}
+
+// Shape a normal frame and its tab.  The pieces are worked out once
+// for each size and tab height, so that a focus change only has to add
+// or take away the frame, and each window is sent just what differs
+// from the shape it has already.
+
+void Border::updateShapes(int w, int h, Boolean active) {
+    int kind;
+
+    if (w == m_shapeW && h == m_shapeH && m_tabHeight == m_shapeTabHeight && active == m_shapeActive) {
+        return; // just as it was last time
+    }
 
-    XShapeCombineRectangles(display(), m_tab, ShapeClip, 0, 0, rl.xrectangles(), rl.count(), ShapeSet, YXSorted);
+    if (w != m_shapeW || h != m_shapeH || m_tabHeight != m_shapeTabHeight) {
+        BorderRectangleList bounding, clip;
+
+        for (kind = ShapeBounding; kind <= ShapeClip; ++kind) {
+            destroyRegion(m_parentBase[kind]);
+            destroyRegion(m_frame[kind]);
+            destroyRegion(m_tabShape[kind]);
+        }
+
+        parentRectangles(w, h, bounding, clip);
+        m_parentBase[ShapeBounding] = toRegion(bounding);
+        m_parentBase[ShapeClip] = toRegion(clip);
+
+        bounding.remove_all();
+        clip.remove_all();
+        frameRectangles(w, h, bounding, clip);
+        m_frame[ShapeBounding] = toRegion(bounding);
+        m_frame[ShapeClip] = toRegion(clip);
+
+        bounding.remove_all();
+        clip.remove_all();
+        tabRectangles(w, h, bounding, clip);
+        m_tabShape[ShapeBounding] = toRegion(bounding);
+        m_tabShape[ShapeClip] = toRegion(clip);
+
+        m_shapeW = w;
+        m_shapeH = h;
+        m_shapeTabHeight = m_tabHeight;
+    }
+
+    for (kind = ShapeBounding; kind <= ShapeClip; ++kind) {
+        Region parent = XCreateRegion();
+        if (active) {
+            XUnionRegion(m_parentBase[kind], m_frame[kind], parent);
+        } else {
+            XSubtractRegion(m_parentBase[kind], m_frame[kind], parent);
+        }
+        applyShape(m_parent, kind, m_parentApplied[kind], parent);
+
+        Region tab = XCreateRegion();
+        XUnionRegion(m_tabShape[kind], tab, tab);
+        applyShape(m_tab, kind, m_tabApplied[kind], tab);
+    }
+    m_shapeActive = active;
 }
 
-void Border::resizeTab(int h) {
-    int i;
-    int shorter, longer, operation;
+// Takes over the desired region.  Sends at most one request: what's
+// been added, what's been taken away, or if both the whole new shape.
 
-    if (isTransient() || m_client->isBorderless()) {
+void Border::applyShape(Window w, int kind, Region &applied, Region desired) {
+    if (!applied) {
+        XShapeCombineRegion(display(), w, kind, 0, 0, desired, ShapeSet);
+        applied = desired;
         return;
     }
-
-    int prevTabHeight = m_tabHeight;
-    fixTabHeight(h);
-    // If resize is not needed, title might be needed redraw.
-    // Because this is called from rename() sometimes.
-    // So do it independently.
-    if (m_tabHeight == prevTabHeight) {
-        drawLabel();
+    if (XEqualRegion(applied, desired)) {
+        XDestroyRegion(desired);
         return;
     }
 
-    XWindowChanges wc;
-    wc.height = m_tabHeight + 2 + m_tabWidth[screen()];
-    XConfigureWindow(display(), m_tab, CWHeight, &wc);
+    Region added = XCreateRegion();
+    Region removed = XCreateRegion();
+    XSubtractRegion(desired, applied, added);
+    XSubtractRegion(applied, desired, removed);
 
-    if (m_tabHeight > prevTabHeight) {
-        shorter = prevTabHeight;
-        longer = m_tabHeight;
-        operation = ShapeUnion;
+    if (XEmptyRegion(removed)) {
+        XShapeCombineRegion(display(), w, kind, 0, 0, added, ShapeUnion);
+    } else if (XEmptyRegion(added)) {
+        XShapeCombineRegion(display(), w, kind, 0, 0, removed, ShapeSubtract);
     } else {
-        shorter = m_tabHeight;
-        longer = prevTabHeight + m_tabWidth[screen()];
-        operation = ShapeSubtract;
+        XShapeCombineRegion(display(), w, kind, 0, 0, desired, ShapeSet);
     }
 
-    BorderRectangle r(0, shorter, m_tabWidth[screen()] + 2, longer - shorter);
-
-    XShapeCombineRectangles(display(), m_parent, ShapeBounding, 0, 0, r.xrectangle(), 1, operation, YXBanded);
-    XShapeCombineRectangles(display(), m_parent, ShapeClip, 0, 0, r.xrectangle(), 1, operation, YXBanded);
-    XShapeCombineRectangles(display(), m_tab, ShapeBounding, 0, 0, r.xrectangle(), 1, operation, YXBanded);
-
-    r.x++;
-    r.width -= 2;
+    XDestroyRegion(added);
+    XDestroyRegion(removed);
+    XDestroyRegion(applied);
+    applied = desired;
+}
 
-    XShapeCombineRectangles(display(), m_tab, ShapeClip, 0, 0, r.xrectangle(), 1, operation, YXBanded);
+// So that the next updateShapes sets every shape outright
 
-    if (m_client->isActive()) {
-        // restore a bit of the frame edge
-        r.x = m_tabWidth[screen()] + 1;
-        r.y = shorter;
-        r.width = FRAME_WIDTH - 1;
-        r.height = longer - shorter;
-        XShapeCombineRectangles(display(), m_parent, ShapeBounding, 0, 0, r.xrectangle(), 1, ShapeUnion, YXBanded);
+void Border::forgetShapes() {
+    for (int kind = ShapeBounding; kind <= ShapeClip; ++kind) {
+        destroyRegion(m_parentApplied[kind]);
+        destroyRegion(m_tabApplied[kind]);
     }
+    m_shapeActive = -1;
+}
 
-    BorderRectangleList rl;
-    for (i = 1; i < m_tabWidth[screen()] - 1; ++i) {
-        rl.append(i, m_tabHeight + i - 1, m_tabWidth[screen()] - i + 2, 1);
+void Border::resizeTab(int h) {
+    if (isTransient() || m_client->isBorderless()) {
+        return;
     }
 
-    XShapeCombineRectangles(display(), m_parent, ShapeBounding, 0, 0, rl.xrectangles(), rl.count(), ShapeUnion, YXBanded);
-    XShapeCombineRectangles(display(), m_parent, ShapeClip, 0, 0, rl.xrectangles(), rl.count(), ShapeUnion, YXBanded);
-    XShapeCombineRectangles(display(), m_tab, ShapeBounding, 0, 0, rl.xrectangles(), rl.count(), ShapeUnion, YXBanded);
-
-    if (rl.count() < 2) {
+    int prevTabHeight = m_tabHeight;
+    fixTabHeight(h);
+    // If resize is not needed, title might be needed redraw.
+    // Because this is called from rename() sometimes.
+    // So do it independently.
+    if (m_tabHeight == prevTabHeight) {
+        drawLabel();
         return;
     }
-    for (i = 0; i < rl.count() - 1; ++i) {
-        rl.item(i).x++;
-        rl.item(i).width -= 2;
-    }
 
-    XShapeCombineRectangles(display(), m_tab, ShapeClip, 0, 0, rl.xrectangles(), rl.count() - 1, ShapeUnion, YXBanded);
+    XWindowChanges wc;
+    wc.height = m_tabHeight + 2 + tabWidth();
+    XConfigureWindow(display(), m_tab, CWHeight, &wc);
+
+    updateShapes(m_prevW, h, m_client->isActive());
 }
 
 void Border::shapeResize() {
@@ -647,49 +675,7 @@ void Border::setFrameVisibility(Boolean visible, int w, int h) {
         return;
     }
 
-    BorderRectangleList rl;
-
-    // Bounding rectangles
-
-    rl.append(m_tabWidth[screen()] + w + 1, 0, FRAME_WIDTH + 1, FRAME_WIDTH);
-    rl.append(m_tabWidth[screen()] + 2, TAB_TOP_HEIGHT + 2, w, FRAME_WIDTH - TAB_TOP_HEIGHT - 2);
-    // for button
-    int ww = m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 4;
-    rl.append((m_tabWidth[screen()] + 2 - ww) / 2, (m_tabWidth[screen()] + 2 - ww) / 2, ww, ww);
-    rl.append(m_tabWidth[screen()] + 2, FRAME_WIDTH, FRAME_WIDTH - 2, m_tabHeight + m_tabWidth[screen()] - FRAME_WIDTH - 2);
-
-    // swap last two if sorted wrong
-    if (rl.item(rl.count() - 2).y > rl.item(rl.count() - 1).y) {
-        rl.append(rl.item(rl.count() - 2));
-        rl.remove(rl.count() - 3);
-    }
-
-    int final = rl.count();
-    rl.append(rl.item(final - 1).x - 1, rl.item(final - 1).y + rl.item(final - 1).height, rl.item(final - 1).width + 1, h - rl.item(final - 1).height + 2);
-
-    XShapeCombineRectangles(display(), m_parent, ShapeBounding, 0, 0, rl.xrectangles(), rl.count(), visible ? ShapeUnion : ShapeSubtract, YXSorted);
-    rl.remove_all();
-
-    // Clip rectangles
-
-    rl.append(m_tabWidth[screen()] + w + 1, 1, FRAME_WIDTH, FRAME_WIDTH - 1);
-    rl.append(m_tabWidth[screen()] + 2, TAB_TOP_HEIGHT + 2, w, FRAME_WIDTH - TAB_TOP_HEIGHT - 2);
-    // for button
-    ww = m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 6;
-    rl.append((m_tabWidth[screen()] + 2 - ww) / 2, (m_tabWidth[screen()] + 2 - ww) / 2, ww, ww);
-    rl.append(m_tabWidth[screen()] + 2, FRAME_WIDTH, FRAME_WIDTH - 2, h - FRAME_WIDTH);
-
-    // swap last two if sorted wrong
-    if (rl.item(rl.count() - 2).y > rl.item(rl.count() - 1).y) {
-        rl.append(rl.item(rl.count() - 2));
-        rl.remove(rl.count() - 3);
-    }
-
-    rl.append(m_tabWidth[screen()] + 2, h, FRAME_WIDTH - 2, FRAME_WIDTH + 1);
-
-    XShapeCombineRectangles(display(), m_parent, ShapeClip, 0, 0, rl.xrectangles(), rl.count(), visible ? ShapeUnion : ShapeSubtract,YXSorted);
-
-    rl.remove_all();
+    updateShapes(w, h, visible);
 
     if (visible && !isFixedSize()) {
         XMapRaised(display(), m_resize);
@@ -701,19 +687,27 @@ void Border::setFrameVisibility(Boolean visible, int w, int h) {
 void Border::configure(int x, int y, int w, int h, unsigned long mask, int detail, Boolean force) { // must reshape everything
     if (!m_parent || m_parent == root()) {
 
+        ThemeScreen &t = theme();
+
         // create windows, then shape them afterwards
-        m_parent = XCreateSimpleWindow(display(), root(), 1, 1, 1, 1, 0, m_borderPixel[screen()], m_frameBackgroundPixel[screen()]);
+        m_parent = XCreateSimpleWindow(display(), root(), 1, 1, 1, 1, 0, t.border, t.frameBackground);
 
         if (!m_client->isBorderless()) {
-            m_tab = XCreateSimpleWindow(display(), m_parent, 1, 1, 1, 1, 0, m_borderPixel[screen()], m_backgroundPixel[screen()]);
-            m_button = XCreateSimpleWindow(display(), m_parent, 1, 1, 1, 1, 0, m_borderPixel[screen()], m_buttonBackgroundPixel[screen()]);
+            m_tab = XCreateSimpleWindow(display(), m_parent, 1, 1, 1, 1, 0, t.border, t.tabBackground);
+            m_button = XCreateSimpleWindow(display(), m_parent, 1, 1, 1, 1, 0, t.border, t.buttonBackground);
             m_resize = XCreateWindow(display(), m_parent, 1, 1, FRAME_WIDTH * 2, FRAME_WIDTH * 2, 0, CopyFromParent, InputOutput, CopyFromParent, 0L, 0);
             if (CONFIG_MAD_FEEDBACK) {
-                m_feedback = XCreateSimpleWindow(display(), root(), 0, 0, 1, 1, 1, m_borderPixel[screen()], m_backgroundPixel[screen()]);
+                m_feedback = XCreateSimpleWindow(display(), root(), 0, 0, 1, 1, 1, t.border, t.tabBackground);
             }
             shapeResize();
         }
 
+        windowManager()->registerWindow(m_parent, m_client);
+        windowManager()->registerWindow(m_tab, m_client);
+        windowManager()->registerWindow(m_button, m_client);
+        windowManager()->registerWindow(m_resize, m_client);
+        windowManager()->registerWindow(m_feedback, m_client);
+
         XSelectInput(display(), m_parent, SubstructureRedirectMask | SubstructureNotifyMask | ButtonPressMask | ButtonReleaseMask);
 
         if (!m_client->isBorderless()) {
@@ -726,26 +720,11 @@ void Border::configure(int x, int y, int w, int h, unsigned long mask, int detai
 
         mask |= CWX | CWY | CWWidth | CWHeight | CWBorderWidth;
 
-        XSetWindowAttributes wa;
-
-        wa.background_pixmap = m_backgroundPixmap;
-
-        if (m_backgroundPixmap) {
-            XChangeWindowAttributes(display(), m_parent, CWBackPixmap, &wa);
-            if (!m_client->isBorderless()) {
-                XChangeWindowAttributes(display(), m_tab, CWBackPixmap, &wa);
-                XChangeWindowAttributes(display(), m_button, CWBackPixmap, &wa);
-            }
-        }
         if (CONFIG_MAD_FEEDBACK && !m_client->isBorderless()) {
+            XSetWindowAttributes wa;
             wa.save_under = (DoesSaveUnders(ScreenOfDisplay(display(), 0)) ? True : False);
-            if (m_backgroundPixmap) {
-                XChangeWindowAttributes(display(), m_feedback, CWSaveUnder | CWBackPixmap, &wa);
-            } else {
-                XChangeWindowAttributes(display(), m_feedback, CWSaveUnder, &wa);
-            }
+            XChangeWindowAttributes(display(), m_feedback, CWSaveUnder, &wa);
         }
-        m_xftDraw = XftDrawCreate(display(), m_tab, XDefaultVisual(display(), screen()), XDefaultColormap(display(), screen()));
     }
 
     XWindowChanges wc;
@@ -779,6 +758,9 @@ void Border::configure(int x, int y, int w, int h, unsigned long mask, int detai
             } else {
                 fixTabHeight(h);
             }
+            if (force) {
+                forgetShapes();
+            }
             shapeParent(w, h);
             setFrameVisibility(m_client->isActive(), w, h);
 
@@ -786,9 +768,8 @@ void Border::configure(int x, int y, int w, int h, unsigned long mask, int detai
                 wc.x = 0;
                 wc.y = 0;
                 wc.width = w + xIndent();
-                wc.height = m_tabHeight + 2 + m_tabWidth[screen()];
+                wc.height = m_tabHeight + 2 + tabWidth();
                 XConfigureWindow(display(), m_tab, mask, &wc);
-                shapeTab(w, h);
             }
             m_prevW = w;
             m_prevH = h;
@@ -798,7 +779,7 @@ void Border::configure(int x, int y, int w, int h, unsigned long mask, int detai
         }
         wc.x = TAB_TOP_HEIGHT + 2;
         wc.y = wc.x;
-        wc.width = wc.height = m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 4;
+        wc.width = wc.height = tabWidth() - TAB_TOP_HEIGHT * 2 - 4;
     } else {
         shapeParent(w, h);
     }
@@ -5,6 +5,8 @@
 
 class Client;
 class WindowManager;
+class BorderRectangleList;
+class ThemeScreen;
 
 // These distances exclude the 1-pixel borders.
 // You could probably change these a certain amount
@@ -51,8 +53,6 @@ public:
     int xIndent();
 
     Boolean coordsInHole(int, int); // in Events.C of all places
-    static Pixmap backgroundPixmap(WindowManager *);
-    static GC drawGC(WindowManager *,int);
 
 private:
     Client *m_client;
@@ -70,37 +70,60 @@ private:
 
     char *m_label;
 
-    XftDraw *m_xftDraw;
+    // The label is drawn once into m_tabPixmap and copied to the tab
+    // when it's exposed.  It's only drawn again when the text or the
+    // tab height changes.  The XftDraw lasts as long as the pixmap.
+    Pixmap m_tabPixmap;
+    int m_tabPixmapHeight;
+    XftDraw *m_tabDraw;
+    char *m_renderedLabel;
+    XRectangle m_damage; // bounding box of a multi-part exposure
+    Boolean m_damaged;
 
     void fixTabHeight(int);
     int getRotatedTextWidth(char *);
     void drawLabel();
+    void renderLabel();
+    void copyLabel(int x, int y, int w, int h);
 
     void setFrameVisibility(Boolean, int, int);
     void setTransientFrameVisibility(Boolean, int, int);
     void shapeParent(int, int);
     void shapeTransientParent(int, int);
-    void shapeTab(int, int);
     void resizeTab(int); // for rename without changing window size
     void shapeResize();
 
+    // Shapes of a normal (non-transient) frame, indexed by
+    // ShapeBounding and ShapeClip.  The pieces are for the size and
+    // tab height in m_shapeW etc; the applied regions are what we
+    // last gave the server, or 0 if we don't know, and were made for
+    // m_shapeActive (-1 if they weren't made by updateShapes).
+    int m_shapeW;
+    int m_shapeH;
+    int m_shapeTabHeight;
+    int m_shapeActive;
+    Region m_parentBase[2];
+    Region m_frame[2]; // added to the parent when active
+    Region m_tabShape[2];
+    Region m_parentApplied[2];
+    Region m_tabApplied[2];
+
+    void parentRectangles(int, int, BorderRectangleList&, BorderRectangleList&);
+    void frameRectangles(int, int, BorderRectangleList&, BorderRectangleList&);
+    void tabRectangles(int, int, BorderRectangleList&, BorderRectangleList&);
+    void updateShapes(int w, int h, Boolean active);
+    void applyShape(Window, int kind, Region &applied, Region desired);
+    void forgetShapes();
+
     int m_prevW;
     int m_prevH;
 
 private:
     int m_tabHeight; // depends on the label
-    static int *m_tabWidth; // depends on the label font
-    static XftFont *m_tabFont;
-    static XftColor *m_xftColour;
-    static GC  *m_drawGC;
-    static unsigned long *m_foregroundPixel;
-    static unsigned long *m_backgroundPixel;
-    static unsigned long *m_frameBackgroundPixel;
-    static unsigned long *m_buttonBackgroundPixel;
-    static unsigned long *m_borderPixel;
-    static Pixmap m_backgroundPixmap;
-
-    static void initialiseStatics(WindowManager *);
+    int tabWidth(); // depends on the label font
+
+    // colours and GCs come from the manager's Theme
+    ThemeScreen& theme();
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "Manager.h"
 #include "Client.h"
 #include "Menu.h"
+#include "Theme.h"
 
 #include <sys/time.h>
 #include <X11/XKBlib.h>
@@ -56,54 +57,6 @@ void WindowManager::eventButton(XButtonEvent *e, XEvent *ev) {
     }
 }
 
-void WindowManager::circulate(Boolean activeFirst) {
-    Client *c = 0;
-    if (m_clients.count() == 0) {
-        return;
-    }
-    if (activeFirst) {
-        c = m_activeClient;
-    }
-
-    // cc 2000/05/11: change direction each time we release Alt
-    static int direction = 1;
-    if (!m_altStateRetained) {
-        direction = -direction;
-    }
-    m_altStateRetained = True;
-
-    if (!c) {
-        int i, j;
-        if (!m_activeClient) {
-            i = (direction > 0 ? -1 : m_clients.count());
-        } else {
-            for (i = 0; i < m_clients.count(); ++i) {
-                if (m_clients.item(i) == m_activeClient) {
-                    break;
-                }
-            }
-            if (i >= m_clients.count() - 1 && direction > 0) {
-                i = -1;
-            } else if (i == 0 && direction < 0) {
-                i = m_clients.count();
-            }
-        }
-        for (j = i + direction; (!m_clients.item(j)->isNormal() || m_clients.item(j)->isTransient() || m_clients.item(j)->skipsFocus()); j += direction) {
-            if (direction > 0 && j >= m_clients.count() - 1) {
-                j = -1;
-            }
-            if (direction < 0 && j <= 0) {
-                j = m_clients.count();
-            }
-            if (j == i) {
-                return; // no suitable clients
-            }
-        }
-        c = m_clients.item(j);
-    }
-    c->activateAndWarp();
-}
-
 void WindowManager::eventKeyPress(XKeyEvent *ev) {
 
     enum {
@@ -117,14 +70,12 @@ void WindowManager::eventKeyPress(XKeyEvent *ev) {
 
         if (key == CONFIG_ALT_KEY) {
             m_altPressed = True;
-            m_altStateRetained = False;
         }
         if (ev->state & m_altModMask) {
             if (!m_altPressed) {
                 // oops! bug
                 // fprintf(stderr, "wmx: Alt key record in inconsistent state\n");
                 m_altPressed = True;
-                m_altStateRetained = False;
                 // fprintf(stderr, "state is %ld, mask is %ld\n", (long)ev->state, (long)m_altModMask);
             }
             // These key names also appear in Client::manage(), so
@@ -132,7 +83,7 @@ void WindowManager::eventKeyPress(XKeyEvent *ev) {
             switch (key) {
 
               case CONFIG_CIRCULATE_KEY: {
-                circulate(False);
+                ClientSwitcher switcher(this, (XEvent*) ev);
                 break;
               }
               case CONFIG_HIDE_KEY: {
@@ -199,7 +150,6 @@ void WindowManager::eventKeyPress(XKeyEvent *ev) {
 
             } // switch
         }
-        XSync(display(), False);
         XUngrabKeyboard(display(), CurrentTime);
     }
     return;
@@ -210,7 +160,6 @@ void WindowManager::eventKeyRelease(XKeyEvent *ev) {
 
     if (key == CONFIG_ALT_KEY) {
         m_altPressed = False;
-        m_altStateRetained = False;
         // fprintf(stderr, "state is %ld, mask is %ld\n", (long)ev->state, (long)m_altModMask);
     }
     return;
@@ -332,29 +281,16 @@ void Client::move(XButtonEvent *e) {
     int ft = CONFIG_FRAME_THICKNESS;
 
     XEvent event;
-    Boolean found;
-    struct timeval sleepval;
+    GrabEvents events(m_windowManager, DragMask | ExposureMask);
 
 #if CONFIG_BUMP_EVERYWHERE
-    EdgeRectList edges;
-    for (int i = 0; i < m_windowManager->clients().count(); ++i) {
-        m_windowManager->clients().item(i)->appendEdges(edges);
-    }
+    EdgeIndex &edges = m_windowManager->edgeIndex();
+    int edge;
 #endif
 
     m_doSomething = False;
     while (!done) {
-        found = False;
-        while (XCheckMaskEvent(display(), DragMask | ExposureMask, &event)) {
-            found = True;
-            if (event.type != MotionNotify) {
-                break;
-            }
-        }
-        if (!found) {
-            sleepval.tv_sec = 0;
-            sleepval.tv_usec = 1000;
-            select(0, 0, 0, 0, &sleepval);
+        if (!events.next(&event)) {
             continue;
         }
 
@@ -410,31 +346,25 @@ void Client::move(XButtonEvent *e) {
 #if CONFIG_BUMP_EVERYWHERE
                     if (!isTransient()) {
                         if (!bumpedh) {
-                            for (int i = 0; i < edges.count(); ++i) {
-                                if (nx < x && nx <= edges.item(i).right - xi + ft && nx > edges.item(i).right - xi + ft - bd) {
-                                    nx = edges.item(i).right - xi + ft;
-                                    // fprintf(stderr, "bumping at left\n");
-                                    bumpedh = 1;
-                                }
-                                if (nx > x && nx >= edges.item(i).left - m_w - xi && nx < edges.item(i).left - m_w - xi + bd) {
-                                    nx = edges.item(i).left - m_w - xi;
-                                    // fprintf(stderr, "bumping at right\n");
-                                    bumpedh = 1;
-                                }
+                            if (nx < x && edges.find(EdgeIndex::Right, nx + xi - ft, nx + xi - ft + bd - 1, this, edge)) {
+                                nx = edge - xi + ft;
+                                // fprintf(stderr, "bumping at left\n");
+                                bumpedh = 1;
+                            } else if (nx > x && edges.find(EdgeIndex::Left, nx + m_w + xi, nx + m_w + xi - bd + 1, this, edge)) {
+                                nx = edge - m_w - xi;
+                                // fprintf(stderr, "bumping at right\n");
+                                bumpedh = 1;
                             }
                         }
                         if (!bumpedv) {
-                            for (int i = 0; i < edges.count(); ++i) {
-                                if (ny < y && ny <= edges.item(i).bottom && ny > edges.item(i).bottom - bd) {
-                                    ny = edges.item(i).bottom;
-                                    // fprintf(stderr, "bumping at top\n");
-                                    bumpedv = 1;
-                                }
-                                if (ny > y && ny >= edges.item(i).top - m_h - yi && ny < edges.item(i).top - m_h - yi + bd) {
-                                    ny = edges.item(i).top - m_h - yi;
-                                    // fprintf(stderr, "bumping at bottom\n");
-                                    bumpedv = 1;
-                                }
+                            if (ny < y && edges.find(EdgeIndex::Bottom, ny, ny + bd - 1, this, edge)) {
+                                ny = edge;
+                                // fprintf(stderr, "bumping at top\n");
+                                bumpedv = 1;
+                            } else if (ny > y && edges.find(EdgeIndex::Top, ny + m_h + yi, ny + m_h + yi - bd + 1, this, edge)) {
+                                ny = edge - m_h - yi;
+                                // fprintf(stderr, "bumping at bottom\n");
+                                bumpedv = 1;
                             }
                         }
                     }
@@ -499,6 +429,27 @@ void Client::fixResizeDimensions(int &w, int &h, int &dw, int &dh) {
     }
 }
 
+// While a window grows, hold its right or bottom edge against the
+// near edge of another window until pushed CONFIG_BUMP_DISTANCE past
+// it, as moving does.
+void Client::bumpResize(int &w, int &h, int prevW, int prevH) {
+#if CONFIG_BUMP_EVERYWHERE
+    if (isTransient()) {
+        return;
+    }
+    EdgeIndex &edges = m_windowManager->edgeIndex();
+    int bd = CONFIG_BUMP_DISTANCE;
+    int edge;
+
+    if (w > prevW && edges.find(EdgeIndex::Left, m_x + w, m_x + w - bd + 1, this, edge) && edge - m_x >= prevW) {
+        w = edge - m_x;
+    }
+    if (h > prevH && edges.find(EdgeIndex::Top, m_y + h, m_y + h - bd + 1, this, edge) && edge - m_y >= prevH) {
+        h = edge - m_y;
+    }
+#endif
+}
+
 void Client::resize(XButtonEvent *e, Boolean horizontal, Boolean vertical) {
     if (isFixedSize()) {
         return;
@@ -537,104 +488,125 @@ void Client::resize(XButtonEvent *e, Boolean horizontal, Boolean vertical) {
     int w = m_w, h = m_h;
     int prevW, prevH;
     int dw, dh;
+    unsigned long mask;
 
     XEvent event;
-    Boolean found;
+    GrabEvents events(m_windowManager, DragMask | ExposureMask);
     Boolean done = False;
-    struct timeval sleepval;
+
+    // With a client that does _NET_WM_SYNC_REQUEST, each size waits
+    // until the client has drawn the one before (or given up on it,
+    // after CONFIG_SYNC_TIMEOUT), and only the newest size held back
+    // in the meantime is sent.
+    Boolean syncing = beginSyncResize();
+    Boolean awaiting = False;
+    unsigned long heldMask = 0L;
+    if (syncing) {
+        events.alsoDeliver(m_windowManager->syncAlarmEvent());
+    }
 
     m_doSomething = False;
     while (!done) {
-        found = False;
-        while (XCheckMaskEvent(display(), DragMask | ExposureMask, &event)) {
-            found = True;
-            if (event.type != MotionNotify) {
-                break;
-            }
-        }
-        if (!found) {
-            sleepval.tv_sec = 0;
-            sleepval.tv_usec = 10000;
-            select(0, 0, 0, 0, &sleepval);
+        // looked at every time round, as a stream of motion never
+        // lets next() come back empty-handed
+        if (awaiting && m_windowManager->timerExpired(WindowManager::SyncTimer)) {
+            awaiting = False;
+        } else if (!events.next(&event)) {
             continue;
-        }
+        } else if (syncing && event.type == m_windowManager->syncAlarmEvent()) {
+            if (!isSyncAnswer(&event)) {
+                continue;
+            }
+            m_windowManager->cancelTimer(WindowManager::SyncTimer);
+            awaiting = False;
+        } else {
 
-        switch (event.type) {
+            switch (event.type) {
 
-          default: {
-            fprintf(stderr, "wmx: unknown event type %d\n", event.type);
-            break;
-          }
-          case Expose: {
-            m_windowManager->dispatchEvent(&event);
-            break;
-          }
-          case ButtonPress: {
-            // don't like this
-            XUngrabPointer(display(), event.xbutton.time);
-            done = True;
-            break;
-          }
-          case ButtonRelease: {
-            x = event.xbutton.x;
-            y = event.xbutton.y;
-            if (!nobuttons(&event.xbutton)) {
-                x = -1;
-            }
-            m_windowManager->releaseGrab(&event.xbutton);
-            done = True;
-            break;
-          }
-          case MotionNotify: {
-            x = event.xbutton.x;
-            y = event.xbutton.y;
-            if (vertical && horizontal) {
-                prevH = h;
-                h = y - m_y;
-                prevW = w;
-                w = x - m_x;
-                fixResizeDimensions(w, h, dw, dh);
-                if (h == prevH && w == prevW) {
-                    break;
-                }
-                m_border->configure(m_x, m_y, w, h, CWWidth | CWHeight, 0);
-                if (CONFIG_RESIZE_UPDATE) {
-                    XResizeWindow(display(), m_window, w, h);
-                }
-                geometry.update(dw, dh);
-                m_doSomething = True;
-            } else if (vertical) {
-                prevH = h;
-                h = y - m_y;
-                fixResizeDimensions(w, h, dw, dh);
-                if (h == prevH) {
-                    break;
-                }
-                m_border->configure(m_x, m_y, w, h, CWHeight, 0);
-                if (CONFIG_RESIZE_UPDATE) {
-                    XResizeWindow(display(), m_window, w, h);
-                }
-                geometry.update(dw, dh);
-                m_doSomething = True;
-            } else {
-                prevW = w;
-                w = x - m_x;
-                fixResizeDimensions(w, h, dw, dh);
-                if (w == prevW) {
-                    break;
+              default: {
+                fprintf(stderr, "wmx: unknown event type %d\n", event.type);
+                break;
+              }
+              case Expose: {
+                m_windowManager->dispatchEvent(&event);
+                break;
+              }
+              case ButtonPress: {
+                // don't like this
+                XUngrabPointer(display(), event.xbutton.time);
+                done = True;
+                break;
+              }
+              case ButtonRelease: {
+                x = event.xbutton.x;
+                y = event.xbutton.y;
+                if (!nobuttons(&event.xbutton)) {
+                    x = -1;
                 }
-                m_border->configure(m_x, m_y, w, h, CWWidth, 0);
-                if (CONFIG_RESIZE_UPDATE) {
-                    XResizeWindow(display(), m_window, w, h);
+                m_windowManager->releaseGrab(&event.xbutton);
+                done = True;
+                break;
+              }
+              case MotionNotify: {
+                x = event.xbutton.x;
+                y = event.xbutton.y;
+                if (vertical && horizontal) {
+                    prevH = h;
+                    h = y - m_y;
+                    prevW = w;
+                    w = x - m_x;
+                    bumpResize(w, h, prevW, prevH);
+                    fixResizeDimensions(w, h, dw, dh);
+                    if (h == prevH && w == prevW) {
+                        break;
+                    }
+                    mask = CWWidth | CWHeight;
+                } else if (vertical) {
+                    prevH = h;
+                    h = y - m_y;
+                    bumpResize(w, h, w, prevH);
+                    fixResizeDimensions(w, h, dw, dh);
+                    if (h == prevH) {
+                        break;
+                    }
+                    mask = CWHeight;
+                } else {
+                    prevW = w;
+                    w = x - m_x;
+                    bumpResize(w, h, prevW, h);
+                    fixResizeDimensions(w, h, dw, dh);
+                    if (w == prevW) {
+                        break;
+                    }
+                    mask = CWWidth;
                 }
                 geometry.update(dw, dh);
+                heldMask |= mask;
                 m_doSomething = True;
-            }
+                break;
+              }
 
-            break;
-          }
+            } // switch
+        }
 
-        } // switch
+        if (!heldMask || awaiting || done) {
+            continue;
+        }
+
+        m_border->configure(m_x, m_y, w, h, heldMask, 0);
+        if (CONFIG_RESIZE_UPDATE) {
+            if (syncing) {
+                sendSyncRequest();
+                awaiting = True;
+                m_windowManager->setTimer(WindowManager::SyncTimer, CONFIG_SYNC_TIMEOUT);
+            }
+            XResizeWindow(display(), m_window, w, h);
+        }
+        heldMask = 0L;
+    }
+
+    if (syncing) {
+        endSyncResize();
     }
 
     if (m_doSomething) {
@@ -643,14 +615,17 @@ void Client::resize(XButtonEvent *e, Boolean horizontal, Boolean vertical) {
         if (vertical && horizontal) {
             m_w = x - m_x;
             m_h = y - m_y;
+            bumpResize(m_w, m_h, w, h);
             fixResizeDimensions(m_w, m_h, dw, dh);
             m_border->configure(m_x, m_y, m_w, m_h, CWWidth | CWHeight, 0, True);
         } else if (vertical) {
             m_h = y - m_y;
+            bumpResize(m_w, m_h, m_w, h);
             fixResizeDimensions(m_w, m_h, dw, dh);
             m_border->configure(m_x, m_y, m_w, m_h, CWHeight, 0, True);
         } else {
             m_w = x - m_x;
+            bumpResize(m_w, m_h, w, m_h);
             fixResizeDimensions(m_w, m_h, dw, dh);
             m_border->configure(m_x, m_y, m_w, m_h, CWWidth, 0, True);
         }
@@ -714,35 +689,23 @@ void Border::eventButton(XButtonEvent *e) {
     }
 
     XEvent event;
-    Boolean found;
+    GrabEvents events(windowManager(), MenuMask);
     Boolean done = False;
-    struct timeval sleepval;
     unsigned long tdiff = 0L;
     int x = e->x;
     int y = e->y;
     int action = 1;
-    int buttonSize = m_tabWidth[screen()] - TAB_TOP_HEIGHT * 2 - 4;
+    int buttonSize = tabWidth() - TAB_TOP_HEIGHT * 2 - 4;
 
-    XFillRectangle(display(), m_button, m_drawGC[screen()], 0, 0, buttonSize, buttonSize);
+    XFillRectangle(display(), m_button, theme().drawGC, 0, 0, buttonSize, buttonSize);
+    windowManager()->setTimer(WindowManager::DestroyTimer, CONFIG_DESTROY_WINDOW_DELAY);
 
     while (!done) {
-        found = False;
-
-        if (tdiff > CONFIG_DESTROY_WINDOW_DELAY && action == 1) {
+        if (windowManager()->timerExpired(WindowManager::DestroyTimer) && action == 1) {
             windowManager()->installCursor(WindowManager::DeleteCursor);
             action = 2;
         }
-        while (XCheckMaskEvent(display(), MenuMask, &event)) {
-            found = True;
-            if (event.type != MotionNotify) {
-                break;
-            }
-        }
-        if (!found) {
-            sleepval.tv_sec = 0;
-            sleepval.tv_usec = 50000;
-            select(0, 0, 0, 0, &sleepval);
-            tdiff += 50;
+        if (!events.next(&event)) {
             continue;
         }
 
@@ -766,6 +729,7 @@ void Border::eventButton(XButtonEvent *e) {
             if (x < 0 || y < 0 || x >= buttonSize || y >= buttonSize) {
                 action = 0;
             }
+            tdiff = event.xbutton.time - e->time;
             windowManager()->releaseGrab(&event.xbutton);
             done = True;
             break;
@@ -794,6 +758,7 @@ void Border::eventButton(XButtonEvent *e) {
 
     XClearWindow(display(), m_button);
     windowManager()->installCursor(WindowManager::NormalCursor);
+    windowManager()->cancelTimer(WindowManager::DestroyTimer);
 
     if (tdiff > 5000L) {        // do nothing, they dithered too long
         return;
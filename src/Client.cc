@@ -11,17 +11,185 @@
 // needed this to be able to use CARD32
 #include <X11/Xmd.h>
 
+#include <xcb/xcb.h>
+
 const char *const Client::m_defaultLabel = "incognito";
 
-implementList(EdgeRectList, EdgeRect);
+// The queries Client::manage makes, sent together over the manager's
+// xcb connection and collected in one go.  While a batch is current,
+// fetchProperty and getColormaps take their answers from it rather
+// than asking the server one at a time.  Each answer is used once;
+// asking again goes to the server.
+
+class PropertyBatch {
+
+public:
+    PropertyBatch(xcb_connection_t*, Window);
+    ~PropertyBatch();
+
+    // True if this one was fetched; reply is 0 if the request failed
+    Boolean take(Window, Atom, Atom type, long length, xcb_get_property_reply_t *&reply);
+    Boolean takeColormap(Window, Colormap&);
+
+    static PropertyBatch *current;
+
+private:
+    enum {
+        MaxProperties = 13
+    };
+
+    Window m_window;
+    int m_count;
+    Atom m_atom[MaxProperties];
+    Atom m_type[MaxProperties];
+    long m_length[MaxProperties];
+    xcb_get_property_cookie_t m_cookie[MaxProperties];
+    xcb_get_property_reply_t *m_reply[MaxProperties];
+    Boolean m_taken[MaxProperties];
+    void request(xcb_connection_t*, Atom, Atom type, long length);
+
+    Boolean m_haveColormap;
+    Colormap m_colormap;
+
+    PropertyBatch *m_previous;
+};
+
+PropertyBatch *PropertyBatch::current = 0;
+
+PropertyBatch::PropertyBatch(xcb_connection_t *c, Window w) :
+    m_window(w),
+    m_count(0),
+    m_haveColormap(False),
+    m_colormap(None),
+    m_previous(current)
+{
+    // in the order manage asks for them
+    request(c, XA_WM_ICON_NAME, AnyPropertyType, 100L);
+    request(c, XA_WM_NAME, AnyPropertyType, 100L);
+    request(c, Atoms::netwm_wmName, Atoms::utf8String, 100L);
+    request(c, Atoms::wm_colormaps, XA_WINDOW, 100L);
+    request(c, Atoms::wm_protocols, XA_ATOM, 20L);
+    request(c, Atoms::netwm_syncRequestCounter, XA_CARDINAL, 1L);
+    request(c, XA_WM_TRANSIENT_FOR, XA_WINDOW, 1L);
+    request(c, Atoms::netwm_winType, XA_ATOM, 100L);
+    request(c, XA_WM_HINTS, XA_WM_HINTS, WM_HINTS_ELEMENTS);
+    request(c, Atoms::wm_state, Atoms::wm_state, 2L);
+    request(c, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, SIZE_HINTS_ELEMENTS);
+    request(c, Atoms::netwm_winState, XA_CARDINAL, 100L);
+    request(c, Atoms::netwm_winHints, XA_CARDINAL, 100L);
+
+    xcb_get_window_attributes_cookie_t attrCookie = xcb_get_window_attributes(c, w);
+    WindowManager::noteRoundTrip();
+
+    for (int i = 0; i < m_count; ++i) {
+        xcb_generic_error_t *error = 0;
+        m_reply[i] = xcb_get_property_reply(c, m_cookie[i], &error);
+        m_taken[i] = False;
+        free(error);
+    }
+
+    xcb_generic_error_t *error = 0;
+    xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(c, attrCookie, &error);
+    if (attr) {
+        m_haveColormap = True;
+        m_colormap = attr->colormap;
+        free(attr);
+    }
+    free(error);
+
+    current = this;
+}
+
+PropertyBatch::~PropertyBatch() {
+    for (int i = 0; i < m_count; ++i) {
+        free(m_reply[i]);
+    }
+    current = m_previous;
+}
+
+void PropertyBatch::request(xcb_connection_t *c, Atom a, Atom type, long length) {
+    assert(m_count < MaxProperties);
+    m_atom[m_count] = a;
+    m_type[m_count] = type;
+    m_length[m_count] = length;
+    m_cookie[m_count] = xcb_get_property(c, False, m_window, a, type, 0, length);
+    ++m_count;
+}
+
+Boolean PropertyBatch::take(Window w, Atom a, Atom type, long length, xcb_get_property_reply_t *&reply) {
+    if (w != m_window) {
+        return False;
+    }
+    for (int i = 0; i < m_count; ++i) {
+        if (!m_taken[i] && m_atom[i] == a && m_type[i] == type && m_length[i] == length) {
+            m_taken[i] = True;
+            reply = m_reply[i];
+            m_reply[i] = 0;
+            return True;
+        }
+    }
+    return False;
+}
+
+Boolean PropertyBatch::takeColormap(Window w, Colormap &colormap) {
+    if (w != m_window || !m_haveColormap) {
+        return False;
+    }
+    m_haveColormap = False;
+    colormap = m_colormap;
+    return True;
+}
+
+// XGetWindowProperty, or the equivalent from the current batch.  The
+// data come back laid out as Xlib would have it (32-bit items widened
+// to long, with a terminating zero byte) so callers can't tell.
+
+static int fetchProperty(Display *d, Window w, Atom a, Atom type, long len, Atom *realType, int *format, unsigned long *n, unsigned long *extra, unsigned char **p) {
+    xcb_get_property_reply_t *reply = 0;
+
+    if (!PropertyBatch::current || !PropertyBatch::current->take(w, a, type, len, reply)) {
+        return XGetWindowProperty(d, w, a, 0L, len, False, type, realType, format, n, extra, p);
+    }
+
+    *p = 0;
+    if (!reply) {
+        return BadWindow;
+    }
+
+    *realType = reply->type;
+    *format = reply->format;
+    *n = reply->value_len;
+    *extra = reply->bytes_after;
+
+    if (reply->type != None) {
+        size_t size = (*format == 32 ? sizeof(long) : *format == 16 ? sizeof(short) : 1);
+        unsigned char *data = (unsigned char*) xcb_get_property_value(reply);
+        *p = (unsigned char*) malloc(*n * size + 1);
+        for (unsigned long i = 0; i < *n; ++i) {
+            if (*format == 32) {
+                ((long*) *p)[i] = ((int32_t*) data)[i];
+            } else if (*format == 16) {
+                ((short*) *p)[i] = ((int16_t*) data)[i];
+            } else {
+                (*p)[i] = data[i];
+            }
+        }
+        (*p)[*n * size] = '\0';
+    }
 
-Client::Client(WindowManager *const wm, Window w, Boolean shaped) :
+    free(reply);
+    return Success;
+}
+
+static int getProperty_aux(Display*, Window, Atom, Atom, long, unsigned char**);
+static Boolean getInitialState(Display*, Window, int*, Window*);
+static Boolean getNormalHints(Display*, Window, XSizeHints*);
+
+Client::Client(WindowManager *const wm, Window w, Boolean shaped, XWindowAttributes *known) :
     m_window(w),
     m_transient(None),
-    m_groupParent(None),
     m_border(0),
     m_shaped(shaped),
-    m_revert(0),
     m_wroot(None),
     m_screen(0),
     m_doSomething(False),
@@ -30,6 +198,7 @@ Client::Client(WindowManager *const wm, Window w, Boolean shaped) :
     m_focusOnClick(False),
     m_layer(NORMAL_LAYER),
     m_type(NormalClient),
+    m_edgesIndexed(False),
     m_levelRaised(False),
     m_speculating(False),
     m_fixedSize(False),
@@ -38,15 +207,21 @@ Client::Client(WindowManager *const wm, Window w, Boolean shaped) :
     m_minHeight(0),
     m_state(WithdrawnState),
     m_protocol(0),
+    m_syncCounter(None),
+    m_syncAlarm(None),
+    m_syncValue(0),
     m_managed(False),
     m_reparenting(False),
     m_stubborn(False),
     m_lastPopTime(0L),
     m_isFullHeight(False),
     m_isFullWidth(False),
+    m_netwmName(NULL),
     m_name(NULL),
     m_iconName(NULL),
     m_label(NULL),
+    m_lastRename(0),
+    m_renamePending(False),
     m_colormap(None),
     m_colormapWinCount(0),
     m_colormapWindows(NULL),
@@ -54,7 +229,11 @@ Client::Client(WindowManager *const wm, Window w, Boolean shaped) :
     m_windowManager(wm)
 {
     XWindowAttributes attr;
-    XGetWindowAttributes(display(), m_window, &attr);
+    if (known) {
+        attr = *known;
+    } else {
+        XGetWindowAttributes(display(), m_window, &attr);
+    }
 
     m_x = attr.x;
     m_y = attr.y;
@@ -62,11 +241,13 @@ Client::Client(WindowManager *const wm, Window w, Boolean shaped) :
     m_h = attr.height;
     m_bw = attr.border_width;
     m_wroot = attr.root;
-    m_name = m_iconName = 0;
+    m_netwmName = m_name = m_iconName = 0;
     m_sizeHints.flags = 0L;
 
     wm->setScreenFromRoot(m_wroot);
     m_screen = wm->screen();
+    wm->registerWindow(m_window, this);
+    wm->linkClient(this);
 
     m_label = NewString(m_defaultLabel);
     m_border = new Border(this, w);
@@ -105,7 +286,7 @@ void Client::release() {
         fprintf(stderr, "wmx: invalid parent in Client::release (released twice?)\n");
     }
 
-    windowManager()->skipInRevert(this, m_revert);
+    windowManager()->skipInRevert(this, revertTo());
 
     if (isHidden()) {
         unhide(False);
@@ -113,10 +294,11 @@ void Client::release() {
     windowManager()->removeFromOrderedList(this);
 
     if (isActive()) {
+        Client *revert = revertTo();
         if (CONFIG_CLICK_TO_FOCUS || isFocusOnClick()) {
-            if (m_revert) {
-                windowManager()->setActiveClient(m_revert);
-                m_revert->activate();
+            if (revert) {
+                windowManager()->setActiveClient(revert);
+                revert->activate();
             } else {
                 windowManager()->setActiveClient(0);
             }
@@ -125,19 +307,32 @@ void Client::release() {
         }
     }
 
+    windowManager()->unlinkClient(this);
+
+    windowManager()->unregisterWindow(m_window, this);
     m_window = None;
+    updateEdges();
 
     if (m_colormapWinCount > 0) {
+        for (int i = 0; i < m_colormapWinCount; ++i) {
+            windowManager()->unregisterWindow(m_colormapWindows[i], this);
+        }
         XFree((char*) m_colormapWindows);
         free((char*) m_windowColormaps); // not allocated through X
     }
 
+    if (m_renamePending) {
+        windowManager()->cancelRetitle(this);
+    }
     if (m_iconName) {
         XFree(m_iconName);
     }
     if (m_name) {
         XFree(m_name);
     }
+    if (m_netwmName) {
+        XFree(m_netwmName);
+    }
     if (m_label) {
         free((void*) m_label);
     }
@@ -146,13 +341,14 @@ void Client::release() {
 
 void Client::unreparent() {
     XWindowChanges wc;
+    windowManager()->ignoreErrors();
     if (!isWithdrawn()) {
         gravitate(True);
         XReparentWindow(display(), m_window, root(), m_x, m_y);
     }
     wc.border_width = m_bw;
     XConfigureWindow(display(), m_window, CWBorderWidth, &wc);
-    XSync(display(), True);
+    windowManager()->endIgnoringErrors();
 }
 
 void Client::installColormap() {
@@ -169,10 +365,8 @@ void Client::installColormap() {
         if (found == 0) {
             windowManager()->installColormap(m_colormap);
         }
-    } else if (m_transient != None && (cc = windowManager()->windowToClient(m_transient))) {
-        if (cc) {
-            cc->installColormap();
-        }
+    } else if ((cc = transientParent())) {
+        cc->installColormap();
     } else {
         windowManager()->installColormap(m_colormap);
     }
@@ -181,11 +375,10 @@ void Client::installColormap() {
 void Client::manage(Boolean mapped) {
     static int lastX = 0, lastY = 0;
     Boolean shouldHide, reshape;
-    XWMHints *hints;
     Display *d = display();
-    long mSize;
     int state;
 
+
     //!!!
     XSelectInput(d, m_window, ColormapChangeMask | EnterWindowMask | PropertyChangeMask | FocusChangeMask | KeyPressMask | KeyReleaseMask);
 
@@ -222,8 +415,15 @@ void Client::manage(Boolean mapped) {
         }
     }
 
+    // Everything we're about to ask about the window, in one go.  It
+    // shares Xlib's connection, so the XSelectInput above is already
+    // ahead of it and no change in between can be missed.
+    PropertyBatch *batch = new PropertyBatch(windowManager()->xcbConnection(), m_window);
+
     m_iconName = getProperty(XA_WM_ICON_NAME);
     m_name = getProperty(XA_WM_NAME);
+    int nameLength;
+    m_netwmName = getProperty(Atoms::netwm_wmName, Atoms::utf8String, nameLength);
     setLabel();
 
     getColormaps();
@@ -233,15 +433,15 @@ void Client::manage(Boolean mapped) {
 
     // fprintf(stderr, "managing client, name = \"%s\"\n", m_name);
 
-    hints = XGetWMHints(d, m_window);
+    int initialState;
+    Window group;
+    Boolean haveHints = getInitialState(d, m_window, &initialState, &group);
+    windowManager()->setWindowGroup(this, group);
     if (!getState(&state)) {
-        state = hints ? hints->initial_state : NormalState;
+        state = haveHints ? initialState : NormalState;
     }
     shouldHide = (state == IconicState);
-    if (hints) {
-        XFree(hints);
-    }
-    if (XGetWMNormalHints(d, m_window, &m_sizeHints, &mSize) == 0 || m_sizeHints.flags == 0) {
+    if (!getNormalHints(d, m_window, &m_sizeHints) || m_sizeHints.flags == 0) {
         m_sizeHints.flags = PSize;
     }
 
@@ -377,6 +577,8 @@ void Client::manage(Boolean mapped) {
         XFree(property);
     }
 
+    delete batch;
+
     m_windowManager->hoistToTop(this);
 
     sendConfigureNotify(); // due to Martin Andrews
@@ -456,13 +658,14 @@ void Client::activate() {
     // now set revert of window that reverts to this one so as to
     // revert to the window this one used to revert to (huh?)
 
-    windowManager()->skipInRevert(this, m_revert);
+    windowManager()->skipInRevert(this, revertTo());
 
     if (previouslyActive && previouslyActive != this) {
-        m_revert = previouslyActive;
-        while (m_revert && !m_revert->isNormal()) {
-            m_revert = m_revert->revertTo();
+        Client *revert = previouslyActive;
+        while (revert && !revert->isNormal()) {
+            revert = revert->revertTo();
         }
+        setRevertTo(revert);
     }
 
     decorate(True);
@@ -518,6 +721,7 @@ void Client::setLayer(int newLayer) {
     m_layer = newLayer;
     windowManager()->hoistToTop(this);  // Puts this client at the top of the list for its layer.
     windowManager()->updateStackingOrder();
+    updateEdges(); // borderless or not may have changed
     // fprintf(stderr, "wmx: Moving client \"%s\" to layer %d\n", name(), m_layer);
 }
 
@@ -541,6 +745,76 @@ void Client::sendMessage(Atom a, long l) {
     }
 }
 
+// Set up an alarm on the client's sync counter for the length of a
+// resize.  False if the client doesn't do _NET_WM_SYNC_REQUEST, or its
+// counter has gone, in which case the resize goes on as before.
+
+Boolean Client::beginSyncResize() {
+    XSyncValue value;
+
+    if (m_syncCounter == None || !CONFIG_RESIZE_UPDATE) {
+        return False;
+    }
+    if (!XSyncQueryCounter(display(), m_syncCounter, &value)) {
+        return False;
+    }
+    m_syncValue = ((long long) XSyncValueHigh32(value) << 32) | XSyncValueLow32(value);
+
+    XSyncAlarmAttributes attr;
+    attr.trigger.counter = m_syncCounter;
+    attr.trigger.value_type = XSyncAbsolute;
+    attr.trigger.test_type = XSyncPositiveComparison;
+    XSyncIntToValue(&attr.trigger.wait_value, 0);
+    XSyncIntToValue(&attr.delta, 0);
+    attr.events = True;
+    m_syncAlarm = XSyncCreateAlarm(display(), XSyncCACounter | XSyncCAValueType | XSyncCATestType | XSyncCAValue | XSyncCADelta | XSyncCAEvents, &attr);
+    return m_syncAlarm != None;
+}
+
+// Ask the client to set its counter to the next value once it has
+// dealt with the size that follows, and have the alarm go off then
+
+void Client::sendSyncRequest() {
+    XEvent ev;
+
+    ++m_syncValue;
+
+    XSyncAlarmAttributes attr;
+    XSyncIntsToValue(&attr.trigger.wait_value, (unsigned int) (m_syncValue & 0xffffffff), (int) (m_syncValue >> 32));
+    XSyncChangeAlarm(display(), m_syncAlarm, XSyncCAValue, &attr);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.xclient.type = ClientMessage;
+    ev.xclient.window = m_window;
+    ev.xclient.message_type = Atoms::wm_protocols;
+    ev.xclient.format = 32;
+    ev.xclient.data.l[0] = Atoms::netwm_syncRequest;
+    ev.xclient.data.l[1] = windowManager()->timestamp(False);
+    ev.xclient.data.l[2] = (long) (m_syncValue & 0xffffffff);
+    ev.xclient.data.l[3] = (long) (m_syncValue >> 32);
+    XSendEvent(display(), m_window, False, 0L, &ev);
+}
+
+Boolean Client::isSyncAnswer(XEvent *e) {
+    if (e->type != windowManager()->syncAlarmEvent()) {
+        return False;
+    }
+    XSyncAlarmNotifyEvent *ae = (XSyncAlarmNotifyEvent*) e;
+    if (ae->alarm != m_syncAlarm) {
+        return False;
+    }
+    long long value = ((long long) XSyncValueHigh32(ae->counter_value) << 32) | XSyncValueLow32(ae->counter_value);
+    return value >= m_syncValue;
+}
+
+void Client::endSyncResize() {
+    if (m_syncAlarm != None) {
+        XSyncDestroyAlarm(display(), m_syncAlarm);
+        m_syncAlarm = None;
+    }
+    windowManager()->cancelTimer(WindowManager::SyncTimer);
+}
+
 static int getProperty_aux(Display *d, Window w, Atom a, Atom type, long len, unsigned char **p) {
     Atom realType;
     int format;
@@ -549,7 +823,7 @@ static int getProperty_aux(Display *d, Window w, Atom a, Atom type, long len, un
     Boolean retried = False;
 
     tryagain:
-       status = XGetWindowProperty(d, w, a, 0L, len, False, type, &realType, &format, &n, &extra, p);
+       status = fetchProperty(d, w, a, type, len, &realType, &format, &n, &extra, p);
        // fprintf(stderr, "XGetWindowProperty: len = %ld, return count = %lu, format = %d, pointer = %p\n", len, n, format, *p);
 
     if (status != Success || *p == 0) {
@@ -560,6 +834,9 @@ static int getProperty_aux(Display *d, Window w, Atom a, Atom type, long len, un
         *p = 0;
         return n;
     }
+    if (realType == Atoms::utf8String && format == 8) {
+        return n; // already as we draw it
+    }
     if (type == XA_STRING || type == AnyPropertyType || retried) {
         if (realType != XA_STRING || format != 8) {
             fprintf(stderr, "string property for window %lx is not an 8-bit string\n", w);
@@ -627,12 +904,77 @@ char* Client::getProperty(Atom a, Atom type, int &length) {
     return (char*) p;
 }
 
+// XGetWMHints and XGetWMNormalHints, reading through getProperty_aux
+// so as to use the batch if there is one.  We only want initial_state
+// out of WM_HINTS.
+
+// The window group comes from the same property, so it's read here
+// too; None if the hints don't name one
+
+static Boolean getInitialState(Display *d, Window w, int *state, Window *group) {
+    long *p = 0;
+    *group = None;
+    int n = getProperty_aux(d, w, XA_WM_HINTS, XA_WM_HINTS, WM_HINTS_ELEMENTS, (unsigned char**) &p);
+    if (n <= 0) {
+        return False;
+    }
+    Boolean valid = (n >= WM_HINTS_ELEMENTS - 1);
+    if (valid) {
+        *state = (int) p[2];
+    }
+    if (n >= WM_HINTS_ELEMENTS && (p[0] & WindowGroupHint)) {
+        *group = (Window) p[8];
+    }
+    XFree((char*) p);
+    return valid;
+}
+
+static Boolean getNormalHints(Display *d, Window w, XSizeHints *hints) {
+    long *p = 0;
+    int n = getProperty_aux(d, w, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, SIZE_HINTS_ELEMENTS, (unsigned char**) &p);
+    if (n <= 0) {
+        return False;
+    }
+    if (n < OLD_SIZE_HINTS_ELEMENTS) {
+        XFree((char*) p);
+        return False;
+    }
+    hints->flags = p[0] & (USPosition | USSize | PAllHints | PBaseSize | PWinGravity);
+    hints->x = (int) p[1];
+    hints->y = (int) p[2];
+    hints->width = (int) p[3];
+    hints->height = (int) p[4];
+    hints->min_width = (int) p[5];
+    hints->min_height = (int) p[6];
+    hints->max_width = (int) p[7];
+    hints->max_height = (int) p[8];
+    hints->width_inc = (int) p[9];
+    hints->height_inc = (int) p[10];
+    hints->min_aspect.x = (int) p[11];
+    hints->min_aspect.y = (int) p[12];
+    hints->max_aspect.x = (int) p[13];
+    hints->max_aspect.y = (int) p[14];
+    if (n >= SIZE_HINTS_ELEMENTS) {
+        hints->base_width = (int) p[15];
+        hints->base_height = (int) p[16];
+        hints->win_gravity = (int) p[17];
+    } else {
+        // pre-ICCCM version 1 property
+        hints->flags &= ~(PBaseSize | PWinGravity);
+        hints->base_width = hints->base_height = 0;
+        hints->win_gravity = 0;
+    }
+    XFree((char*) p);
+    return True;
+}
+
 void Client::setState(int state) {
     m_state = state;
     CARD32 data[2];
     data[0] = (CARD32) state;
     data[1] = (CARD32) None;
     XChangeProperty(display(), m_window, Atoms::wm_state, Atoms::wm_state, 32, PropModeReplace, (unsigned char*) data, 2);
+    updateEdges();
 }
 
 Boolean Client::getState(int *state) {
@@ -657,9 +999,20 @@ void Client::getProtocols() {
             m_protocol |= Pdelete;
         } else if (p[i] == Atoms::wm_takeFocus) {
             m_protocol |= PtakeFocus;
+        } else if (p[i] == Atoms::netwm_syncRequest) {
+            m_protocol |= PsyncRequest;
         }
     }
     XFree((char*) p);
+
+    m_syncCounter = None;
+    if ((m_protocol & PsyncRequest) && windowManager()->syncAlarmEvent()) {
+        unsigned long *counter;
+        if (getProperty_aux(display(), m_window, Atoms::netwm_syncRequestCounter, XA_CARDINAL, 1L, (unsigned char**) &counter) > 0) {
+            m_syncCounter = (XSyncCounter) counter[0];
+            XFree((char*) counter);
+        }
+    }
 }
 
 void Client::gravitate(Boolean invert) {
@@ -739,7 +1092,9 @@ void Client::gravitate(Boolean invert) {
 Boolean Client::setLabel(void) {
     const char *newLabel;
 
-    if (m_name) {
+    if (m_netwmName && *m_netwmName) {
+        newLabel = m_netwmName;
+    } else if (m_name) {
         newLabel = m_name;
     } else if (m_iconName) {
         newLabel = m_iconName;
@@ -754,7 +1109,7 @@ Boolean Client::setLabel(void) {
         m_label = NewString(newLabel);
         return True;
     } else {
-        return True; // False; // dammit!
+        return False;
     }
 }
 
@@ -764,13 +1119,20 @@ void Client::getColormaps(void) {
     XWindowAttributes attr;
 
     if (!m_managed) {
-        XGetWindowAttributes(display(), m_window, &attr);
-        m_colormap = attr.colormap;
+        if (!PropertyBatch::current || !PropertyBatch::current->takeColormap(m_window, m_colormap)) {
+            XGetWindowAttributes(display(), m_window, &attr);
+            m_colormap = attr.colormap;
+        }
     }
 
     n = getProperty_aux(display(), m_window, Atoms::wm_colormaps, XA_WINDOW, 100L, (unsigned char**) &cw);
 
     if (m_colormapWinCount != 0) {
+        for (i = 0; i < m_colormapWinCount; ++i) {
+            if (m_colormapWindows[i] != m_window) {
+                windowManager()->unregisterWindow(m_colormapWindows[i], this);
+            }
+        }
         XFree((char*) m_colormapWindows);
         free((char*) m_windowColormaps);
     }
@@ -785,15 +1147,36 @@ void Client::getColormaps(void) {
 
     m_windowColormaps = (Colormap*) malloc(n * sizeof(Colormap));
 
+    // ask about all the colormap windows before waiting on any
+    xcb_connection_t *c = windowManager()->xcbConnection();
+    xcb_get_window_attributes_cookie_t *cookies = (xcb_get_window_attributes_cookie_t*)
+    malloc(n * sizeof(xcb_get_window_attributes_cookie_t));
+    for (i = 0; i < n; ++i) {
+        if (cw[i] != m_window) {
+            cookies[i] = xcb_get_window_attributes(c, cw[i]);
+        }
+    }
+    WindowManager::noteRoundTrip();
+
     for (i = 0; i < n; ++i) {
         if (cw[i] == m_window) {
             m_windowColormaps[i] = m_colormap;
         } else {
+            // don't steal a window that already belongs to someone
+            if (!windowManager()->isRegisteredWindow(cw[i])) {
+                windowManager()->registerWindow(cw[i], this);
+            }
             XSelectInput(display(), cw[i], ColormapChangeMask);
-            XGetWindowAttributes(display(), cw[i], &attr);
-            m_windowColormaps[i] = attr.colormap;
+            xcb_generic_error_t *error = 0;
+            xcb_get_window_attributes_reply_t *reply =
+            xcb_get_window_attributes_reply(c, cookies[i], &error);
+            m_windowColormaps[i] = reply ? reply->colormap : None;
+            free(reply);
+            free(error);
         }
     }
+
+    free(cookies);
 }
 
 void Client::getClientType() {
@@ -811,11 +1194,6 @@ void Client::getClientType() {
         // fprintf(stderr, "got property, count = %d\n", count);
         for (int i = 0; i < count; ++i) {
             Atom typeAtom = ((Atom*) property)[i];
-            char *name = XGetAtomName(display(), typeAtom);
-            // fprintf(stderr, "window type property item %d is \"%s\"\n", i, name);
-            if (name) {
-                XFree(name);
-            }
             if (typeAtom == Atoms::netwm_winType_desktop) {
                 m_type = DesktopClient;
                 m_layer = DESKTOP_LAYER;
@@ -858,7 +1236,10 @@ void Client::getClientType() {
 
 void Client::getTransient() {
     Window t = None;
-    if (XGetTransientForHint(display(), m_window, &t) != 0) {
+    Window *p = 0;
+    if (getProperty_aux(display(), m_window, XA_WM_TRANSIENT_FOR, XA_WINDOW, 1L, (unsigned char**) &p) > 0) {
+        t = p[0];
+        XFree((char*) p);
         if (windowManager()->windowToClient(t) == this) {
             fprintf(stderr, "wmx: warning: client \"%s\" thinks it's a transient for itself -- ignoring WM_TRANSIENT_FOR property...\n", m_label ? m_label : "(no name)");
             m_transient = None;
@@ -868,6 +1249,7 @@ void Client::getTransient() {
     } else {
         m_transient = None;
     }
+    windowManager()->setTransientFor(this, m_transient);
 }
 
 void Client::hide() {
@@ -921,10 +1303,14 @@ void Client::sendConfigureNotify() {
     ce.above = None;
     ce.override_redirect = 0;
     XSendEvent(display(), m_window, False, StructureNotifyMask, (XEvent*) &ce);
+
+    // every change to our idea of the geometry ends up here
+    updateEdges();
 }
 
 void Client::withdraw(Boolean changeState) {
     // fprintf(stderr, "withdraw: changeState = %d\n", (int) changeState);
+    windowManager()->ignoreErrors(); // it may be on its way out
     m_border->unmap();
     gravitate(True);
     XReparentWindow(display(), m_window, root(), m_x, m_y);
@@ -933,9 +1319,7 @@ void Client::withdraw(Boolean changeState) {
         XRemoveFromSaveSet(display(), m_window);
         setState(WithdrawnState);
     }
-    ignoreBadWindowErrors = True;
-    XSync(display(), False);
-    ignoreBadWindowErrors = False;
+    windowManager()->endIgnoringErrors();
 }
 
 void Client::unwithdraw() {
@@ -953,10 +1337,29 @@ void Client::unwithdraw() {
 }
 
 void Client::rename() {
+    m_renamePending = False;
+    m_lastRename = WindowManager::monotonicTime();
     m_border->configure(0, 0, m_w, m_h, CWWidth | CWHeight, Above);
     m_border->expose(0);
 }
 
+// Titles that change faster than the screen (progress counters and
+// the like) are redrawn once a frame at most, showing whatever the
+// label is by then
+
+void Client::retitle() {
+    if (m_renamePending) {
+        return;
+    }
+    long long due = m_lastRename + 1000000LL / CONFIG_TITLE_RATE;
+    if (WindowManager::monotonicTime() >= due) {
+        rename();
+    } else {
+        m_renamePending = True;
+        windowManager()->retitleLater(this, due);
+    }
+}
+
 void Client::mapRaised() {
     m_border->map(); // or mapRaised() ?
     windowManager()->hoistToTop(this);
@@ -1170,7 +1573,7 @@ void Client::removeFeedback(Boolean mapped) {
                 if (!mapped) {
                     hide();
                 }
-                XSync(display(), False);
+                XFlush(display());
             } else {
                 // not much we can do
             }
@@ -1184,22 +1587,32 @@ void Client::updateFromNetwmProperty(Atom property, unsigned char state) {
     return;
 }
 
-void Client::appendEdges(EdgeRectList &list) {
-    if (!m_managed || !isNormal() || isTransient()) {
-        return;
-    }
+void Client::updateEdges() {
+    Boolean indexed = m_managed && isNormal() && !isTransient() && !isKilled();
     EdgeRect r;
-    if (isBorderless()) {
-        r.left = m_x - 1;
-        r.top = m_y - 1;
-    } else {
-        r.left = m_x - CONFIG_FRAME_THICKNESS;
-        r.top = m_y - CONFIG_FRAME_THICKNESS;
+    if (indexed) {
+        if (isBorderless()) {
+            r.left = m_x - 1;
+            r.top = m_y - 1;
+        } else {
+            r.left = m_x - CONFIG_FRAME_THICKNESS;
+            r.top = m_y - CONFIG_FRAME_THICKNESS;
+        }
+        r.right = m_x + m_w;
+        r.bottom = m_y + m_h;
+    }
+    if (m_edgesIndexed) {
+        if (indexed && r.left == m_edges.left && r.right == m_edges.right && r.top == m_edges.top && r.bottom == m_edges.bottom) {
+            return;
+        }
+        m_windowManager->edgeIndex().remove(this, m_edges);
     }
-    r.right = m_x + m_w;
-    r.bottom = m_y + m_h;
     // fprintf(stderr, "edges: H %d - %d  V %d - %d  for \"%s\"\n", r.left, r.right, r.top, r.bottom, name());
-    list.append(r);
+    m_edgesIndexed = indexed;
+    if (indexed) {
+        m_edges = r;
+        m_windowManager->edgeIndex().insert(this, r);
+    }
 }
 
 void Client::printClientData() {
@@ -1277,6 +1690,6 @@ void Client::printClientData() {
 
     printf(
             "\n     * Transient for: %lx - Group parent: %lx - Revert to: %p (%lx)\n",
-            m_transient, m_groupParent, m_revert,
-            m_revert ? m_revert->window() : None);
+            m_transient, m_relations.group, revertTo(),
+            revertTo() ? revertTo()->window() : None);
 }
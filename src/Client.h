@@ -5,27 +5,11 @@
 #include "Manager.h"
 #include "Border.h"
 
-class EdgeRect {
-
-public:
-    EdgeRect() :
-        left(0),
-        right(0),
-        top(0),
-        bottom(0)
-        {}
-
-    ~EdgeRect() {}
-
-    int left, right, top, bottom;
-};
-
-declareList(EdgeRectList, EdgeRect);
-
 class Client {
 
 public:
-    Client(WindowManager* const, Window, Boolean);
+    // attributes may be passed in if the caller already has them
+    Client(WindowManager* const, Window, Boolean, XWindowAttributes* = 0);
     void release();
 
     /* for call from WindowManager: */
@@ -40,6 +24,7 @@ public:
     void hide();
     void unhide(Boolean map);
     void rename();
+    void retitle(); // rename, unless it was done less than a frame ago
     void kill();
     void mapRaised(); // without activating
     void lower();
@@ -60,10 +45,10 @@ public:
     Boolean hasWindow(Window);
 
     Client* revertTo() {
-        return m_revert;
+        return m_relations.revert;
     }
     void setRevertTo(Client *c) {
-        m_revert = c;
+        m_windowManager->setRevertTo(this, c);
     }
 
     Boolean isHidden() {
@@ -96,6 +81,9 @@ public:
     Window transientFor() {
         return m_transient;
     }
+    Client* transientParent() { // zero if we don't have it
+        return m_relations.parent;
+    }
     Boolean isFixedSize() {
         return m_fixedSize;
     }
@@ -204,7 +192,14 @@ public:
         return m_window;
     }
 
-    void appendEdges(EdgeRectList&);
+    void updateEdges(); // in the manager's EdgeIndex
+
+    StackEntry& stackEntry() {
+        return m_stackEntry;
+    }
+    RelationEntry& relations() {
+        return m_relations;
+    }
 
 protected: // cravenly submitting to gcc's warnings
     ~Client();
@@ -212,13 +207,10 @@ protected: // cravenly submitting to gcc's warnings
 private:
     Window m_window;
     Window m_transient;
-    Window m_groupParent;
     Border *m_border;
 
     Boolean m_shaped;
 
-    Client *m_revert;
-
     int m_x;
     int m_y;
     int m_w;
@@ -233,6 +225,10 @@ private:
     Boolean m_focusOnClick;
     int m_layer;
     ClientType m_type;
+    StackEntry m_stackEntry;
+    RelationEntry m_relations;
+    EdgeRect m_edges; // as last put in the EdgeIndex
+    Boolean m_edgesIndexed;
 
     Boolean m_levelRaised;
     Boolean m_speculating;
@@ -243,10 +239,23 @@ private:
     int m_minWidth;
     int m_minHeight;
     void fixResizeDimensions(int&, int&, int&, int&);
+    void bumpResize(int&, int&, int, int);
     Boolean coordsInHole(int, int);
 
     int m_state;
     int m_protocol;
+
+    // _NET_WM_SYNC_REQUEST: during a resize the client is sent a
+    // value before each new size and sets the counter to it once it
+    // has redrawn.  m_syncCounter is None if the client doesn't take
+    // part.
+    XSyncCounter m_syncCounter;
+    XSyncAlarm m_syncAlarm;
+    long long m_syncValue;
+    Boolean beginSyncResize();
+    void sendSyncRequest();
+    Boolean isSyncAnswer(XEvent*);
+    void endSyncResize();
     Boolean m_managed;
     Boolean m_reparenting;
     Boolean m_stubborn; // keeps popping itself to the front
@@ -259,9 +268,12 @@ private:
     int m_normalW;
     int m_normalX;
 
+    char *m_netwmName; // UTF-8, and preferred to m_name
     char *m_name;
     char *m_iconName;
     const char *m_label; // alias: one of (instance,class,name,iconName)
+    long long m_lastRename;
+    Boolean m_renamePending; // on the manager's TitleTimer
     static const char *const m_defaultLabel;
 
     Colormap m_colormap;
@@ -291,7 +303,8 @@ private:
     void decorate(Boolean active);
 };
 
-#define Pdelete    1
-#define PtakeFocus 2
+#define Pdelete      1
+#define PtakeFocus   2
+#define PsyncRequest 4
 
 #endif
@@ -0,0 +1,351 @@
+#include "CommandTree.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+// Far deeper than anyone's menu.  Symlink loops are caught by
+// findSame; this just bounds a tree that's deep for real.
+#define COMMAND_TREE_MAX_DEPTH 16
+
+#define COMMAND_TREE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                             IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static int sortstrs(const void *va, const void *vb) {
+    char **a = (char**) va;
+    char **b = (char**) vb;
+    return strcmp(*a, *b);
+}
+
+CommandTree::CommandTree(WindowManager *wm) :
+    m_windowManager(wm),
+    m_fd(-1),
+    m_root(0)
+{
+    const char *home = getenv("HOME");
+    const char *wmxdir = getenv("WMXDIR");
+
+    if (wmxdir == NULL) {
+        if (home == NULL) {
+            return;
+        }
+        m_root = (char*) malloc(strlen(home) + strlen(CONFIG_COMMAND_MENU) + 2);
+        sprintf(m_root, "%s/%s", home, CONFIG_COMMAND_MENU);
+    } else if (wmxdir[0] == '/') {
+        m_root = NewString(wmxdir);
+    } else {
+        if (home == NULL) {
+            return;
+        }
+        m_root = (char*) malloc(strlen(home) + strlen(wmxdir) + 2);
+        sprintf(m_root, "%s/%s", home, wmxdir);
+    }
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        perror("wmx: no inotify, so the command menu will be read each time it's shown");
+    } else {
+        m_windowManager->addEventSource(m_fd, this);
+    }
+
+    add(m_root, 0);
+}
+
+CommandTree::~CommandTree() {
+    while (m_directories.count() > 0) {
+        remove(m_directories.count() - 1);
+    }
+    if (m_fd >= 0) {
+        m_windowManager->removeEventSource(m_fd);
+        close(m_fd);
+    }
+    free(m_root);
+}
+
+CommandTree::Directory* CommandTree::find(const char *path) {
+    for (int i = 0; i < m_directories.count(); ++i) {
+        Directory *d = m_directories.item(i);
+        if (!strcmp(d->path, path)) {
+            if (d->watch < 0) {
+                refresh(d);
+            }
+            return d;
+        }
+    }
+
+    // perhaps by a path we didn't follow
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        Directory *d = findSame(st);
+        if (d) {
+            if (d->watch < 0) {
+                refresh(d);
+            }
+            return d;
+        }
+    }
+    return 0;
+}
+
+CommandTree::Directory* CommandTree::findSame(const struct stat &st) {
+    for (int i = 0; i < m_directories.count(); ++i) {
+        Directory *d = m_directories.item(i);
+        if (d->inode == st.st_ino && d->device == st.st_dev && d->inode != 0) {
+            return d;
+        }
+    }
+    return 0;
+}
+
+CommandTree::Directory* CommandTree::add(const char *path, int depth) {
+    Directory *d = 0;
+    for (int i = 0; i < m_directories.count(); ++i) {
+        if (!strcmp(m_directories.item(i)->path, path)) {
+            d = m_directories.item(i);
+            break;
+        }
+    }
+
+    if (d) {
+        // it may have gone away and come back since we last watched it
+        if (d->watch < 0 && m_fd >= 0) {
+            d->watch = inotify_add_watch(m_fd, d->path, COMMAND_TREE_EVENTS);
+            if (d->watch >= 0) {
+                refresh(d);
+            }
+        }
+        return d;
+    }
+
+    // already in the tree by another path: don't go down it again
+    struct stat st;
+    if (stat(path, &st) == 0 && findSame(st)) {
+        return 0;
+    }
+
+    d = new Directory;
+    d->path = NewString(path);
+    d->device = 0;
+    d->inode = 0;
+    d->depth = depth;
+    d->names = 0;
+    d->count = d->directories = 0;
+    d->width = -1;
+    d->watch = (m_fd >= 0) ? inotify_add_watch(m_fd, path, COMMAND_TREE_EVENTS) : -1;
+    m_directories.append(d);
+
+    refresh(d);
+    return d;
+}
+
+void CommandTree::clear(Directory *d) {
+    for (int i = 0; i < d->count; ++i) {
+        free(d->names[i]);
+    }
+    free(d->names);
+    d->names = 0;
+    d->count = d->directories = 0;
+    d->width = -1;
+}
+
+void CommandTree::load(Directory *d) {
+    clear(d);
+
+    DIR *dir = opendir(d->path);
+    if (dir == NULL) {
+        return;
+    }
+
+    struct stat self;
+    if (fstat(dirfd(dir), &self) == 0) {
+        d->device = self.st_dev;
+        d->inode = self.st_ino;
+    }
+
+    List<char*> directories;
+    List<char*> commands;
+    struct dirent *ent;
+
+    while ((ent = readdir(dir)) != NULL) {
+        struct stat st;
+        if (fstatat(dirfd(dir), ent->d_name, &st, 0) == -1) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if ((st.st_mode & 0444) && ent->d_name[0] != '.') {
+                directories.append(NewString(ent->d_name));
+            }
+        } else if (S_ISREG(st.st_mode) && (st.st_mode & 0111)) {
+            commands.append(NewString(ent->d_name));
+        }
+    }
+    closedir(dir);
+
+    int i, n = directories.count() + commands.count();
+    if (n == 0) {
+        return;
+    }
+
+    qsort(directories.array(0, directories.count()), directories.count(), sizeof(char*), sortstrs);
+    qsort(commands.array(0, commands.count()), commands.count(), sizeof(char*), sortstrs);
+
+    d->names = (char**) malloc(n * sizeof(char*));
+    for (i = 0; i < directories.count(); ++i) {
+        d->names[d->count++] = directories.item(i);
+    }
+    for (i = 0; i < commands.count(); ++i) {
+        d->names[d->count++] = commands.item(i);
+    }
+    d->directories = directories.count();
+}
+
+// Read the directory again, pick up any new subdirectories and drop
+// the ones that have gone
+
+void CommandTree::refresh(Directory *d) {
+    load(d);
+
+    int i, j;
+    int length = strlen(d->path);
+    char *path = (char*) malloc(length + 1024 + 2); // NAME_MAX guess
+    strcpy(path, d->path);
+    path[length] = '/';
+
+    List<char*> gone;
+    for (i = 0; i < m_directories.count(); ++i) {
+        const char *other = m_directories.item(i)->path;
+        if (strncmp(other, path, length + 1) || strchr(other + length + 1, '/')) {
+            continue;
+        }
+        for (j = 0; j < d->directories; ++j) {
+            if (!strcmp(other + length + 1, d->names[j])) {
+                break;
+            }
+        }
+        if (j == d->directories) {
+            gone.append(NewString(other));
+        }
+    }
+    for (i = 0; i < gone.count(); ++i) {
+        removeBelow(gone.item(i));
+        free(gone.item(i));
+    }
+
+    if (d->depth < COMMAND_TREE_MAX_DEPTH) {
+        // d stays put while we add to the list, but its names are
+        // only ours until the next load, so take copies
+        int depth = d->depth;
+        List<char*> below;
+        for (i = 0; i < d->directories; ++i) {
+            strcpy(path + length + 1, d->names[i]);
+            below.append(NewString(path));
+        }
+        for (i = 0; i < below.count(); ++i) {
+            add(below.item(i), depth + 1);
+            free(below.item(i));
+        }
+    }
+
+    free(path);
+}
+
+void CommandTree::removeBelow(const char *path) {
+    int length = strlen(path);
+    for (int i = m_directories.count() - 1; i >= 0; --i) {
+        const char *other = m_directories.item(i)->path;
+        if (!strncmp(other, path, length) && (other[length] == '\0' || other[length] == '/')) {
+            remove(i);
+        }
+    }
+}
+
+void CommandTree::remove(int index) {
+    Directory *d = m_directories.item(index);
+    m_directories.swap_remove(index);
+
+    // two paths can lead to the same directory, and share a watch
+    if (d->watch >= 0) {
+        int i;
+        for (i = 0; i < m_directories.count(); ++i) {
+            if (m_directories.item(i)->watch == d->watch) {
+                break;
+            }
+        }
+        if (i == m_directories.count()) {
+            inotify_rm_watch(m_fd, d->watch);
+        }
+    }
+
+    clear(d);
+    free(d->path);
+    delete d;
+}
+
+void CommandTree::readable() {
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    List<int> changed;
+    Boolean overflowed = False;
+    int i, j;
+
+    for (;;) {
+        ssize_t n = ::read(m_fd, buffer, sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+        struct inotify_event *ev;
+        for (char *p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event*) p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflowed = True;
+            } else if (ev->mask & IN_IGNORED) {
+                // the directory's gone, or we stopped watching it
+                for (i = 0; i < m_directories.count(); ++i) {
+                    if (m_directories.item(i)->watch == ev->wd) {
+                        m_directories.item(i)->watch = -1;
+                    }
+                }
+            } else {
+                for (i = 0; i < changed.count(); ++i) {
+                    if (changed.item(i) == ev->wd) {
+                        break;
+                    }
+                }
+                if (i == changed.count()) {
+                    changed.append(ev->wd);
+                }
+            }
+        }
+    }
+
+    // A burst of events (unpacking a tarball, say) reads each
+    // directory only once.  Refreshing may remove directories, so
+    // look each one up again by path.
+
+    List<char*> paths;
+    for (i = 0; i < m_directories.count(); ++i) {
+        Directory *d = m_directories.item(i);
+        if (overflowed) {
+            paths.append(NewString(d->path));
+            continue;
+        }
+        for (j = 0; j < changed.count(); ++j) {
+            if (d->watch == changed.item(j)) {
+                paths.append(NewString(d->path));
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < paths.count(); ++i) {
+        for (j = 0; j < m_directories.count(); ++j) {
+            if (!strcmp(m_directories.item(j)->path, paths.item(i))) {
+                refresh(m_directories.item(j));
+                break;
+            }
+        }
+        free(paths.item(i));
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef _COMMANDTREE_H_
+#define _COMMANDTREE_H_
+
+#include "General.h"
+#include "List.h"
+#include "Manager.h"
+
+// The command menu's directories, read once at startup and kept in
+// memory with the names already sorted.  inotify tells us when one
+// of them changes, and only that one is read again, so opening a
+// menu needn't touch the filesystem at all.  A directory we couldn't
+// watch (no inotify, or it didn't exist yet) is read afresh every
+// time it's looked up, as the menu always used to do.
+//
+// A directory reached by a second path (through a symlink, say) is
+// only in the tree once, under the first path it was found by;
+// looking it up by the other path finds the same entry.
+
+class CommandTree : public EventSource {
+
+public:
+    CommandTree(WindowManager*);
+    virtual ~CommandTree();
+
+    virtual void readable();
+
+    class Directory {
+    public:
+        char *path;
+        dev_t device;     // which directory it is, whatever the
+        ino_t inode;      // path; both 0 if it couldn't be read
+        int depth;        // below the root
+        int watch;        // inotify descriptor, -1 if none
+        char **names;     // subdirectories first, then commands
+        int count;
+        int directories;  // how many of the names are subdirectories
+        int width;        // widest name, as measured by the menu; -1 if not
+    };
+
+    // Zero if there's no home directory to look in
+    const char* root() {
+        return m_root;
+    }
+
+    // Zero if the path isn't a directory in the tree
+    Directory* find(const char *path);
+
+private:
+    WindowManager *m_windowManager;
+    int m_fd;
+    char *m_root;
+    List<Directory*> m_directories;
+
+    Directory* add(const char *path, int depth);
+    Directory* findSame(const struct stat&);
+    void load(Directory*);
+    void clear(Directory*);
+    void refresh(Directory*);
+    void removeBelow(const char *path);
+    void remove(int index);
+};
+
+#endif
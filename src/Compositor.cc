@@ -0,0 +1,708 @@
+#include "Compositor.h"
+
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xfixes.h>
+#include <xcb/damage.h>
+#include <xcb/shape.h>
+#include <xcb/xcbext.h> // xcb_poll_for_reply
+#include <fcntl.h>
+
+static Boolean redirectFailed;
+
+static int redirectErrorHandler(Display*, XErrorEvent*) {
+    redirectFailed = True;
+    return 0;
+}
+
+Compositor* Compositor::create(WindowManager *wm) {
+    Display *d = wm->display();
+    int ev, er, major, minor;
+
+    if (!XRenderQueryExtension(d, &ev, &er) || !XFixesQueryExtension(d, &ev, &er)) {
+        return 0;
+    }
+    major = 2;
+    minor = 0;
+    if (!XFixesQueryVersion(d, &major, &minor) || major < 2) {
+        return 0;
+    }
+    major = 0;
+    minor = 3;
+    if (!XCompositeQueryVersion(d, &major, &minor) || (major == 0 && minor < 3)) {
+        return 0; // no overlay window
+    }
+
+    xcb_connection_t *c = xcb_connect(DisplayString(d), 0);
+    if (xcb_connection_has_error(c)) {
+        fprintf(stderr, "wmx: couldn't open a connection for compositing\n");
+        xcb_disconnect(c);
+        return 0;
+    }
+    fcntl(xcb_get_file_descriptor(c), F_SETFD, FD_CLOEXEC);
+
+    const xcb_query_extension_reply_t *damage = xcb_get_extension_data(c, &xcb_damage_id);
+    const xcb_query_extension_reply_t *shape = xcb_get_extension_data(c, &xcb_shape_id);
+    if (!damage || !damage->present || !shape || !shape->present) {
+        xcb_disconnect(c);
+        return 0;
+    }
+
+    // the server won't take DAMAGE requests until we've said which
+    // version we speak
+    xcb_damage_query_version_reply_t *version =
+    xcb_damage_query_version_reply(c, xcb_damage_query_version(c, 1, 1), 0);
+    if (!version) {
+        xcb_disconnect(c);
+        return 0;
+    }
+    free(version);
+
+    // only one client can redirect manually
+    XSync(d, False);
+    redirectFailed = False;
+    XErrorHandler previous = XSetErrorHandler(redirectErrorHandler);
+    for (int i = 0; i < wm->screensTotal(); ++i) {
+        XCompositeRedirectSubwindows(d, wm->mroot(i), CompositeRedirectManual);
+    }
+    XSync(d, False);
+    XSetErrorHandler(previous);
+
+    if (redirectFailed) {
+        for (int i = 0; i < wm->screensTotal(); ++i) {
+            XCompositeUnredirectSubwindows(d, wm->mroot(i), CompositeRedirectManual);
+        }
+        fprintf(stderr, "wmx: another compositor running?\n");
+        xcb_disconnect(c);
+        return 0;
+    }
+
+    return new Compositor(wm, c, damage->first_event + XCB_DAMAGE_NOTIFY, shape->first_event + XCB_SHAPE_NOTIFY);
+}
+
+Compositor::Compositor(WindowManager *wm, xcb_connection_t *c, int damageEvent, int shapeEvent) :
+    m_windowManager(wm),
+    m_display(wm->display()),
+    m_xcb(c),
+    m_damageEvent(damageEvent),
+    m_shapeEvent(shapeEvent),
+    m_outstanding(0),
+    m_scheduled(False),
+    m_lastPaint(0)
+{
+    m_screenCount = wm->screensTotal();
+    m_screens = new ScreenState[m_screenCount];
+
+    for (int i = 0; i < m_screenCount; ++i) {
+        ScreenState &s = m_screens[i];
+        XRenderPictureAttributes pa;
+
+        s.root = wm->mroot(i);
+        s.width = DisplayWidth(m_display, i);
+        s.height = DisplayHeight(m_display, i);
+
+        // the overlay mustn't take the pointer from the windows under it
+        s.overlay = XCompositeGetOverlayWindow(m_display, s.root);
+        XserverRegion empty = XFixesCreateRegion(m_display, 0, 0);
+        XFixesSetWindowShapeRegion(m_display, s.overlay, ShapeInput, 0, 0, empty);
+        XFixesDestroyRegion(m_display, empty);
+
+        XRenderPictFormat *format = XRenderFindVisualFormat(m_display, DefaultVisual(m_display, i));
+        pa.subwindow_mode = IncludeInferiors;
+        s.rootPicture = XRenderCreatePicture(m_display, s.root, format, CPSubwindowMode, &pa);
+        s.overlayPicture = XRenderCreatePicture(m_display, s.overlay, format, 0, 0);
+        s.back = XCreatePixmap(m_display, s.root, s.width, s.height, DefaultDepth(m_display, i));
+        s.backPicture = XRenderCreatePicture(m_display, s.back, format, 0, 0);
+
+        s.damage = XCreateRegion();
+        XRectangle all = { 0, 0, (unsigned short) s.width, (unsigned short) s.height };
+        XUnionRectWithRegion(&all, s.damage, s.damage);
+
+        uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+        xcb_change_window_attributes(m_xcb, s.root, XCB_CW_EVENT_MASK, &mask);
+        adoptWindows(i);
+    }
+
+    wm->addEventSource(xcb_get_file_descriptor(m_xcb), this);
+    schedule();
+}
+
+Compositor::~Compositor() {
+    m_windowManager->removeEventSource(xcb_get_file_descriptor(m_xcb));
+    m_windowManager->cancelTimer(WindowManager::CompositeTimer);
+
+    for (int i = 0; i < m_screenCount; ++i) {
+        ScreenState &s = m_screens[i];
+        while (s.windows.count() > 0) {
+            removeWindow(i, s.windows.count() - 1, False);
+        }
+        XRenderFreePicture(m_display, s.rootPicture);
+        XRenderFreePicture(m_display, s.overlayPicture);
+        XRenderFreePicture(m_display, s.backPicture);
+        XFreePixmap(m_display, s.back);
+        XDestroyRegion(s.damage);
+        XCompositeReleaseOverlayWindow(m_display, s.root);
+        XCompositeUnredirectSubwindows(m_display, s.root, CompositeRedirectManual);
+    }
+
+    delete[] m_screens;
+    xcb_disconnect(m_xcb);
+}
+
+// Take on the windows already there.  Like the manager's own
+// adoptWindows, all the queries go out before any answer is read.
+
+void Compositor::adoptWindows(int screen) {
+    ScreenState &s = m_screens[screen];
+
+    xcb_query_tree_reply_t *tree = xcb_query_tree_reply(m_xcb, xcb_query_tree(m_xcb, s.root), 0);
+    if (!tree) {
+        return;
+    }
+
+    int n = xcb_query_tree_children_length(tree);
+    xcb_window_t *children = xcb_query_tree_children(tree);
+    xcb_get_window_attributes_cookie_t *attrCookies = (xcb_get_window_attributes_cookie_t*) malloc(n * sizeof(xcb_get_window_attributes_cookie_t));
+    xcb_get_geometry_cookie_t *geomCookies = (xcb_get_geometry_cookie_t*) malloc(n * sizeof(xcb_get_geometry_cookie_t));
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        attrCookies[i] = xcb_get_window_attributes(m_xcb, children[i]);
+        geomCookies[i] = xcb_get_geometry(m_xcb, children[i]);
+    }
+
+    // bottom first, as the tree gives them
+    for (i = 0; i < n; ++i) {
+        xcb_get_window_attributes_reply_t *attr = xcb_get_window_attributes_reply(m_xcb, attrCookies[i], 0);
+        xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(m_xcb, geomCookies[i], 0);
+        if (attr && geom && children[i] != s.overlay) {
+            Win *w = addWindow(screen, children[i], geom->x, geom->y, geom->width, geom->height, geom->border_width, attr);
+            w->mapped = (attr->map_state == XCB_MAP_STATE_VIEWABLE);
+        }
+        free(attr);
+        free(geom);
+    }
+
+    free(attrCookies);
+    free(geomCookies);
+    free(tree);
+}
+
+void Compositor::readable() {
+    xcb_generic_event_t *e;
+    while ((e = xcb_poll_for_event(m_xcb))) {
+        event(e);
+        free(e);
+    }
+}
+
+void Compositor::flush() {
+    // events may have been read while somebody else was waiting for
+    // a reply on this connection, in which case the descriptor won't
+    // have told us about them
+    xcb_generic_event_t *e;
+    while ((e = xcb_poll_for_queued_event(m_xcb))) {
+        event(e);
+        free(e);
+    }
+    if (m_outstanding > 0) {
+        collect();
+    }
+
+    if (m_scheduled && m_windowManager->timerExpired(WindowManager::CompositeTimer)) {
+        m_scheduled = False;
+        paint();
+    }
+
+    // nothing else sends what's been queued on this connection
+    xcb_flush(m_xcb);
+}
+
+void Compositor::event(xcb_generic_event_t *e) {
+    int type = e->response_type & 0x7f;
+    int screen, index;
+    Win *w;
+
+    if (type == 0) {
+        return; // error: a window went before we got to it, most likely
+    }
+
+    if (type == m_damageEvent) {
+        xcb_damage_notify_event_t *de = (xcb_damage_notify_event_t*) e;
+        if ((w = find(de->drawable, screen)) && w->mapped) {
+            XRectangle r = { (short) (w->x + w->border + de->area.x), (short) (w->y + w->border + de->area.y), de->area.width, de->area.height };
+            XUnionRectWithRegion(&r, m_screens[screen].damage, m_screens[screen].damage);
+            schedule();
+        }
+        return;
+    }
+
+    if (type == m_shapeEvent) {
+        xcb_shape_notify_event_t *se = (xcb_shape_notify_event_t*) e;
+        if (se->shape_kind == XCB_SHAPE_SK_BOUNDING && (w = find(se->affected_window, screen))) {
+            // the old shape goes on being painted until the new one's
+            // rectangles are in, so a frame that's reshaped as it's
+            // resized doesn't drop out of the paint in between
+            damageWindow(screen, w);
+            discard(w->shapeRequest);
+            w->shaped = se->shaped;
+            if (w->shaped) {
+                w->shapeRequest = xcb_shape_get_rectangles(m_xcb, w->id, XCB_SHAPE_SK_BOUNDING).sequence;
+                ++m_outstanding;
+            } else if (w->shape) {
+                XDestroyRegion(w->shape);
+                w->shape = 0;
+            }
+            damageWindow(screen, w);
+        }
+        return;
+    }
+
+    switch (type) {
+
+      case XCB_CREATE_NOTIFY: {
+        xcb_create_notify_event_t *ce = (xcb_create_notify_event_t*) e;
+        if ((screen = screenOf(ce->parent)) >= 0 && ce->window != m_screens[screen].overlay) {
+            addWindow(screen, ce->window, ce->x, ce->y, ce->width, ce->height, ce->border_width);
+        }
+        break;
+      }
+      case XCB_DESTROY_NOTIFY: {
+        xcb_destroy_notify_event_t *de = (xcb_destroy_notify_event_t*) e;
+        if ((screen = screenOf(de->event)) >= 0 && (index = find(screen, de->window)) >= 0) {
+            damageWindow(screen, m_screens[screen].windows.item(index));
+            removeWindow(screen, index, True);
+        }
+        break;
+      }
+      case XCB_MAP_NOTIFY: {
+        xcb_map_notify_event_t *me = (xcb_map_notify_event_t*) e;
+        if ((screen = screenOf(me->event)) >= 0 && (index = find(screen, me->window)) >= 0) {
+            w = m_screens[screen].windows.item(index);
+            w->mapped = True;
+            damageWindow(screen, w);
+        }
+        break;
+      }
+      case XCB_UNMAP_NOTIFY: {
+        xcb_unmap_notify_event_t *ue = (xcb_unmap_notify_event_t*) e;
+        if ((screen = screenOf(ue->event)) >= 0 && (index = find(screen, ue->window)) >= 0) {
+            w = m_screens[screen].windows.item(index);
+            damageWindow(screen, w);
+            w->mapped = False;
+            freePicture(w); // a new pixmap comes with the next map
+        }
+        break;
+      }
+      case XCB_CONFIGURE_NOTIFY: {
+        xcb_configure_notify_event_t *ce = (xcb_configure_notify_event_t*) e;
+        if ((screen = screenOf(ce->event)) >= 0 && (index = find(screen, ce->window)) >= 0) {
+            w = m_screens[screen].windows.item(index);
+            damageWindow(screen, w);
+            discard(w->geometryRequest); // this is newer
+            if (ce->width != w->width || ce->height != w->height || ce->border_width != w->border) {
+                freePicture(w);
+            }
+            w->x = ce->x;
+            w->y = ce->y;
+            w->width = ce->width;
+            w->height = ce->height;
+            w->border = ce->border_width;
+            restack(screen, index, ce->above_sibling);
+            damageWindow(screen, w);
+        }
+        break;
+      }
+      case XCB_REPARENT_NOTIFY: {
+        xcb_reparent_notify_event_t *re = (xcb_reparent_notify_event_t*) e;
+        if ((screen = screenOf(re->event)) < 0) {
+            break;
+        }
+        if (re->parent == m_screens[screen].root) {
+            // the event doesn't give the size, which is collected later
+            if (find(screen, re->window) < 0) {
+                w = addWindow(screen, re->window, re->x, re->y, 0, 0, 0);
+                w->geometryRequest = xcb_get_geometry(m_xcb, re->window).sequence;
+                ++m_outstanding;
+            }
+        } else if ((index = find(screen, re->window)) >= 0) {
+            damageWindow(screen, m_screens[screen].windows.item(index));
+            removeWindow(screen, index, False);
+        }
+        break;
+      }
+      case XCB_CIRCULATE_NOTIFY: {
+        xcb_circulate_notify_event_t *ce = (xcb_circulate_notify_event_t*) e;
+        if ((screen = screenOf(ce->event)) >= 0 && (index = find(screen, ce->window)) >= 0) {
+            List<Win*> &windows = m_screens[screen].windows;
+            w = windows.item(index);
+            windows.remove(index);
+            if (ce->place == XCB_PLACE_ON_TOP) {
+                windows.append(w);
+            } else {
+                windows.insert(0, w);
+            }
+            damageWindow(screen, w);
+        }
+        break;
+      }
+
+    } // switch
+}
+
+int Compositor::screenOf(Window root) {
+    for (int i = 0; i < m_screenCount; ++i) {
+        if (m_screens[i].root == root) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int Compositor::find(int screen, Window id) {
+    List<Win*> &windows = m_screens[screen].windows;
+    for (int i = windows.count() - 1; i >= 0; --i) {
+        if (windows.item(i)->id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Compositor::Win* Compositor::find(Window id, int &screen) {
+    for (screen = 0; screen < m_screenCount; ++screen) {
+        int index = find(screen, id);
+        if (index >= 0) {
+            return m_screens[screen].windows.item(index);
+        }
+    }
+    return 0;
+}
+
+// New windows go on top.  The window may have been seen already, if
+// its creation was queued while we were looking at the tree.  If the
+// caller hasn't its attributes to hand, they're asked for.
+
+Compositor::Win* Compositor::addWindow(int screen, Window id, int x, int y, int width, int height, int border, xcb_get_window_attributes_reply_t *attr) {
+    int index = find(screen, id);
+    if (index >= 0) {
+        return m_screens[screen].windows.item(index);
+    }
+
+    Win *w = new Win;
+    w->id = id;
+    w->x = x;
+    w->y = y;
+    w->width = width;
+    w->height = height;
+    w->border = border;
+    w->mapped = False;
+    w->inputOnly = False;
+    w->alpha = False;
+    w->format = 0;
+    w->pixmap = None;
+    w->picture = None;
+    w->shaped = False;
+    w->shape = 0;
+    w->clip = 0;
+    w->attributesRequest = 0;
+    w->geometryRequest = 0;
+    w->shapeRequest = 0;
+    w->damage = xcb_generate_id(m_xcb);
+    m_screens[screen].windows.append(w);
+
+    // errors (for an input-only window, say) come back as events
+    xcb_damage_create(m_xcb, w->damage, id, XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+    xcb_shape_select_input(m_xcb, id, True);
+
+    if (attr) {
+        setAttributes(screen, w, attr);
+    } else {
+        w->attributesRequest = xcb_get_window_attributes(m_xcb, id).sequence;
+        ++m_outstanding;
+    }
+    return w;
+}
+
+// A reply of 0 means the window went before it could be answered
+
+void Compositor::setAttributes(int screen, Win *w, xcb_get_window_attributes_reply_t *attr) {
+    if (!attr) {
+        return;
+    }
+    if (attr->_class == XCB_WINDOW_CLASS_INPUT_ONLY) {
+        w->inputOnly = True;
+        return;
+    }
+
+    XVisualInfo templ;
+    int n;
+    templ.visualid = attr->visual;
+    XVisualInfo *info = XGetVisualInfo(m_display, VisualIDMask, &templ, &n);
+    if (!info) {
+        return;
+    }
+    w->format = XRenderFindVisualFormat(m_display, info->visual);
+    XFree(info);
+
+    if (w->format) {
+        w->alpha = (w->format->type == PictTypeDirect && w->format->direct.alphaMask);
+        damageWindow(screen, w);
+    }
+}
+
+void Compositor::setGeometry(int screen, Win *w, xcb_get_geometry_reply_t *geom) {
+    if (!geom) {
+        return;
+    }
+    damageWindow(screen, w);
+    w->x = geom->x;
+    w->y = geom->y;
+    w->width = geom->width;
+    w->height = geom->height;
+    w->border = geom->border_width;
+    damageWindow(screen, w);
+}
+
+void Compositor::setShape(int screen, Win *w, xcb_shape_get_rectangles_reply_t *reply) {
+    if (!reply) {
+        return;
+    }
+    damageWindow(screen, w); // where the old shape was
+    if (w->shape) {
+        XDestroyRegion(w->shape);
+    }
+    w->shape = XCreateRegion();
+    xcb_rectangle_t *rects = xcb_shape_get_rectangles_rectangles(reply);
+    int count = xcb_shape_get_rectangles_rectangles_length(reply);
+    for (int i = 0; i < count; ++i) {
+        XRectangle r = { rects[i].x, rects[i].y, rects[i].width, rects[i].height };
+        XUnionRectWithRegion(&r, w->shape, w->shape);
+    }
+    damageWindow(screen, w);
+}
+
+// Take whatever answers have arrived, without waiting for the rest
+
+void Compositor::collect() {
+    for (int i = 0; i < m_screenCount; ++i) {
+        List<Win*> &windows = m_screens[i].windows;
+        for (int j = 0; j < windows.count(); ++j) {
+            Win *w = windows.item(j);
+            void *reply = 0;
+            xcb_generic_error_t *error = 0;
+
+            if (w->attributesRequest && xcb_poll_for_reply(m_xcb, w->attributesRequest, &reply, &error)) {
+                w->attributesRequest = 0;
+                --m_outstanding;
+                setAttributes(i, w, (xcb_get_window_attributes_reply_t*) reply);
+                free(reply);
+                free(error);
+                reply = 0;
+                error = 0;
+            }
+            if (w->geometryRequest && xcb_poll_for_reply(m_xcb, w->geometryRequest, &reply, &error)) {
+                w->geometryRequest = 0;
+                --m_outstanding;
+                setGeometry(i, w, (xcb_get_geometry_reply_t*) reply);
+                free(reply);
+                free(error);
+                reply = 0;
+                error = 0;
+            }
+            if (w->shapeRequest && xcb_poll_for_reply(m_xcb, w->shapeRequest, &reply, &error)) {
+                w->shapeRequest = 0;
+                --m_outstanding;
+                setShape(i, w, (xcb_shape_get_rectangles_reply_t*) reply);
+                free(reply);
+                free(error);
+            }
+        }
+    }
+}
+
+// A query whose answer is no longer wanted
+
+void Compositor::discard(unsigned int &request) {
+    if (request) {
+        xcb_discard_reply(m_xcb, request);
+        request = 0;
+        --m_outstanding;
+    }
+}
+
+// If the window's been destroyed, the server has freed its damage
+// along with it.  The pixmap and picture outlive it.
+
+void Compositor::removeWindow(int screen, int index, Boolean destroyed) {
+    Win *w = m_screens[screen].windows.item(index);
+    freePicture(w);
+    if (!destroyed) {
+        xcb_damage_destroy(m_xcb, w->damage);
+    }
+    discard(w->attributesRequest);
+    discard(w->geometryRequest);
+    discard(w->shapeRequest);
+    if (w->shape) {
+        XDestroyRegion(w->shape);
+    }
+    m_screens[screen].windows.remove(index);
+    delete w;
+}
+
+// Put a window directly above the given sibling, or at the bottom
+
+void Compositor::restack(int screen, int index, Window above) {
+    List<Win*> &windows = m_screens[screen].windows;
+    Win *w = windows.item(index);
+    int target = 0;
+
+    if (above != None) {
+        int a = find(screen, above);
+        if (a < 0) {
+            return; // don't know it, so leave things as they are
+        }
+        target = a + 1;
+    }
+    if (target > index) {
+        --target; // it'll have moved down when we take this one out
+    }
+    if (target == index) {
+        return;
+    }
+    windows.remove(index);
+    windows.insert(target, w);
+}
+
+// The window's bounding shape in root coordinates, added to r.  Until
+// the first shape's rectangles are in, the whole of it.
+
+void Compositor::addExtents(Win *w, Region r) {
+    if (w->shaped && w->shape) {
+        XOffsetRegion(w->shape, w->x + w->border, w->y + w->border);
+        XUnionRegion(w->shape, r, r);
+        XOffsetRegion(w->shape, -(w->x + w->border), -(w->y + w->border));
+    } else {
+        XRectangle rect = { (short) w->x, (short) w->y, (unsigned short) (w->width + 2 * w->border), (unsigned short) (w->height + 2 * w->border) };
+        XUnionRectWithRegion(&rect, r, r);
+    }
+}
+
+void Compositor::damageWindow(int screen, Win *w) {
+    if (!w->mapped) {
+        return;
+    }
+    addExtents(w, m_screens[screen].damage);
+    schedule();
+}
+
+// Paint at most once a frame, however much damage arrives
+
+void Compositor::schedule() {
+    if (m_scheduled) {
+        return;
+    }
+    const long long frame = 1000000LL / CONFIG_GRAB_FRAME_RATE;
+    long long wait = m_lastPaint + frame - WindowManager::monotonicTime();
+    m_windowManager->setTimer(WindowManager::CompositeTimer, wait > 0 ? (int) ((wait + 999) / 1000) : 0);
+    m_scheduled = True;
+}
+
+// Never waits for the server: a window whose attributes haven't been
+// collected yet is skipped, and painted when they are.
+// The picture is on the window's named pixmap rather than the window
+// itself, as only the pixmap includes the border.
+
+Boolean Compositor::ensurePicture(Win *w) {
+    if (w->picture) {
+        return True;
+    }
+    if (!w->format) {
+        return False;
+    }
+
+    // the window may be gone or unmapped already, with the news still
+    // on its way
+    m_windowManager->ignoreErrors((1L << BadWindow) | (1L << BadMatch) | (1L << BadDrawable));
+    w->pixmap = XCompositeNameWindowPixmap(m_display, w->id);
+    w->picture = XRenderCreatePicture(m_display, w->pixmap, w->format, 0, 0);
+    m_windowManager->endIgnoringErrors();
+    return True;
+}
+
+// The pixmap stops following the window once it's resized or unmapped
+
+void Compositor::freePicture(Win *w) {
+    if (w->picture) {
+        XRenderFreePicture(m_display, w->picture);
+        XFreePixmap(m_display, w->pixmap);
+        w->picture = None;
+        w->pixmap = None;
+    }
+}
+
+void Compositor::paint() {
+    for (int i = 0; i < m_screenCount; ++i) {
+        if (!XEmptyRegion(m_screens[i].damage)) {
+            paintScreen(m_screens[i]);
+        }
+    }
+    m_lastPaint = WindowManager::monotonicTime();
+}
+
+// Work down from the top, taking each opaque window's shape out of
+// what's left to paint, then draw the windows that showed up from the
+// bottom into the back buffer, and copy the damaged area to the
+// screen in one go
+
+void Compositor::paintScreen(ScreenState &s) {
+    Region remaining = XCreateRegion();
+    int i;
+
+    XUnionRegion(s.damage, remaining, remaining);
+    m_painted.remove_all();
+
+    for (i = s.windows.count() - 1; i >= 0 && !XEmptyRegion(remaining); --i) {
+        Win *w = s.windows.item(i);
+        if (!w->mapped || !ensurePicture(w)) {
+            continue;
+        }
+
+        Region extents = XCreateRegion();
+        addExtents(w, extents);
+        w->clip = XCreateRegion();
+        XIntersectRegion(extents, remaining, w->clip);
+
+        if (XEmptyRegion(w->clip)) {
+            XDestroyRegion(w->clip);
+            w->clip = 0;
+        } else {
+            m_painted.append(w);
+            if (!w->alpha) {
+                XSubtractRegion(remaining, extents, remaining);
+            }
+        }
+        XDestroyRegion(extents);
+    }
+
+    if (!XEmptyRegion(remaining)) {
+        XRenderSetPictureClipRegion(m_display, s.backPicture, remaining);
+        XRenderComposite(m_display, PictOpSrc, s.rootPicture, None, s.backPicture, 0, 0, 0, 0, 0, 0, s.width, s.height);
+    }
+    XDestroyRegion(remaining);
+
+    for (i = m_painted.count() - 1; i >= 0; --i) {
+        Win *w = m_painted.item(i);
+        XRenderSetPictureClipRegion(m_display, s.backPicture, w->clip);
+        XRenderComposite(m_display, w->alpha ? PictOpOver : PictOpSrc, w->picture, None, s.backPicture,
+            0, 0, 0, 0, w->x, w->y, w->width + 2 * w->border, w->height + 2 * w->border);
+        XDestroyRegion(w->clip);
+        w->clip = 0;
+    }
+    m_painted.remove_all();
+
+    XRenderSetPictureClipRegion(m_display, s.overlayPicture, s.damage);
+    XRenderComposite(m_display, PictOpSrc, s.backPicture, None, s.overlayPicture, 0, 0, 0, 0, 0, 0, s.width, s.height);
+
+    XDestroyRegion(s.damage);
+    s.damage = XCreateRegion();
+}
@@ -0,0 +1,117 @@
+#ifndef _COMPOSITOR_H_
+#define _COMPOSITOR_H_
+
+#include "General.h"
+#include "List.h"
+#include "Manager.h"
+
+#include <X11/extensions/Xrender.h>
+#include <xcb/xcb.h>
+#include <xcb/shape.h>
+
+// Compositing done by wmx itself, for CONFIG_MANUAL_COMPOSITE.  Every
+// top-level window is redirected off screen, and the visible parts
+// are drawn into a back buffer that is copied onto the composite
+// overlay window.  Only what the DAMAGE extension says has changed is
+// repainted, parts hidden behind opaque windows are skipped, and all
+// that changed in one frame reaches the screen in a single composite.
+//
+// Windows are followed over an xcb connection of our own rather than
+// the Xlib one, so that we still hear about them while a modal loop
+// is holding back the main event queue.
+
+class Compositor : public EventSource {
+
+public:
+    // Zero if the server lacks something we need or somebody else is
+    // compositing already
+    static Compositor* create(WindowManager*);
+    virtual ~Compositor();
+
+    virtual void readable();
+
+    // Called before the event loop waits: deal with anything already
+    // read, and paint if a frame is due
+    void flush();
+
+private:
+    Compositor(WindowManager*, xcb_connection_t*, int damageEvent, int shapeEvent);
+
+    // What paint needs to know about a window but the events don't
+    // say (its visual, its size when it's reparented to the root, and
+    // the rectangles of its shape) is asked for when the window turns
+    // up or changes, and picked up by flush once the answer is in.
+    // Until its visual is known it's left out of the paint; a new
+    // shape replaces the old one only once it has arrived.
+    class Win {
+    public:
+        Window id;
+        int x, y, width, height, border;
+        Boolean mapped;
+        Boolean inputOnly;
+        Boolean alpha;
+        XRenderPictFormat *format; // 0 until the attributes are in
+        Pixmap pixmap;     // the window's contents, border and all
+        Picture picture;   // on pixmap; None until first painted
+        XID damage;
+        Boolean shaped;
+        Region shape;      // bounding shape, window-relative; 0 if not fetched
+        Region clip;       // during paint
+        unsigned int attributesRequest; // sequence numbers of the
+        unsigned int geometryRequest;   // queries outstanding, or 0
+        unsigned int shapeRequest;
+    };
+
+    class ScreenState {
+    public:
+        Window root;
+        Window overlay;
+        int width, height;
+        Picture rootPicture;
+        Picture overlayPicture;
+        Pixmap back;
+        Picture backPicture;
+        Region damage; // in root coordinates, since the last paint
+        List<Win*> windows; // bottom first
+    };
+
+    WindowManager *m_windowManager;
+    Display *m_display;
+    xcb_connection_t *m_xcb;
+    int m_damageEvent;
+    int m_shapeEvent;
+
+    ScreenState *m_screens;
+    int m_screenCount;
+
+    int m_outstanding; // queries not yet collected
+    Boolean m_scheduled; // CompositeTimer is set
+    long long m_lastPaint;
+    List<Win*> m_painted;
+
+    void adoptWindows(int screen);
+    void event(xcb_generic_event_t*);
+    void collect(); // answers to the queries in Win
+
+    int screenOf(Window root);
+    int find(int screen, Window);
+    Win* find(Window, int &screen);
+    Win* addWindow(int screen, Window, int x, int y, int w, int h, int bw, xcb_get_window_attributes_reply_t* = 0);
+    void setAttributes(int screen, Win*, xcb_get_window_attributes_reply_t*);
+    void setGeometry(int screen, Win*, xcb_get_geometry_reply_t*);
+    void setShape(int screen, Win*, xcb_shape_get_rectangles_reply_t*);
+    void discard(unsigned int &request);
+    void removeWindow(int screen, int index, Boolean destroyed);
+    void restack(int screen, int index, Window above);
+
+    void addExtents(Win*, Region);
+    void damageWindow(int screen, Win*);
+    void schedule();
+
+    Boolean ensurePicture(Win*);
+    void freePicture(Win*);
+    void paint();
+    void paintScreen(ScreenState&);
+};
+
+#endif
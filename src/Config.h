@@ -77,6 +77,36 @@
 #define CONFIG_POINTER_STOPPED_DELAY  80
 #define CONFIG_DESTROY_WINDOW_DELAY   600
 
+// If REPORT_WAKEUPS is True, wmx counts the times it comes back from
+// waiting for events or timers and prints the total every
+// WAKEUP_REPORT_INTERVAL milliseconds.  On an idle display this
+// should print zero.
+
+#define CONFIG_REPORT_WAKEUPS         False
+#define CONFIG_WAKEUP_REPORT_INTERVAL 10000
+
+// If REPORT_GRAB_STATS is True, each move, resize or menu prints the
+// CPU time it used, how many motion events arrived and were acted
+// on, and the mean time from the pointer moving to the configure (or
+// redraw) that followed being sent.  The last needs the X server on
+// the same machine; bench/wmxbench times the same thing from outside.
+
+#define CONFIG_REPORT_GRAB_STATS      False
+
+// If REPORT_STARTUP is True, wmx prints how long it took to get going
+// (up to the point where it starts handling events), how many
+// requests it sent and roughly how many times it had to wait for the
+// server to reply.
+
+#define CONFIG_REPORT_STARTUP         False
+
+// If EVENT_STATS is True, wmx keeps a note of how long it takes to
+// handle each type of event, and how many requests and round trips
+// that takes.  They're printed with the client list on the debug key
+// or on SIGUSR1; SIGUSR2 starts the counts again.
+
+#define CONFIG_EVENT_STATS            False
+
 // Number of pixels off the screen you have to push a window
 // before the manager notices the window is off-screen (the higher
 // the value, the easier it is to place windows at the screen edges)
@@ -94,6 +124,31 @@
 
 #define CONFIG_RESIZE_UPDATE      True
 
+// When RESIZE_UPDATE is on and a client supports _NET_WM_SYNC_REQUEST,
+// a resize waits for the client to finish drawing each size before
+// giving it the next.  If it hasn't answered after this many
+// milliseconds we carry on without it.
+
+#define CONFIG_SYNC_TIMEOUT       200
+
+// Timestamps for focus changes, grabs and client messages are worked
+// out from the last event that carried the server's time, plus the
+// time since by our own clock.  After this many milliseconds without
+// such an event we ask the server instead.
+
+#define CONFIG_TIMESTAMP_ESTIMATE_AGE 10000
+
+// While moving or resizing, pointer motion is collapsed and acted on
+// no more than this many times a second (ideally the display refresh
+// rate).
+
+#define CONFIG_GRAB_FRAME_RATE    60
+
+// A window's title is redrawn no more than this many times a second;
+// a faster run of changes is shown as its last one.
+
+#define CONFIG_TITLE_RATE         CONFIG_GRAB_FRAME_RATE
+
 // If USE_COMPOSITE is true, wmx will enable composite redirects for
 // all windows if the Composite extension is present.  This should
 // make no difference at all to the appearance or behaviour of wmx,
@@ -102,6 +157,16 @@
 
 #define CONFIG_USE_COMPOSITE      True
 
+// If MANUAL_COMPOSITE is also true, wmx does the compositing itself
+// (with the Damage, Render and XFixes extensions) instead of leaving
+// it to the server: only damaged areas are repainted, windows hidden
+// under others aren't drawn at all, and the screen is updated at most
+// CONFIG_GRAB_FRAME_RATE times a second in a single copy.  Meant for
+// older hardware where a separate compositor is too heavy.  Falls
+// back to the ordinary redirect if another compositor is running.
+
+#define CONFIG_MANUAL_COMPOSITE   False
+
 // If RAISELOWER_ON_CLICK is True, clicking on the title of the
 // topmost window will lower instead of raising it (patch due to
 // Kazushi (Jam) Marukawa)
@@ -194,6 +259,11 @@
 #define CONFIG_MENU_FONT "DejaVu Sans"
 #define CONFIG_MENU_FONT_SIZE 12
 
+// How many label sizes to remember, across the frame and menu fonts.
+// Each entry is a few dozen bytes plus the label itself.
+
+#define CONFIG_TEXT_CACHE_SIZE 512
+
 // CONFIG_TAB_MARGIN defines the size of the gap on the left and right of the
 // text in the tab.
 
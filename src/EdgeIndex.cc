@@ -0,0 +1,66 @@
+#include "EdgeIndex.h"
+
+// first entry not less than position
+long EdgeIndex::lowerBound(EntryList &list, int position) {
+    long lo = 0, hi = list.count();
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (list.item(mid).position < position) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void EdgeIndex::insert(EntryList &list, int position, Client *c) {
+    Entry e;
+    e.position = position;
+    e.client = c;
+    list.insert(lowerBound(list, position), e);
+}
+
+void EdgeIndex::remove(EntryList &list, int position, Client *c) {
+    for (long i = lowerBound(list, position); i < list.count() && list.item(i).position == position; ++i) {
+        if (list.item(i).client == c) {
+            list.remove(i);
+            return;
+        }
+    }
+}
+
+void EdgeIndex::insert(Client *c, const EdgeRect &r) {
+    insert(m_sides[Left], r.left, c);
+    insert(m_sides[Right], r.right, c);
+    insert(m_sides[Top], r.top, c);
+    insert(m_sides[Bottom], r.bottom, c);
+}
+
+void EdgeIndex::remove(Client *c, const EdgeRect &r) {
+    remove(m_sides[Left], r.left, c);
+    remove(m_sides[Right], r.right, c);
+    remove(m_sides[Top], r.top, c);
+    remove(m_sides[Bottom], r.bottom, c);
+}
+
+Boolean EdgeIndex::find(Side side, int from, int to, Client *except, int &position) {
+    EntryList &list = m_sides[side];
+
+    if (from <= to) {
+        for (long i = lowerBound(list, from); i < list.count() && list.item(i).position <= to; ++i) {
+            if (list.item(i).client != except) {
+                position = list.item(i).position;
+                return True;
+            }
+        }
+    } else {
+        for (long i = lowerBound(list, from + 1) - 1; i >= 0 && list.item(i).position >= to; --i) {
+            if (list.item(i).client != except) {
+                position = list.item(i).position;
+                return True;
+            }
+        }
+    }
+    return False;
+}
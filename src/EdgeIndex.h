@@ -0,0 +1,59 @@
+#ifndef _EDGEINDEX_H_
+#define _EDGEINDEX_H_
+
+#include "General.h"
+
+class Client;
+
+class EdgeRect {
+
+public:
+    EdgeRect() :
+        left(0),
+        right(0),
+        top(0),
+        bottom(0)
+        {}
+
+    ~EdgeRect() {}
+
+    int left, right, top, bottom;
+};
+
+// The frame edges of every normal, non-transient client, one sorted
+// array per side, for bumping windows against each other while
+// moving and resizing.  Clients keep their own entries up to date
+// (Client::updateEdges), so nothing is rebuilt per drag.
+
+class EdgeIndex {
+
+public:
+    enum Side {
+        Left, Right, Top, Bottom, SideCount
+    };
+
+    void insert(Client*, const EdgeRect&);
+    void remove(Client*, const EdgeRect&);
+
+    // Look for an edge on the given side whose position lies between
+    // from and to inclusive, ignoring the given client's own; if
+    // there's more than one, take the one nearest to from.  (from may
+    // be greater than to.)
+    Boolean find(Side, int from, int to, Client *except, int &position);
+
+private:
+    class Entry {
+    public:
+        int position;
+        Client *client;
+    };
+    typedef List<Entry> EntryList;
+
+    long lowerBound(EntryList&, int position);
+    void insert(EntryList&, int position, Client*);
+    void remove(EntryList&, int position, Client*);
+
+    EntryList m_sides[SideCount];
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "EventStats.h"
+#include "Manager.h"
+
+#include <string.h>
+
+static const char *const eventNames[LASTEvent] = {
+    "Other", "(reply)", "KeyPress", "KeyRelease", "ButtonPress",
+    "ButtonRelease", "MotionNotify", "EnterNotify", "LeaveNotify",
+    "FocusIn", "FocusOut", "KeymapNotify", "Expose", "GraphicsExpose",
+    "NoExpose", "VisibilityNotify", "CreateNotify", "DestroyNotify",
+    "UnmapNotify", "MapNotify", "MapRequest", "ReparentNotify",
+    "ConfigureNotify", "ConfigureRequest", "GravityNotify",
+    "ResizeRequest", "CirculateNotify", "CirculateRequest",
+    "PropertyNotify", "SelectionClear", "SelectionRequest",
+    "SelectionNotify", "ColormapNotify", "ClientMessage", "MappingNotify",
+    "GenericEvent"
+};
+
+EventStats::EventStats() {
+    reset();
+}
+
+void EventStats::reset() {
+    memset(m_entries, 0, sizeof(m_entries));
+    m_since = WindowManager::monotonicTime();
+}
+
+void EventStats::record(int type, long long micros, unsigned long requests, long roundTrips) {
+    if (type < 0 || type >= LASTEvent) {
+        type = 0;
+    }
+    Entry &e = m_entries[type];
+
+    int bucket = 0;
+    for (long long t = micros; t > 0 && bucket < Buckets - 1; t >>= 1) {
+        ++bucket;
+    }
+
+    ++e.count;
+    e.total += micros;
+    if (micros > e.max) {
+        e.max = micros;
+    }
+    e.requests += requests;
+    e.roundTrips += roundTrips;
+    ++e.buckets[bucket];
+}
+
+void EventStats::print() const {
+    printf("wmx: event handling over the last %.1fs:\n",
+        (WindowManager::monotonicTime() - m_since) / 1000000.0);
+    printf("wmx: %-17s %8s %9s %9s %9s %9s\n",
+        "event", "count", "mean us", "max us", "requests", "trips");
+
+    for (int type = 0; type < LASTEvent; ++type) {
+        const Entry &e = m_entries[type];
+        if (e.count == 0) {
+            continue;
+        }
+        printf("wmx: %-17s %8ld %9.1f %9lld %9.2f %9.2f\n", eventNames[type],
+            e.count, (double) e.total / e.count, e.max,
+            (double) e.requests / e.count, (double) e.roundTrips / e.count);
+
+        // only the buckets that have anything in them, as "<2^n us: count"
+        printf("wmx: %17s", "");
+        for (int b = 0; b < Buckets; ++b) {
+            if (e.buckets[b]) {
+                if (b == Buckets - 1) {
+                    printf(" >=%lld:%ld", 1LL << (b - 1), e.buckets[b]);
+                } else {
+                    printf(" <%lld:%ld", 1LL << b, e.buckets[b]);
+                }
+            }
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
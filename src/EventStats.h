@@ -0,0 +1,43 @@
+#ifndef _EVENTSTATS_H_
+#define _EVENTSTATS_H_
+
+#include "General.h"
+
+// Where dispatchEvent spends its time, by event type: how long each
+// event took to handle, in log2 buckets of microseconds, and how many
+// X requests and round trips the handler made.  Requests over xcb are
+// numbered along with Xlib's and so are in the count, and waits for
+// their replies are counted where they're made.  Everything is in
+// fixed arrays, so recording never allocates.  A handler that runs a
+// modal loop (moving, menus) counts the events handled inside it as
+// well as itself.
+
+class EventStats {
+
+public:
+    EventStats();
+
+    void record(int type, long long micros, unsigned long requests, long roundTrips);
+    void print() const;
+    void reset();
+
+private:
+    enum {
+        Buckets = 24 // the last one takes everything from 2^22us up
+    };
+
+    class Entry {
+    public:
+        long count;
+        long long total;
+        long long max;
+        unsigned long requests;
+        long roundTrips;
+        long buckets[Buckets];
+    };
+
+    Entry m_entries[LASTEvent]; // 0 for anything we don't know
+    long long m_since;
+};
+
+#endif
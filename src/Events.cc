@@ -1,13 +1,20 @@
 #include "Manager.h"
 #include "Client.h"
+#include "Compositor.h"
+
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
 
 int WindowManager::loop() {
     XEvent ev;
     m_looping = True;
 
     while (m_looping) {
-        nextEvent(&ev);
-        dispatchEvent(&ev);
+        if (nextEvent(&ev)) {
+            dispatchEvent(&ev);
+        }
     }
 
     release();
@@ -15,8 +22,25 @@ int WindowManager::loop() {
 }
 
 void WindowManager::dispatchEvent(XEvent *ev) {
-    m_currentTime = CurrentTime;
+    m_currentTime = noteServerTime(ev);
+    ++m_eventCount;
+
+    if (!CONFIG_EVENT_STATS) {
+        handleEvent(ev);
+        return;
+    }
+
+    long long start = monotonicTime();
+    unsigned long firstRequest = NextRequest(m_display);
+    long roundTrips = m_roundTrips;
+
+    handleEvent(ev);
+
+    m_eventStats.record(ev->type, monotonicTime() - start,
+        NextRequest(m_display) - firstRequest, m_roundTrips - roundTrips);
+}
 
+void WindowManager::handleEvent(XEvent *ev) {
     // fprintf(stderr, "WindowManager::dispatchEvent: event type %d for window %p\n", (int)ev->type, (void *)((XUnmapEvent *)ev)->window);
 
     switch (ev->type) {
@@ -99,11 +123,7 @@ void WindowManager::dispatchEvent(XEvent *ev) {
       }
       case MotionNotify: {
         if (CONFIG_AUTO_RAISE && m_focusChanging) {
-            if (!m_focusPointerMoved) {
-                m_focusPointerMoved = True;
-            } else {
-                m_focusPointerNowStill = False;
-            }
+            m_focusPointerMoved = True;
         }
         break;
       }
@@ -121,6 +141,8 @@ void WindowManager::dispatchEvent(XEvent *ev) {
         // if (ev->type == m_shapeEvent) eventShapeNotify((XShapeEvent *)ev);
         if (ev->type == m_shapeEvent) {
             fprintf(stderr, "wmx: shaped windows are not supported\n");
+        } else if (m_syncEvent && ev->type == m_syncEvent + XSyncAlarmNotify) {
+            // a late answer to a resize that's over
         } else {
             fprintf(stderr, "wmx: unsupported event type %d\n", ev->type);
         }
@@ -130,89 +152,359 @@ void WindowManager::dispatchEvent(XEvent *ev) {
     } // switch
 }
 
-void WindowManager::nextEvent(XEvent *e) {
-    int fd;
-    fd_set rfds;
-    struct timeval t;
-    int r;
+Boolean WindowManager::nextEvent(XEvent *e) {
+    while (m_looping && !m_signalled) {
+
+        if (CONFIG_EVENT_STATS && m_printStats) {
+            m_printStats = False;
+            m_eventStats.print();
+        }
+        if (CONFIG_EVENT_STATS && m_resetStats) {
+            m_resetStats = False;
+            m_eventStats.reset();
+        }
+
+        checkTimers();
+        if (CONFIG_AUTO_RAISE && timerExpired(FocusTimer)) {
+            checkDelaysForFocus();
+        }
+        if (timerExpired(TitleTimer)) {
+            checkTitles();
+        }
 
-    if (!m_signalled) {
-      waiting:
-        if (QLength(m_display) > 0) {
+        // a batch of events ends when the queue runs dry
+        if (QLength(m_display) == 0) {
+            netwmFlush();
+        }
+        if (XEventsQueued(m_display, QueuedAfterFlush) > 0) {
             XNextEvent(m_display, e);
-            return;
+            return True;
         }
 
-        fd = ConnectionNumber(m_display);
-        memset((void*) &rfds, 0, sizeof(fd_set)); // SGI's FD_ZERO is fucked
-        FD_SET(fd, &rfds);
-        t.tv_sec = t.tv_usec = 0;
+        waitForActivity();
+    }
 
-        int nfds = fd + 1;
+    if (m_signalled) {
+        fprintf(stderr, "wmx: signal caught, exiting\n");
+        ignoreErrors(); // from here on
+        m_returnCode = 0;
+    }
+    m_looping = False;
+    return False;
+}
 
-        // !!! This two-select structure is getting disgusting;
-        // a marginal improvement would be to put this body in
-        // another function, but it'd be better to go back and
-        // think hard about why the code is like this at all
-        if (select(nfds, &rfds, NULL, NULL, &t) > 0) {
-            if (FD_ISSET(fd, &rfds)) {
-                XNextEvent(m_display, e);
-                return;
-            }
+void WindowManager::initialiseEventLoop() {
+    for (int i = 0; i < TimerCount; ++i) {
+        m_timerDeadline[i] = 0;
+        m_timerFired[i] = False;
+    }
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        fatal("couldn't create epoll instance");
+    }
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) {
+        fatal("couldn't create timerfd");
+    }
+
+    // the X connection is tagged with a null pointer, the timerfd
+    // with the address of its own descriptor, and anything else
+    // with its EventSource
+    struct epoll_event ev;
+    memset((void*) &ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = 0;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, ConnectionNumber(m_display), &ev) < 0) {
+        fatal("couldn't watch X connection");
+    }
+    ev.data.ptr = (void*) &m_timerFd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &ev) < 0) {
+        fatal("couldn't watch timerfd");
+    }
+
+    if (CONFIG_REPORT_WAKEUPS) {
+        setTimer(WakeupReportTimer, CONFIG_WAKEUP_REPORT_INTERVAL);
+    }
+}
+
+void WindowManager::addEventSource(int fd, EventSource *source) {
+    struct epoll_event ev;
+    memset((void*) &ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = (void*) source;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("wmx: couldn't add event source");
+    }
+}
+
+void WindowManager::removeEventSource(int fd) {
+    struct epoll_event ev; // ignored, but older kernels want it
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+long long WindowManager::monotonicTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void WindowManager::setTimer(Timer t, int ms) {
+    m_timerDeadline[t] = monotonicTime() + (long long) ms * 1000LL;
+    m_timerFired[t] = False;
+}
+
+void WindowManager::cancelTimer(Timer t) {
+    m_timerDeadline[t] = 0;
+    m_timerFired[t] = False;
+}
+
+// The deadline is checked here too, so that a loop that never waits
+// (and so never calls checkTimers) still sees its timer go off
+
+Boolean WindowManager::timerExpired(Timer t) {
+    if (!m_timerFired[t] && m_timerDeadline[t] && m_timerDeadline[t] <= monotonicTime()) {
+        m_timerDeadline[t] = 0;
+        m_timerFired[t] = True;
+    }
+    if (m_timerFired[t]) {
+        m_timerFired[t] = False;
+        return True;
+    }
+    return False;
+}
+
+Boolean WindowManager::checkTimers() {
+    Boolean fired = False;
+    long long now = monotonicTime();
+
+    for (int i = 0; i < TimerCount; ++i) {
+        if (m_timerDeadline[i] && m_timerDeadline[i] <= now) {
+            m_timerDeadline[i] = 0;
+            m_timerFired[i] = True;
+            fired = True;
         }
+    }
+    return fired;
+}
 
-        XFlush(m_display);
-        FD_SET(fd, &rfds);
-        t.tv_sec = 0;
-        t.tv_usec = 20000;
+void WindowManager::armTimerFd() {
+    long long earliest = 0;
 
-        if ((r = select(nfds, &rfds, NULL, NULL, m_focusChanging ? &t : (struct timeval*) NULL)) > 0) {
-            if (FD_ISSET(fd, &rfds)) {
-                XNextEvent(m_display, e);
-                return;
-            }
+    for (int i = 0; i < TimerCount; ++i) {
+        if (m_timerDeadline[i] && (!earliest || m_timerDeadline[i] < earliest)) {
+            earliest = m_timerDeadline[i];
         }
+    }
+    if (earliest == m_timerArmed) {
+        return;
+    }
 
-        if (CONFIG_AUTO_RAISE && m_focusChanging) { // timeout on select
-            checkDelaysForFocus();
+    // an all-zero value disarms it
+    struct itimerspec its;
+    memset((void*) &its, 0, sizeof(its));
+    its.it_value.tv_sec = earliest / 1000000LL;
+    its.it_value.tv_nsec = (earliest % 1000000LL) * 1000LL;
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &its, 0) < 0) {
+        perror("wmx: timerfd_settime failed");
+    }
+    m_timerArmed = earliest;
+}
+
+void WindowManager::waitForActivity() {
+    netwmFlush();
+    if (m_compositor) {
+        m_compositor->flush();
+    }
+
+    // the flush may read events in while waiting to write, and the
+    // caller won't have seen those
+    int queued = QLength(m_display);
+    XFlush(m_display);
+    if (QLength(m_display) > queued) {
+        return;
+    }
+    if (checkTimers()) {
+        return;
+    }
+    armTimerFd();
+
+    struct epoll_event events[8];
+    int n = epoll_wait(m_epollFd, events, 8, -1);
+    if (n < 0) {
+        if (errno != EINTR) {
+            perror("wmx: epoll_wait failed");
+            m_looping = False;
         }
+        return;
+    }
 
-        if (r == 0) {
-            goto waiting;
+    for (int i = 0; i < n; ++i) {
+        void *p = events[i].data.ptr;
+        if (p == 0) {
+            continue; // X connection; the caller reads it
         }
-        if (errno != EINTR || !m_signalled) {
-            perror("wmx: select failed");
-            m_looping = False;
+        if (p == (void*) &m_timerFd) {
+            unsigned long long expirations;
+            while (read(m_timerFd, &expirations, sizeof(expirations)) > 0);
+            m_timerArmed = 0;
+            continue;
         }
+        ((EventSource*) p)->readable();
     }
 
-    fprintf(stderr, "wmx: signal caught, exiting\n");
-    ignoreBadWindowErrors = True;
-    m_looping = False;
-    m_returnCode = 0;
+    checkTimers();
+
+    if (CONFIG_REPORT_WAKEUPS) {
+        if (timerExpired(WakeupReportTimer)) {
+            // the wakeup for the report itself isn't counted
+            fprintf(stderr, "wmx: %ld wakeups in the last %d ms\n", m_wakeups, CONFIG_WAKEUP_REPORT_INTERVAL);
+            m_wakeups = 0;
+            setTimer(WakeupReportTimer, CONFIG_WAKEUP_REPORT_INTERVAL);
+        } else {
+            ++m_wakeups;
+        }
+    }
 }
 
-void WindowManager::checkDelaysForFocus() {
-    if (!CONFIG_AUTO_RAISE) {
+static long long cpuTime() {
+    struct rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    return (long long) (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000LL + r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+}
+
+GrabEvents::GrabEvents(WindowManager *manager, long mask) :
+    m_windowManager(manager),
+    m_mask(mask),
+    m_extraType(0),
+    m_haveMotion(False),
+    m_lastDelivery(0),
+    m_motionCount(0),
+    m_deliveredCount(0),
+    m_deliveredTime(CurrentTime),
+    m_latency(0),
+    m_latencyCount(0),
+    m_started(0),
+    m_startCpu(0)
+{
+    if (CONFIG_REPORT_GRAB_STATS) {
+        m_started = WindowManager::monotonicTime();
+        m_startCpu = cpuTime();
+    }
+}
+
+GrabEvents::~GrabEvents() {
+    m_windowManager->cancelTimer(WindowManager::FrameTimer);
+
+    if (CONFIG_REPORT_GRAB_STATS) {
+        noteLatency();
+        long long elapsed = WindowManager::monotonicTime() - m_started;
+        fprintf(stderr, "wmx: grab: %.1f ms cpu in %.1f ms, %ld motion events, %ld acted on, "
+            "mean input to configure %.1f ms (%ld timed)\n",
+            (cpuTime() - m_startCpu) / 1000.0, elapsed / 1000.0, m_motionCount, m_deliveredCount,
+            m_latencyCount ? (double) m_latency / m_latencyCount : 0.0, m_latencyCount);
+    }
+}
+
+// Once the handler has dealt with a motion event, what it asked for
+// is sent, and the time since the pointer moved is measured against
+// the event's own timestamp.  That's only meaningful where the
+// server's clock is our CLOCK_MONOTONIC in milliseconds, as it is for
+// Xorg and Xvfb on the same machine; anything implausible is taken
+// to mean it isn't, and left out.
+
+void GrabEvents::noteLatency() {
+    if (m_deliveredTime == CurrentTime) {
         return;
     }
-    Time t = timestamp(True);
-    if (m_focusPointerMoved) {  // only raise when pointer stops
-        if (t < m_focusTimestamp || t - m_focusTimestamp > CONFIG_POINTER_STOPPED_DELAY) {
-            if (m_focusPointerNowStill) {
-                m_focusPointerMoved = False;
-            } else {
-                m_focusPointerNowStill = True; // until proven false
-            }
+    XFlush(m_windowManager->display());
+    int32_t ms = (int32_t) ((uint32_t) (WindowManager::monotonicTime() / 1000) - (uint32_t) m_deliveredTime);
+    if (ms >= 0 && ms < 10000) {
+        m_latency += ms;
+        ++m_latencyCount;
+    }
+    m_deliveredTime = CurrentTime;
+}
+
+Boolean GrabEvents::next(XEvent *e) {
+    const long long frame = 1000000LL / CONFIG_GRAB_FRAME_RATE;
+    Boolean waited = False;
+
+    if (CONFIG_REPORT_GRAB_STATS) {
+        noteLatency();
+    }
+
+    while (1) {
+        while (XCheckMaskEvent(m_windowManager->display(), m_mask, e)) {
+            m_windowManager->noteServerTime(e);
+            switch (e->type) {
+
+              case MotionNotify: {
+                m_motion = *e;
+                m_haveMotion = True;
+                ++m_motionCount;
+                break;
+              }
+              case ButtonPress:
+              case ButtonRelease:
+              case KeyPress:
+              case KeyRelease: {
+                // as ever, these carry their own coordinates and
+                // supersede any motion still waiting
+                m_haveMotion = False;
+                return True;
+              }
+              default: {
+                return True; // exposures &c can't wait for the frame
+              }
+
+            } // switch
         }
-    } else {
-        if (t < m_focusTimestamp|| t - m_focusTimestamp > (Time)CONFIG_AUTO_RAISE_DELAY) {
-            m_focusCandidate->focusIfAppropriate(True);
+
+        if (m_extraType && XCheckTypedEvent(m_windowManager->display(), m_extraType, e)) {
+            return True;
+        }
+
+        if (m_haveMotion) {
+            long long now = WindowManager::monotonicTime();
+            if (now - m_lastDelivery >= frame) {
+                *e = m_motion;
+                m_haveMotion = False;
+                m_lastDelivery = now;
+                m_deliveredTime = e->xmotion.time;
+                ++m_deliveredCount;
+                return True;
+            }
+            int ms = (int) ((m_lastDelivery + frame - now + 999) / 1000);
+            m_windowManager->setTimer(WindowManager::FrameTimer, ms);
+        } else if (waited) {
+            return False;
         }
+
+        m_windowManager->waitForActivity();
+        waited = True;
+    }
+}
+
+void WindowManager::checkDelaysForFocus() {
+    if (!CONFIG_AUTO_RAISE || !m_focusChanging) {
+        return;
+    }
+    if (m_focusPointerMoved) {  // only raise when pointer stops
+        m_focusPointerMoved = False;
+        setTimer(FocusTimer, CONFIG_POINTER_STOPPED_DELAY);
+        return;
+    }
+    m_focusCandidate->focusIfAppropriate(True);
+
+    // if the pointer has gone elsewhere, the crossing event that
+    // took it there will have started things off again
+    if (m_focusChanging) {
+        stopConsideringFocus();
     }
 }
 
-void WindowManager::considerFocusChange(Client *c, Window w, Time timestamp) {
+void WindowManager::considerFocusChange(Client *c, Window w) {
     if (!CONFIG_AUTO_RAISE) {
         return;
     }
@@ -221,7 +513,6 @@ void WindowManager::considerFocusChange(Client *c, Window w, Time timestamp) {
     }
 
     m_focusChanging = True;
-    m_focusTimestamp = timestamp;
     m_focusCandidate = c;
     m_focusCandidateWindow = w;
 
@@ -231,18 +522,19 @@ void WindowManager::considerFocusChange(Client *c, Window w, Time timestamp) {
     // windows for which we don't get motion events at all
 
     m_focusPointerMoved = False;
-    m_focusPointerNowStill = False;
     m_focusCandidate->selectOnMotion(m_focusCandidateWindow, True);
+    setTimer(FocusTimer, CONFIG_AUTO_RAISE_DELAY);
 }
 
 void WindowManager::stopConsideringFocus() {
     if (!CONFIG_AUTO_RAISE) {
         return;
     }
-    m_focusChanging = False;
     if (m_focusChanging && m_focusCandidateWindow) {
         m_focusCandidate->selectOnMotion(m_focusCandidateWindow, False);
     }
+    m_focusChanging = False;
+    cancelTimer(FocusTimer);
 }
 
 void Client::focusIfAppropriate(Boolean ifActive) {
@@ -468,11 +760,11 @@ void Client::eventUnmap(XUnmapEvent *e) {
         // If this line isn't here, the window will stay, but be blank.
         m_windowManager->removeFromOrderedList(this);
 
-        Client *c = windowManager()->windowToClient(transientFor());
+        Client *c = transientParent();
         if (c && !c->isActive() && !CONFIG_CLICK_TO_FOCUS && !c->isFocusOnClick()) {
             c->activate();
             if (CONFIG_AUTO_RAISE) {
-                c->windowManager()->considerFocusChange(this, c->m_window, windowManager()->timestamp(False));
+                c->windowManager()->considerFocusChange(this, c->m_window);
             } else if (CONFIG_RAISE_ON_FOCUS) {
                 c->mapRaised();
             }
@@ -502,9 +794,12 @@ void WindowManager::eventCreate(XCreateWindowEvent *e) {
 
 void WindowManager::eventDestroy(XDestroyWindowEvent *e) {
     Client *c = windowToClient(e->window);
-    if (c) {
+    // colormap windows are indexed too, but losing one of those
+    // doesn't mean losing the client
+    if (c && c->hasWindow(e->window)) {
         if (CONFIG_AUTO_RAISE && m_focusChanging && c == m_focusCandidate) {
             m_focusChanging = False;
+            cancelTimer(FocusTimer);
         }
         for (int i = m_clients.count() - 1; i >= 0; --i) {
             if (m_clients.item(i) == c) {
@@ -512,10 +807,16 @@ void WindowManager::eventDestroy(XDestroyWindowEvent *e) {
                 break;
             }
         }
+        for (int i = m_focusOrder.count() - 1; i >= 0; --i) {
+            if (m_focusOrder.item(i) == c) {
+                m_focusOrder.remove(i);
+                break;
+            }
+        }
+        // the window's gone, so most of what release asks for fails
+        ignoreErrors();
         c->release();
-        ignoreBadWindowErrors = True;
-        XSync(display(), False);
-        ignoreBadWindowErrors = False;
+        endIgnoringErrors();
     }
 }
 
@@ -634,7 +935,7 @@ void Client::eventProperty(XPropertyEvent *e) {
         }
         m_iconName = shouldDelete ? 0 : getProperty(a);
         if (setLabel()) {
-            rename();
+            retitle();
         }
         return;
       }
@@ -644,12 +945,17 @@ void Client::eventProperty(XPropertyEvent *e) {
         }
         m_name = shouldDelete ? 0 : getProperty(a);
         if (setLabel()) {
-            rename();
+            retitle();
         }
         return;
       }
       case XA_WM_TRANSIENT_FOR: {
         getTransient();
+        updateEdges();
+        return;
+      }
+      case XA_WM_HINTS: {
+        windowManager()->groupChanged(this);
         return;
       }
 
@@ -660,6 +966,15 @@ void Client::eventProperty(XPropertyEvent *e) {
         if (isActive()) {
             installColormap();
         }
+    } else if (a == Atoms::netwm_wmName) {
+        if (m_netwmName) {
+            XFree((char*) m_netwmName);
+        }
+        int length;
+        m_netwmName = shouldDelete ? 0 : getProperty(a, Atoms::utf8String, length);
+        if (setLabel()) {
+            retitle();
+        }
     }
 }
 
@@ -716,7 +1031,7 @@ void Client::eventEnter(XCrossingEvent *e) {
         if (!isActive() && !CONFIG_CLICK_TO_FOCUS && !isFocusOnClick()) {
             activate();
             if (CONFIG_AUTO_RAISE) {
-                windowManager()->considerFocusChange(this, m_window, e->time);
+                windowManager()->considerFocusChange(this, m_window);
             } else if (CONFIG_RAISE_ON_FOCUS) {
                 mapRaised();
             }
@@ -729,7 +1044,7 @@ Boolean Client::coordsInHole(int x, int y) { // relative to parent
 }
 
 Boolean Border::coordsInHole(int x, int y) { // this is all a bit of a hack
-    return (x > 1 && x < m_tabWidth[screen()] - 1 && y > 1 && y < m_tabWidth[screen()] - 1);
+    return (x > 1 && x < tabWidth() - 1 && y > 1 && y < tabWidth() - 1);
 }
 
 void WindowManager::eventFocusIn(XFocusInEvent *e) {
@@ -22,13 +22,14 @@
 #include <X11/Xatom.h>
 
 #include <X11/extensions/shape.h>
+#include <X11/extensions/sync.h>
 
 // True and False are defined in Xlib.h
 typedef char Boolean;
 
 #include "Config.h"
 
-#include "listmacro.h"
+#include "List.h"
 
 #define NewString(x) (strcpy((char *)malloc(strlen(x)+1),(x)))
 
@@ -47,6 +48,13 @@ typedef char Boolean;
 
 #include "Config.h"
 
+// Lengths (in 32-bit items) of the WM_HINTS and WM_NORMAL_HINTS
+// properties, as in Xlib's Xatomtype.h
+
+#define WM_HINTS_ELEMENTS       9
+#define SIZE_HINTS_ELEMENTS     18
+#define OLD_SIZE_HINTS_ELEMENTS 15
+
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include FT_OUTLINE_H
@@ -79,10 +87,13 @@ public:
     static Atom wm_delete;
     static Atom wm_takeFocus;
     static Atom wm_colormaps;
+    static Atom netwm_syncRequest;
+    static Atom netwm_syncRequestCounter;
     static Atom wmx_running;
 
     static Atom netwm_supportingWmCheck;
     static Atom netwm_wmName;
+    static Atom utf8String;
     static Atom netwm_supported;
     static Atom netwm_clientList;
     static Atom netwm_clientListStacking;
@@ -131,7 +142,7 @@ enum ClientType {
     NotifyClient    // netwm_winType_notify
 };
 
-declareList(AtomList, Atom);
+typedef List<Atom> AtomList;
 
 #define DESKTOP_LAYER 0
 
@@ -153,8 +164,6 @@ declareList(AtomList, Atom);
 
 #define MAX_LAYER    13
 
-extern Boolean ignoreBadWindowErrors; // tidiness hack
-
 #define AllButtonMask   ( Button1Mask | Button2Mask | Button3Mask | Button4Mask | Button5Mask )
 #define ButtonMask      ( ButtonPressMask | ButtonReleaseMask )
 #define DragMask        ( ButtonMask | ButtonMotionMask )
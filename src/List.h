@@ -0,0 +1,128 @@
+#ifndef _LIST_H_
+#define _LIST_H_
+
+#include <assert.h>
+#include <stdlib.h>
+#include <new>
+
+// Counts every block allocated by any List, for the debug output
+
+class ListStats {
+public:
+    static long allocations;
+};
+
+// Growable array.  Capacity doubles when it runs out and is kept when
+// items are removed, so a list that is filled and emptied over and
+// over stops allocating once it reaches its working size.  Items are
+// moved by copy-construction rather than memmove, so T needn't be
+// plain data.
+
+template <class T>
+class List {
+
+public:
+    typedef T *iterator;
+
+    List() : m_items(0), m_count(0), m_capacity(0) { }
+    ~List() {
+        remove_all();
+        free((void*) m_items);
+    }
+
+    long count() const { return m_count; }
+
+    T &item(long index) const {
+        assert(index >= 0 && index < m_count);
+        return m_items[index];
+    }
+    T *array(long index, long) {
+        return m_items + index;
+    }
+
+    iterator begin() const { return m_items; }
+    iterator end() const { return m_items + m_count; }
+
+    void reserve(long capacity) {
+        if (capacity <= m_capacity) {
+            return;
+        }
+        T *items = (T*) malloc(capacity * sizeof(T));
+        assert(items);
+        ++ListStats::allocations;
+        for (long i = 0; i < m_count; ++i) {
+            new (&items[i]) T(m_items[i]);
+            m_items[i].~T();
+        }
+        free((void*) m_items);
+        m_items = items;
+        m_capacity = capacity;
+    }
+
+    void append(const T &item) {
+        if (m_count == m_capacity) {
+            // item may live in this list, so copy it before moving
+            T temp(item);
+            reserve(m_capacity ? m_capacity * 2 : 8);
+            new (&m_items[m_count++]) T(temp);
+        } else {
+            new (&m_items[m_count++]) T(item);
+        }
+    }
+
+    void insert(long index, const T &item) {
+        assert(index >= 0 && index <= m_count);
+        if (index == m_count) {
+            append(item);
+            return;
+        }
+        T temp(item);
+        append(m_items[m_count - 1]);
+        for (long i = m_count - 2; i > index; --i) {
+            m_items[i] = m_items[i - 1];
+        }
+        m_items[index] = temp;
+    }
+
+    // keeps the order of the remaining items
+    void remove(long index) {
+        assert(index >= 0 && index < m_count);
+        for (long i = index; i < m_count - 1; ++i) {
+            m_items[i] = m_items[i + 1];
+        }
+        m_items[--m_count].~T();
+    }
+
+    // constant time, for where order doesn't matter: the last item
+    // takes the place of the removed one
+    void swap_remove(long index) {
+        assert(index >= 0 && index < m_count);
+        if (index != m_count - 1) {
+            m_items[index] = m_items[m_count - 1];
+        }
+        m_items[--m_count].~T();
+    }
+
+    void swap(long a, long b) {
+        assert(a >= 0 && a < m_count && b >= 0 && b < m_count);
+        T temp(m_items[a]);
+        m_items[a] = m_items[b];
+        m_items[b] = temp;
+    }
+
+    void remove_all() { // keeps the capacity
+        while (m_count > 0) {
+            m_items[--m_count].~T();
+        }
+    }
+
+private:
+    List(const List&); // not copyable
+    List &operator=(const List&);
+
+    T *m_items;
+    long m_count;
+    long m_capacity;
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "Manager.h"
 #include "Menu.h"
 #include "Client.h"
+#include "Theme.h"
+#include "CommandTree.h"
 
 #include <X11/Xlocale.h>
 
@@ -9,12 +11,17 @@
 #include <X11/keysym.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <spawn.h>
 
 #include <X11/cursorfont.h>
+#include <fcntl.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/shape.h>
 
 #if CONFIG_USE_COMPOSITE
 #include <X11/extensions/Xcomposite.h>
 #endif
+#include "Compositor.h"
 #if CONFIG_CLEAR_NUMLOCK
 #include <X11/XKBlib.h>
 void clearNumLock(Display*);
@@ -26,10 +33,13 @@ Atom Atoms::wm_protocols;
 Atom Atoms::wm_delete;
 Atom Atoms::wm_takeFocus;
 Atom Atoms::wm_colormaps;
+Atom Atoms::netwm_syncRequest;
+Atom Atoms::netwm_syncRequestCounter;
 Atom Atoms::wmx_running;
 
 Atom Atoms::netwm_supportingWmCheck;
 Atom Atoms::netwm_wmName;
+Atom Atoms::utf8String;
 Atom Atoms::netwm_supported;
 Atom Atoms::netwm_clientList;
 Atom Atoms::netwm_clientListStacking;
@@ -59,21 +69,103 @@ Atom Atoms::netwm_winType_combo;
 Atom Atoms::netwm_winType_dnd;
 Atom Atoms::netwm_winType_normal;
 
+// Everything we intern, so that it can be done in one request
+
+static struct {
+    Atom *atom;
+    const char *name;
+} atomTable[] = {
+    { &Atoms::wm_state, "WM_STATE" },
+    { &Atoms::wm_changeState, "WM_CHANGE_STATE" },
+    { &Atoms::wm_protocols, "WM_PROTOCOLS" },
+    { &Atoms::wm_delete, "WM_DELETE_WINDOW" },
+    { &Atoms::wm_takeFocus, "WM_TAKE_FOCUS" },
+    { &Atoms::wm_colormaps, "WM_COLORMAP_WINDOWS" },
+    { &Atoms::netwm_syncRequest, "_NET_WM_SYNC_REQUEST" },
+    { &Atoms::netwm_syncRequestCounter, "_NET_WM_SYNC_REQUEST_COUNTER" },
+    { &Atoms::wmx_running, "_WMX_RUNNING" },
+
+    { &Atoms::netwm_supportingWmCheck, "_NET_SUPPORTING_WM_CHECK" },
+    { &Atoms::netwm_wmName, "_NET_WM_NAME" },
+    { &Atoms::utf8String, "UTF8_STRING" },
+    { &Atoms::netwm_supported, "_NET_SUPPORTED" },
+    { &Atoms::netwm_clientList, "_NET_CLIENT_LIST" },
+    { &Atoms::netwm_clientListStacking, "_NET_CLIENT_LIST_STACKING" },
+    { &Atoms::netwm_desktop, "_NET_CURRENT_DESKTOP" },
+    { &Atoms::netwm_desktopCount, "_NET_NUMBER_OF_DESKTOPS" },
+    { &Atoms::netwm_desktopNames, "_NET_DESKTOP_NAMES" },
+    { &Atoms::netwm_activeWindow, "_NET_ACTIVE_WINDOW" },
+    //!!! "replaced with _NET_WM_WINDOW_TYPE functional hint":
+    { &Atoms::netwm_winLayer, "_WIN_LAYER" },
+    //!!! what is this??
+    { &Atoms::netwm_winDesktopButtonProxy, "_WIN_DESKTOP_BUTTON_PROXY" },
+    //!!! "replaced with _NET_WM_WINDOW_TYPE functional hint":
+    { &Atoms::netwm_winHints, "_WIN_HINTS" },
+    { &Atoms::netwm_winState, "_NET_WM_STATE" },
+    { &Atoms::netwm_winDesktop, "_NET_WM_DESKTOP" },
+
+    { &Atoms::netwm_winType, "_NET_WM_WINDOW_TYPE" },
+
+    { &Atoms::netwm_winType_desktop, "_NET_WM_WINDOW_TYPE_DESKTOP" },
+    { &Atoms::netwm_winType_dock, "_NET_WM_WINDOW_TYPE_DOCK" },
+    { &Atoms::netwm_winType_toolbar, "_NET_WM_WINDOW_TYPE_TOOLBAR" },
+    { &Atoms::netwm_winType_menu, "_NET_WM_WINDOW_TYPE_MENU" },
+    { &Atoms::netwm_winType_utility, "_NET_WM_WINDOW_TYPE_UTILITY" },
+    { &Atoms::netwm_winType_splash, "_NET_WM_WINDOW_TYPE_SPLASH" },
+    { &Atoms::netwm_winType_dialog, "_NET_WM_WINDOW_TYPE_DIALOG" },
+    { &Atoms::netwm_winType_dropdown, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU" },
+    { &Atoms::netwm_winType_popup, "_NET_WM_WINDOW_TYPE_POPUP_MENU" },
+    { &Atoms::netwm_winType_tooltip, "_NET_WM_WINDOW_TYPE_TOOLTIP" },
+    { &Atoms::netwm_winType_notify, "_NET_WM_WINDOW_TYPE_NOTIFICATION" },
+    { &Atoms::netwm_winType_combo, "_NET_WM_WINDOW_TYPE_COMBO" },
+    { &Atoms::netwm_winType_dnd, "_NET_WM_WINDOW_TYPE_DND" },
+    { &Atoms::netwm_winType_normal, "_NET_WM_WINDOW_TYPE_NORMAL" },
+};
+
 int WindowManager::m_signalled = False;
 int WindowManager::m_restart = False;
+volatile sig_atomic_t WindowManager::m_printStats = False;
+volatile sig_atomic_t WindowManager::m_resetStats = False;
 Boolean WindowManager::m_initialising = False;
-Boolean ignoreBadWindowErrors;
+List<WindowManager::IgnoredErrors> WindowManager::m_ignoredErrors;
+int WindowManager::m_ignoringErrors = 0;
+
+long WindowManager::m_roundTrips = 0;
+unsigned long WindowManager::m_lastKnownRequest = 0;
 
-implementPList(ClientList, Client); // @suppress("Method cannot be resolved")
-implementList(AtomList, Atom);  // @suppress("Method cannot be resolved")
+long ListStats::allocations = 0;
 
 WindowManager::WindowManager(int argc, char **argv) :
+    m_textCache(CONFIG_TEXT_CACHE_SIZE),
+    m_theme(0),
+    m_xcb(0),
+    m_compositor(0),
+    m_commandTree(0),
+    m_displayEnv(0),
+    m_startTime(monotonicTime()),
     m_focusChanging(False),
+    m_epollFd(-1),
+    m_timerFd(-1),
+    m_timerArmed(0),
+    m_wakeups(0),
     m_altPressed(False),
-    m_altStateRetained(False),
     m_netwmCheckWin(0),
+    m_netwmDirty(0),
+    m_netwmClientList(0),
+    m_netwmClientListCount(-1),
+    m_netwmStacking(0),
+    m_netwmStackingCount(-1),
+    m_netwmActive(0),
+    m_netwmActiveCount(-1),
+    m_eventCount(0),
+    m_netwmWrites(0),
+    m_netwmSkips(0),
     m_altModMask(0) // later
 {
+    for (int layer = 0; layer <= MAX_LAYER; ++layer) {
+        m_stackTop[layer] = m_stackBottom[layer] = 0;
+    }
+
     char *home = getenv("HOME");
     char *wmxdir = getenv("WMXDIR");
 
@@ -182,6 +274,11 @@ WindowManager::WindowManager(int argc, char **argv) :
     if (!m_display) {
         fatal("can't open display");
     }
+    if (CONFIG_REPORT_STARTUP || CONFIG_EVENT_STATS) {
+        XSetAfterFunction(m_display, countRoundTrips);
+    }
+
+    m_xcb = XGetXCBConnection(m_display);
 
     m_shell = (char*) getenv("SHELL");
     if (!m_shell) {
@@ -223,91 +320,88 @@ WindowManager::WindowManager(int argc, char **argv) :
 
     m_initialising = True;
     XSetErrorHandler(errorHandler);
-    ignoreBadWindowErrors = False;
 
     // 9wm does more, I think for nohup
     signal(SIGTERM, sigHandler);
     signal(SIGINT, sigHandler);
     signal(SIGHUP, sigHandler);
+    if (CONFIG_EVENT_STATS) {
+        signal(SIGUSR1, statsSigHandler);
+        signal(SIGUSR2, statsSigHandler);
+    }
 
-    m_currentTime = -1;
+    m_currentTime = CurrentTime;
+    m_serverTime = CurrentTime;
+    m_serverTimeAt = 0;
+    m_timeWindow = None;
     m_activeClient = 0;
 
-    Atoms::wm_state = XInternAtom(m_display, "WM_STATE", False);
-    Atoms::wm_changeState = XInternAtom(m_display, "WM_CHANGE_STATE", False);
-    Atoms::wm_protocols = XInternAtom(m_display, "WM_PROTOCOLS", False);
-    Atoms::wm_delete = XInternAtom(m_display, "WM_DELETE_WINDOW", False);
-    Atoms::wm_takeFocus = XInternAtom(m_display, "WM_TAKE_FOCUS", False);
-    Atoms::wm_colormaps = XInternAtom(m_display, "WM_COLORMAP_WINDOWS", False);
-    Atoms::wmx_running = XInternAtom(m_display, "_WMX_RUNNING", False);
-
-    Atoms::netwm_supportingWmCheck = XInternAtom(m_display, "_NET_SUPPORTING_WM_CHECK", False);
-    Atoms::netwm_wmName = XInternAtom(m_display, "_NET_WM_NAME", False);
-    Atoms::netwm_supported = XInternAtom(m_display, "_NET_SUPPORTED", False);
-    Atoms::netwm_clientList = XInternAtom(m_display, "_NET_CLIENT_LIST", False);
-    Atoms::netwm_clientListStacking = XInternAtom(m_display, "_NET_CLIENT_LIST_STACKING", False);
-    Atoms::netwm_desktop = XInternAtom(m_display, "_NET_CURRENT_DESKTOP", False);
-    Atoms::netwm_desktopCount = XInternAtom(m_display, "_NET_NUMBER_OF_DESKTOPS", False);
-    Atoms::netwm_desktopNames = XInternAtom(m_display, "_NET_DESKTOP_NAMES", False);
-    Atoms::netwm_activeWindow = XInternAtom(m_display, "_NET_ACTIVE_WINDOW", False);
-    //!!! "replaced with _NET_WM_WINDOW_TYPE functional hint":
-    Atoms::netwm_winLayer = XInternAtom(m_display, "_WIN_LAYER", False);
-    //!!! what is this??
-    Atoms::netwm_winDesktopButtonProxy = XInternAtom(m_display, "_WIN_DESKTOP_BUTTON_PROXY", False);
-    //!!! "replaced with _NET_WM_WINDOW_TYPE functional hint":
-    Atoms::netwm_winHints = XInternAtom(m_display, "_WIN_HINTS", False);
-    Atoms::netwm_winState = XInternAtom(m_display, "_NET_WM_STATE", False);
-    Atoms::netwm_winDesktop = XInternAtom(m_display, "_NET_WM_DESKTOP", False);
-
-    Atoms::netwm_winType = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE", False);
-
-    Atoms::netwm_winType_desktop = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_DESKTOP", False);
-    Atoms::netwm_winType_dock = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_DOCK", False);
-    Atoms::netwm_winType_toolbar = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_TOOLBAR", False);
-    Atoms::netwm_winType_menu = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_MENU", False);
-    Atoms::netwm_winType_utility = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_UTILITY", False);
-    Atoms::netwm_winType_splash = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_SPLASH", False);
-    Atoms::netwm_winType_dialog = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-    Atoms::netwm_winType_dropdown = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_DROPDOWN_MENU", False);
-    Atoms::netwm_winType_popup = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_POPUP_MENU", False);
-    Atoms::netwm_winType_tooltip = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_TOOLTIP", False);
-    Atoms::netwm_winType_notify = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_NOTIFICATION", False);
-    Atoms::netwm_winType_combo = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_COMBO", False);
-    Atoms::netwm_winType_dnd = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_DND", False);
-    Atoms::netwm_winType_normal = XInternAtom(m_display, "_NET_WM_WINDOW_TYPE_NORMAL", False);
+    initialiseAtoms();
 
     int dummy;
     if (!XShapeQueryExtension(m_display, &m_shapeEvent, &dummy)) {
         fatal("no shape extension, can't run without it");
     }
+    m_syncEvent = 0;
+    if (XSyncQueryExtension(m_display, &m_syncEvent, &dummy)) {
+        int major, minor;
+        if (!XSyncInitialize(m_display, &major, &minor)) {
+            m_syncEvent = 0;
+        }
+    }
     initialiseScreen();
+    prefetchColours();
+    m_theme = new Theme(this);
+    initialiseLauncher();
     if (m_screensTotal > 1) {
         fprintf(stderr, "Detected %d screens.\n", m_screensTotal);
     }
 
-#if CONFIG_USE_COMPOSITE
-    int ev, er;
-    if (XCompositeQueryExtension(m_display, &ev, &er)) {
-        fprintf(stderr, "Enabling composite extension.\n");
-        for (int i = 0; i < m_screensTotal; ++i) {
-            XCompositeRedirectSubwindows(m_display, RootWindow(m_display, i),
-            CompositeRedirectAutomatic);
-        }
-    }
-#endif
-
     XSetSelectionOwner(m_display, Atoms::wmx_running,
     None, timestamp(True)); // used to have m_menuWindow
     XSync(m_display, False);
     m_initialising = False;
     m_returnCode = 0;
 
+    initialiseEventLoop();
+    m_commandTree = new CommandTree(this);
+
+#if CONFIG_USE_COMPOSITE
+    // the compositor wants the event loop, and deals with its own
+    // errors, so this comes after initialisation proper
+    int ev, er;
+    if (XCompositeQueryExtension(m_display, &ev, &er)) {
+        if (CONFIG_MANUAL_COMPOSITE) {
+            m_compositor = Compositor::create(this);
+        }
+        if (m_compositor) {
+            fprintf(stderr, "Compositing windows ourselves.\n");
+        } else {
+            fprintf(stderr, "Enabling composite extension.\n");
+            for (int i = 0; i < m_screensTotal; ++i) {
+                XCompositeRedirectSubwindows(m_display, RootWindow(m_display, i),
+                CompositeRedirectAutomatic);
+            }
+        }
+    }
+#endif
     netwmInitialiseCompliance();
     fprintf(stderr, "\n");
 
     clearFocus();
     scanInitialWindows();
     updateStackingOrder();
+
+    if (CONFIG_REPORT_STARTUP) {
+        XSync(m_display, False);
+        if (!CONFIG_EVENT_STATS) {
+            XSetAfterFunction(m_display, 0);
+        }
+        fprintf(stderr, "wmx: startup took %.1fms, %lu requests, about %ld round trips\n",
+        (monotonicTime() - m_startTime) / 1000.0,
+        NextRequest(m_display) - 1, m_roundTrips);
+    }
+
     loop();
     if (m_restart == True) {
         fprintf(stderr, "restarting wmx from SIGHUP\n");
@@ -319,6 +413,20 @@ WindowManager::~WindowManager() {
     if (m_netwmCheckWin) {
         XDestroyWindow(m_display, m_netwmCheckWin);
     }
+    free((void*) m_netwmClientList);
+    free((void*) m_netwmStacking);
+    free((void*) m_netwmActive);
+
+    for (int i = 0; i < m_colours.count(); ++i) {
+        free(m_colours.item(i).name);
+    }
+
+    if (m_displayEnv) {
+        for (int i = 0; i < m_screensTotal; ++i) {
+            free(m_displayEnv[i]);
+        }
+        free(m_displayEnv);
+    }
 }
 
 int WindowManager::numdigits(int number) {
@@ -354,6 +462,7 @@ void WindowManager::release() {
 
     m_clients.remove_all();
     m_hiddenClients.remove_all();
+    m_focusOrder.remove_all();
     for (i = 0; i < unparentList.count(); ++i) {
         // fprintf(stderr, "release: unparenting client %p\n", unparentList.item(i));
         unparentList.item(i)->unreparent();
@@ -371,7 +480,19 @@ void WindowManager::release() {
     XFreeCursor(m_display, m_vhCursor);
 
     Menu::cleanup(this);
+    delete m_theme;
+    m_theme = 0;
+
+    delete m_compositor;
+    m_compositor = 0;
+    delete m_commandTree;
+    m_commandTree = 0;
+    if (m_timeWindow) {
+        XDestroyWindow(m_display, m_timeWindow);
+    }
 
+    close(m_timerFd);
+    close(m_epollFd);
     XCloseDisplay(m_display);
 }
 
@@ -386,15 +507,31 @@ void WindowManager::fatal(const char *message) {
     exit(1);
 }
 
+// Called by Xlib after every request.  If the server has caught up
+// with everything we've sent, we must have waited for it: a reply, a
+// sync, or an event we blocked on.
+
+int WindowManager::countRoundTrips(Display *d) {
+    unsigned long known = LastKnownRequestProcessed(d);
+    if (known != m_lastKnownRequest && known == NextRequest(d) - 1) {
+        ++m_roundTrips;
+    }
+    m_lastKnownRequest = known;
+    return 0;
+}
+
 int WindowManager::errorHandler(Display *d, XErrorEvent *e) {
     if (m_initialising && (e->request_code == X_ChangeWindowAttributes) && e->error_code == BadAccess) {
         fprintf(stderr, "\nwmx: another window manager running?\n");
         exit(1);
     }
 
-    // ugh
-    if (ignoreBadWindowErrors == True && e->error_code == BadWindow) {
-        return 0;
+    for (int i = 0; i < m_ignoredErrors.count(); ++i) {
+        IgnoredErrors &ie = m_ignoredErrors.item(i);
+        if (e->serial >= ie.first && e->serial <= ie.last &&
+            e->error_code < 32 && (ie.codes & (1L << e->error_code))) {
+            return 0;
+        }
     }
     char msg[100], number[30], request[100];
     XGetErrorText(d, e->error_code, msg, 100);
@@ -414,6 +551,37 @@ int WindowManager::errorHandler(Display *d, XErrorEvent *e) {
     return 0;
 }
 
+void WindowManager::ignoreErrors(unsigned long codes) {
+    if (m_ignoringErrors++ > 0) {
+        m_ignoredErrors.item(m_ignoredErrors.count() - 1).codes |= codes;
+        return;
+    }
+
+    // forget ranges the server has finished with; any errors from
+    // them have been handled by now
+    unsigned long done = LastKnownRequestProcessed(m_display);
+    for (int i = m_ignoredErrors.count() - 1; i >= 0; --i) {
+        if (m_ignoredErrors.item(i).last < done) {
+            m_ignoredErrors.swap_remove(i);
+        }
+    }
+
+    IgnoredErrors ie;
+    ie.first = NextRequest(m_display);
+    ie.last = ~0UL;
+    ie.codes = codes;
+    m_ignoredErrors.append(ie);
+}
+
+void WindowManager::endIgnoringErrors() {
+    if (m_ignoringErrors == 0) {
+        return;
+    }
+    if (--m_ignoringErrors == 0) {
+        m_ignoredErrors.item(m_ignoredErrors.count() - 1).last = NextRequest(m_display) - 1;
+    }
+}
+
 void WindowManager::setScreenFromRoot(Window root) {
     int s;
     m_screenNumber = 0;
@@ -424,6 +592,23 @@ void WindowManager::setScreenFromRoot(Window root) {
     }
 }
 
+void WindowManager::initialiseAtoms() {
+    const int n = sizeof(atomTable) / sizeof(atomTable[0]);
+    char *names[n];
+    Atom atoms[n];
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        names[i] = (char*) atomTable[i].name;
+    }
+    if (!XInternAtoms(m_display, names, n, False, atoms)) {
+        fatal("couldn't intern atoms");
+    }
+    for (i = 0; i < n; ++i) {
+        *atomTable[i].atom = atoms[i];
+    }
+}
+
 void WindowManager::initialiseScreen() {
     int i;
     m_screensTotal = ScreenCount(m_display);
@@ -431,25 +616,18 @@ void WindowManager::initialiseScreen() {
     m_root = (Window*) malloc(m_screensTotal * sizeof(Window));
     m_defaultColormap = (Colormap*) malloc(m_screensTotal * sizeof(Colormap));
 
+    // cursors aren't tied to a screen, so one set does for all
+    m_cursor = XCreateFontCursor(m_display, XC_top_left_arrow);
+    m_xCursor = XCreateFontCursor(m_display, XC_X_cursor);
+    m_hCursor = XCreateFontCursor(m_display, XC_right_side);
+    m_vCursor = XCreateFontCursor(m_display, XC_bottom_side);
+    m_vhCursor = XCreateFontCursor(m_display, XC_bottom_right_corner);
+
     for (i = 0; i < m_screensTotal; i++) {
         m_screenNumber = i;
         m_root[i] = RootWindow(m_display, i);
         m_defaultColormap[i] = DefaultColormap(m_display, i);
 
-        XColor black, white, temp;
-
-        if (!XAllocNamedColor(m_display, m_defaultColormap[i], "black", &black, &temp)) {
-            fatal("couldn't load colour \"black\"!");
-        }
-        if (!XAllocNamedColor(m_display, m_defaultColormap[i], "white", &white, &temp)) {
-            fatal("couldn't load colour \"white\"!");
-        }
-        m_cursor = XCreateFontCursor(m_display, XC_top_left_arrow);
-        m_xCursor = XCreateFontCursor(m_display, XC_X_cursor);
-        m_hCursor = XCreateFontCursor(m_display, XC_right_side);
-        m_vCursor = XCreateFontCursor(m_display, XC_bottom_side);
-        m_vhCursor = XCreateFontCursor(m_display, XC_bottom_right_corner);
-
         XSetWindowAttributes attr;
         attr.cursor = m_cursor;
         attr.event_mask = SubstructureRedirectMask | SubstructureNotifyMask |
@@ -457,14 +635,104 @@ void WindowManager::initialiseScreen() {
         PropertyChangeMask | LeaveWindowMask | KeyPressMask | KeyReleaseMask;
 
         XChangeWindowAttributes(m_display, m_root[i], CWCursor | CWEventMask, &attr);
-        XSync(m_display, False);
     }
 
+    // one sync for all screens: the error handler catches a BadAccess
+    // from any of them
+    XSync(m_display, False);
+
     m_screenNumber = 0;
 }
 
+void WindowManager::prefetchColours() {
+    static const char *const names[] = {
+        CONFIG_TAB_FOREGROUND, CONFIG_TAB_BACKGROUND, CONFIG_FRAME_BACKGROUND,
+        CONFIG_BUTTON_BACKGROUND, CONFIG_BORDERS,
+        CONFIG_MENU_FOREGROUND, CONFIG_MENU_BACKGROUND, CONFIG_MENU_BORDERS
+    };
+    const int n = sizeof(names) / sizeof(names[0]);
+    int s, i;
+
+    // send them all, then collect the replies
+    xcb_lookup_color_cookie_t *cookies = (xcb_lookup_color_cookie_t*)
+    malloc(m_screensTotal * n * sizeof(xcb_lookup_color_cookie_t));
+
+    for (s = 0; s < m_screensTotal; ++s) {
+        for (i = 0; i < n; ++i) {
+            cookies[s * n + i] = xcb_lookup_color(m_xcb, m_defaultColormap[s], strlen(names[i]), names[i]);
+        }
+    }
+    noteRoundTrip();
+
+    for (s = 0; s < m_screensTotal; ++s) {
+        for (i = 0; i < n; ++i) {
+            xcb_generic_error_t *error = 0;
+            xcb_lookup_color_reply_t *reply = xcb_lookup_color_reply(m_xcb, cookies[s * n + i], &error);
+            XColor exact;
+            if (reply && !findColour(s, names[i], exact)) {
+                ColourEntry entry;
+                entry.screen = s;
+                entry.name = NewString(names[i]);
+                entry.exact.red = reply->exact_red;
+                entry.exact.green = reply->exact_green;
+                entry.exact.blue = reply->exact_blue;
+                entry.exact.flags = DoRed | DoGreen | DoBlue;
+                m_colours.append(entry);
+            }
+            free(reply);
+            free(error);
+        }
+    }
+
+    free(cookies);
+}
+
+Boolean WindowManager::findColour(int screen, const char *name, XColor &exact) {
+    for (int i = 0; i < m_colours.count(); ++i) {
+        ColourEntry &entry = m_colours.item(i);
+        if (entry.screen == screen && !strcmp(entry.name, name)) {
+            exact = entry.exact;
+            return True;
+        }
+    }
+    return False;
+}
+
+// Scale a 16-bit colour component into the bits of a TrueColor mask
+
+static unsigned long scaleToMask(unsigned short value, unsigned long mask) {
+    int shift = 0, bits = 0;
+    if (!mask) {
+        return 0;
+    }
+    while (!(mask & 1)) {
+        mask >>= 1;
+        ++shift;
+    }
+    while (mask & 1) {
+        mask >>= 1;
+        ++bits;
+    }
+    if (bits > 16) {
+        bits = 16;
+    }
+    return ((unsigned long) (value >> (16 - bits))) << shift;
+}
+
 unsigned long WindowManager::allocateColour(int screen, const char *name, const char *desc) {
     XColor nearest, ideal;
+    if (findColour(screen, name, ideal)) {
+        Visual *visual = DefaultVisual(display(), screen);
+        if (visual->c_class == TrueColor) {
+            return scaleToMask(ideal.red, visual->red_mask) |
+                   scaleToMask(ideal.green, visual->green_mask) |
+                   scaleToMask(ideal.blue, visual->blue_mask);
+        }
+        nearest = ideal;
+        if (XAllocColor(display(), DefaultColormap(display(), screen), &nearest)) {
+            return nearest.pixel;
+        }
+    }
     if (!XAllocNamedColor(display(), DefaultColormap(display(), screen), name, &nearest, &ideal)) {
         char error[100];
         sprintf(error, "couldn't load %s colour", desc);
@@ -473,6 +741,24 @@ unsigned long WindowManager::allocateColour(int screen, const char *name, const
     return nearest.pixel;
 }
 
+void WindowManager::allocateXftColour(int screen, const char *name, XftColor *colour) {
+    Visual *visual = DefaultVisual(display(), screen);
+    Colormap colormap = DefaultColormap(display(), screen);
+    XColor exact;
+
+    if (findColour(screen, name, exact)) {
+        XRenderColor render;
+        render.red = exact.red;
+        render.green = exact.green;
+        render.blue = exact.blue;
+        render.alpha = 0xffff;
+        if (XftColorAllocValue(display(), visual, colormap, &render, colour)) {
+            return;
+        }
+    }
+    XftColorAllocName(display(), visual, colormap, name, colour);
+}
+
 void WindowManager::installCursor(RootCursor c) {
     installCursorOnWindow(c, root());
 }
@@ -508,17 +794,89 @@ void WindowManager::installCursorOnWindow(RootCursor c, Window w) {
     XChangeWindowAttributes(m_display, w, CWCursor, &attr);
 }
 
+// An event's time is never later than the server's clock when we read
+// the event, so adding our own elapsed time to it gives an estimate
+// that errs on the early side.  That's the safe side: the server
+// ignores focus changes and grabs timestamped in its future.  We
+// only ask the server outright when we've nothing recent enough to
+// go on, and then on a window of our own, so that nothing else is
+// pulled out of the queue.
+
+Time WindowManager::noteServerTime(XEvent *ev) {
+    Time t;
+
+    switch (ev->type) {
+      case KeyPress:
+      case KeyRelease:
+        t = ev->xkey.time;
+        break;
+      case ButtonPress:
+      case ButtonRelease:
+        t = ev->xbutton.time;
+        break;
+      case MotionNotify:
+        t = ev->xmotion.time;
+        break;
+      case EnterNotify:
+      case LeaveNotify:
+        t = ev->xcrossing.time;
+        break;
+      case PropertyNotify:
+        t = ev->xproperty.time;
+        break;
+      case SelectionClear:
+        t = ev->xselectionclear.time;
+        break;
+      default:
+        return CurrentTime;
+    }
+
+    // anyone can send an event with any time in it, so a synthetic
+    // event's time is neither believed nor passed on
+    if (ev->xany.send_event || t == CurrentTime) {
+        return CurrentTime;
+    }
+
+    // one read late from the queue may be older than what we
+    // already have, and we mustn't go backwards.  The server's clock
+    // is 32 bits of milliseconds and wraps every 49 days, so compare
+    // the way it does, modulo 2^32.
+    long long now = monotonicTime();
+    CARD32 estimate = (CARD32) (m_serverTime + (Time) ((now - m_serverTimeAt) / 1000));
+    if (!m_serverTimeAt || (int32_t) ((CARD32) t - estimate) > 0) {
+        m_serverTime = t;
+        m_serverTimeAt = now;
+    }
+    return t;
+}
+
 Time WindowManager::timestamp(Boolean reset) {
     if (reset) {
         m_currentTime = CurrentTime;
     }
-    if (m_currentTime == CurrentTime) {
-        XEvent event;
-        XChangeProperty(m_display, root(), Atoms::wmx_running, Atoms::wmx_running, 8, PropModeAppend, (unsigned char*) "", 0);
-        XMaskEvent(m_display, PropertyChangeMask, &event);
-        m_currentTime = event.xproperty.time;
+    if (m_currentTime != CurrentTime) {
+        return m_currentTime;
+    }
+
+    long long now = monotonicTime();
+    if (m_serverTimeAt && now - m_serverTimeAt < CONFIG_TIMESTAMP_ESTIMATE_AGE * 1000LL) {
+        return (CARD32) (m_serverTime + (Time) ((now - m_serverTimeAt) / 1000));
     }
-    return m_currentTime;
+
+    if (!m_timeWindow) {
+        XSetWindowAttributes attr;
+        attr.event_mask = PropertyChangeMask;
+        attr.override_redirect = True;
+        m_timeWindow = XCreateWindow(m_display, m_root[0], -1, -1, 1, 1, 0, 0, InputOnly, CopyFromParent,
+            CWEventMask | CWOverrideRedirect, &attr);
+    }
+
+    XEvent event;
+    XChangeProperty(m_display, m_timeWindow, Atoms::wmx_running, Atoms::wmx_running, 8, PropModeAppend, (unsigned char*) "", 0);
+    XWindowEvent(m_display, m_timeWindow, PropertyChangeMask, &event);
+    m_serverTime = event.xproperty.time;
+    m_serverTimeAt = monotonicTime();
+    return m_serverTime;
 }
 
 void WindowManager::sigHandler(int signal) {
@@ -529,55 +887,133 @@ void WindowManager::sigHandler(int signal) {
     }
 }
 
+void WindowManager::statsSigHandler(int signal) {
+    if (signal == SIGUSR1) {
+        m_printStats = True;
+    } else {
+        m_resetStats = True;
+    }
+}
+
 void WindowManager::scanInitialWindows() {
-    unsigned int i, n;
+    unsigned int n;
     int s;
     Window w1, w2, *wins;
-    XWindowAttributes attr;
 
     for (s = 0; s < m_screensTotal; s++) {
         XQueryTree(m_display, m_root[s], &w1, &w2, &wins, &n);
-        for (i = 0; i < n; ++i) {
-            XGetWindowAttributes(m_display, wins[i], &attr);
-            if (attr.override_redirect) {
-                continue;
-            }
-            (void) windowToClient(wins[i], True);
-        }
+        adoptWindows(wins, n);
         XFree((void*) wins);
     }
 }
 
+// Manage the windows that were already there when we started.  The
+// attribute, geometry and shape queries all go out before any reply
+// is read, so taking them on costs one round trip however many there
+// are.
+
+void WindowManager::adoptWindows(Window *wins, unsigned int n) {
+    xcb_get_window_attributes_cookie_t *attrCookies;
+    xcb_get_geometry_cookie_t *geomCookies;
+    xcb_shape_query_extents_cookie_t *shapeCookies;
+    unsigned int i;
+
+    if (n == 0) {
+        return;
+    }
+
+    attrCookies = (xcb_get_window_attributes_cookie_t*)
+    malloc(n * sizeof(xcb_get_window_attributes_cookie_t));
+    geomCookies = (xcb_get_geometry_cookie_t*)
+    malloc(n * sizeof(xcb_get_geometry_cookie_t));
+    shapeCookies = (xcb_shape_query_extents_cookie_t*)
+    malloc(n * sizeof(xcb_shape_query_extents_cookie_t));
+
+    for (i = 0; i < n; ++i) {
+        attrCookies[i] = xcb_get_window_attributes(m_xcb, wins[i]);
+        geomCookies[i] = xcb_get_geometry(m_xcb, wins[i]);
+        shapeCookies[i] = xcb_shape_query_extents(m_xcb, wins[i]);
+    }
+    noteRoundTrip();
+
+    for (i = 0; i < n; ++i) {
+        xcb_generic_error_t *error = 0;
+        xcb_get_window_attributes_reply_t *a =
+        xcb_get_window_attributes_reply(m_xcb, attrCookies[i], &error);
+        free(error);
+        error = 0;
+        xcb_get_geometry_reply_t *g =
+        xcb_get_geometry_reply(m_xcb, geomCookies[i], &error);
+        free(error);
+        error = 0;
+        xcb_shape_query_extents_reply_t *sh =
+        xcb_shape_query_extents_reply(m_xcb, shapeCookies[i], &error);
+        free(error);
+
+        // a window that went away, an override-redirect one, or one
+        // we already know about (a colormap window perhaps)
+        if (a && g && !a->override_redirect && !m_windowMap.find(wins[i])) {
+            XWindowAttributes attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.x = g->x;
+            attr.y = g->y;
+            attr.width = g->width;
+            attr.height = g->height;
+            attr.border_width = g->border_width;
+            attr.depth = g->depth;
+            attr.root = g->root;
+            attr.map_state = a->map_state;
+            attr.override_redirect = a->override_redirect;
+            (void) createClient(wins[i], sh && sh->bounding_shaped, &attr);
+        }
+
+        free(a);
+        free(g);
+        free(sh);
+    }
+
+    free(attrCookies);
+    free(geomCookies);
+    free(shapeCookies);
+}
+
 Client* WindowManager::windowToClient(Window w, Boolean create) {
     if (w == 0) {
         return 0;
     }
-    for (int i = m_clients.count() - 1; i >= 0; --i) {
-        if (m_clients.item(i)->hasWindow(w)) {
-            return m_clients.item(i);
-        }
+    Client *c = m_windowMap.find(w);
+    if (c) {
+        return c;
     }
     if (!create) {
         return 0;
     } else {
-        Client *newC = 0;
-        int bounding_shape = -1;
-        int clip_shape = -1;
-        int x_bounding = 0;
-        int y_bounding = 0;
-        unsigned int w_bounding = 0;
-        unsigned int h_bounding = 0;
-        unsigned int w_clip = 0;
-        unsigned int h_clip = 0;
-        int x_clip = 0;
-        int y_clip = 0;
-        (void) XShapeQueryExtents(m_display, w, &bounding_shape, &x_bounding, &y_bounding, &w_bounding, &h_bounding, &clip_shape, &x_clip, &y_clip, &w_clip, &h_clip);
-        newC = new Client(this, w, bounding_shape == 1);
-        m_clients.append(newC);
-        return newC;
+        return createClient(w, isShaped(w), 0);
     }
 }
 
+Boolean WindowManager::isShaped(Window w) {
+    int bounding_shape = -1;
+    int clip_shape = -1;
+    int x_bounding = 0;
+    int y_bounding = 0;
+    unsigned int w_bounding = 0;
+    unsigned int h_bounding = 0;
+    unsigned int w_clip = 0;
+    unsigned int h_clip = 0;
+    int x_clip = 0;
+    int y_clip = 0;
+    (void) XShapeQueryExtents(m_display, w, &bounding_shape, &x_bounding, &y_bounding, &w_bounding, &h_bounding, &clip_shape, &x_clip, &y_clip, &w_clip, &h_clip);
+    return bounding_shape == 1;
+}
+
+Client* WindowManager::createClient(Window w, Boolean shaped, XWindowAttributes *attr) {
+    Client *newC = new Client(this, w, shaped, attr);
+    m_clients.append(newC);
+    m_focusOrder.append(newC);
+    return newC;
+}
+
 void WindowManager::installColormap(Colormap cmap) {
     if (cmap == None) {
         XInstallColormap(m_display, m_defaultColormap[screen()]);
@@ -591,6 +1027,15 @@ void WindowManager::setActiveClient(Client *const c) {
         m_activeClient->deactivate();
     }
     m_activeClient = c;
+    if (c && (m_focusOrder.count() == 0 || m_focusOrder.item(0) != c)) {
+        for (long i = 1; i < m_focusOrder.count(); ++i) {
+            if (m_focusOrder.item(i) == c) {
+                m_focusOrder.remove(i);
+                break;
+            }
+        }
+        m_focusOrder.insert(0, c);
+    }
     netwmUpdateStackingOrder();
     netwmUpdateActiveClient();
 }
@@ -625,13 +1070,182 @@ void WindowManager::clearFocus() {
 }
 
 void WindowManager::skipInRevert(Client *c, Client *myRevert) {
-    for (int i = 0; i < m_clients.count(); ++i) {
-        if (m_clients.item(i) != c && m_clients.item(i)->revertTo() == c) {
-            m_clients.item(i)->setRevertTo(myRevert);
+    if (myRevert == c) {
+        return;
+    }
+    // each one leaves the list as its revert changes
+    ClientList &revertedBy = c->relations().revertedBy;
+    for (long i = revertedBy.count() - 1; i >= 0; --i) {
+        if (revertedBy.item(i) != c) {
+            setRevertTo(revertedBy.item(i), myRevert);
+        }
+    }
+}
+
+void WindowManager::retitleLater(Client *c, long long due) {
+    PendingTitle p;
+    p.client = c;
+    p.due = due;
+    m_pendingTitles.append(p);
+    if (!m_timerDeadline[TitleTimer] || due < m_timerDeadline[TitleTimer]) {
+        setTimer(TitleTimer, (int) ((due - monotonicTime() + 999) / 1000));
+    }
+}
+
+void WindowManager::cancelRetitle(Client *c) {
+    for (long i = 0; i < m_pendingTitles.count(); ++i) {
+        if (m_pendingTitles.item(i).client == c) {
+            m_pendingTitles.swap_remove(i);
+            return;
+        }
+    }
+}
+
+void WindowManager::checkTitles() {
+    long long now = monotonicTime(), next = 0;
+    for (long i = 0; i < m_pendingTitles.count();) {
+        PendingTitle &p = m_pendingTitles.item(i);
+        if (p.due <= now) {
+            Client *c = p.client;
+            m_pendingTitles.swap_remove(i);
+            c->rename();
+        } else {
+            if (!next || p.due < next) {
+                next = p.due;
+            }
+            ++i;
+        }
+    }
+    if (next) {
+        setTimer(TitleTimer, (int) ((next - now + 999) / 1000));
+    }
+}
+
+static void removeClient(ClientList &list, Client *c) {
+    for (long i = 0; i < list.count(); ++i) {
+        if (list.item(i) == c) {
+            list.remove(i);
+            return;
         }
     }
 }
 
+// A transient may be mapped before the window it's transient for, so
+// it waits among the orphans until that window's client turns up
+
+void WindowManager::linkClient(Client *c) {
+    for (long i = 0; i < m_orphanTransients.count();) {
+        Client *t = m_orphanTransients.item(i);
+        if (t != c && t->transientFor() == c->window()) {
+            m_orphanTransients.remove(i);
+            t->relations().parent = c;
+            c->relations().transients.append(t);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void WindowManager::unlinkClient(Client *c) {
+    RelationEntry &r = c->relations();
+
+    setTransientFor(c, None);
+    while (r.transients.count() > 0) {
+        Client *t = r.transients.item(0);
+        r.transients.remove(0);
+        t->relations().parent = 0;
+        m_orphanTransients.append(t);
+    }
+
+    if (r.groupStale) {
+        removeClient(m_staleGroups, c);
+        r.groupStale = False;
+    }
+    setWindowGroup(c, None);
+
+    setRevertTo(c, 0);
+    while (r.revertedBy.count() > 0) {
+        setRevertTo(r.revertedBy.item(0), 0);
+    }
+}
+
+void WindowManager::setTransientFor(Client *c, Window w) {
+    RelationEntry &r = c->relations();
+    if (r.parent) {
+        removeClient(r.parent->relations().transients, c);
+        r.parent = 0;
+    } else {
+        removeClient(m_orphanTransients, c);
+    }
+
+    if (w == None) {
+        return;
+    }
+    for (int i = 0; i < m_screensTotal; ++i) {
+        if (w == m_root[i]) {
+            return; // transient for its whole group
+        }
+    }
+
+    Client *parent = windowToClient(w);
+    if (parent && parent != c) {
+        r.parent = parent;
+        parent->relations().transients.append(c);
+    } else if (!parent) {
+        m_orphanTransients.append(c);
+    }
+}
+
+void WindowManager::setWindowGroup(Client *c, Window group) {
+    RelationEntry &r = c->relations();
+    if (r.group == group) {
+        return;
+    }
+
+    if (r.group != None) {
+        if (m_groupMap.find(r.group) == c) {
+            m_groupMap.remove(r.group, c);
+            if (r.groupNext != c) {
+                m_groupMap.insert(r.group, r.groupNext);
+            }
+        }
+        r.groupPrev->relations().groupNext = r.groupNext;
+        r.groupNext->relations().groupPrev = r.groupPrev;
+        r.groupNext = r.groupPrev = 0;
+    }
+
+    r.group = group;
+    if (group == None) {
+        return;
+    }
+
+    Client *first = m_groupMap.find(group);
+    if (first) {
+        RelationEntry &f = first->relations();
+        r.groupNext = first;
+        r.groupPrev = f.groupPrev;
+        f.groupPrev->relations().groupNext = c;
+        f.groupPrev = c;
+    } else {
+        m_groupMap.insert(group, c);
+        r.groupNext = r.groupPrev = c;
+    }
+}
+
+void WindowManager::setRevertTo(Client *c, Client *revert) {
+    RelationEntry &r = c->relations();
+    if (r.revert == revert) {
+        return;
+    }
+    if (r.revert) {
+        removeClient(r.revert->relations().revertedBy, c);
+    }
+    r.revert = revert;
+    if (revert) {
+        revert->relations().revertedBy.append(c);
+    }
+}
+
 void WindowManager::addToHiddenList(Client *c) {
     for (int i = 0; i < m_hiddenClients.count(); ++i) {
         if (m_hiddenClients.item(i) == c) {
@@ -653,54 +1267,152 @@ void WindowManager::removeFromHiddenList(Client *c) {
     }
 }
 
+void WindowManager::unlinkFromStack(Client *c) {
+    StackEntry &e = c->stackEntry();
+    if (!e.linked) {
+        return;
+    }
+    if (e.above) {
+        e.above->stackEntry().below = e.below;
+    } else {
+        m_stackTop[e.layer] = e.below;
+    }
+    if (e.below) {
+        e.below->stackEntry().above = e.above;
+    } else {
+        m_stackBottom[e.layer] = e.above;
+    }
+    e.above = e.below = 0;
+    e.linked = False;
+}
+
+Client* WindowManager::stackNext(Client *c) {
+    StackEntry &e = c->stackEntry();
+    if (e.below) {
+        return e.below;
+    }
+    for (int layer = e.layer - 1; layer >= 0; --layer) {
+        if (m_stackTop[layer]) {
+            return m_stackTop[layer];
+        }
+    }
+    return 0;
+}
+
 void WindowManager::hoistToTop(Client *c) {
     // fprintf(stderr, "WindowManager::hoistToTop(%p)\n", c);
-    int i;
+    StackEntry &e = c->stackEntry();
     int layer = c->layer();
-    for (i = 0; i < m_orderedClients[layer].count(); ++i) {
-        if (m_orderedClients[layer].item(i) == c) {
-            m_orderedClients[layer].move_to_start(i);
-            netwmUpdateWindowList();
-            return;
-        }
+    if (e.linked && e.layer == layer && m_stackTop[layer] == c) {
+        return;
+    }
+    unlinkFromStack(c);
+    e.layer = layer;
+    e.above = 0;
+    e.below = m_stackTop[layer];
+    if (e.below) {
+        e.below->stackEntry().above = c;
+    } else {
+        m_stackBottom[layer] = c;
     }
-    m_orderedClients[layer].append(c);
-    m_orderedClients[layer].move_to_start(m_orderedClients[layer].count() - 1);
+    m_stackTop[layer] = c;
+    e.linked = True;
+    e.moved = True;
     netwmUpdateWindowList();
 }
 
 void WindowManager::hoistToBottom(Client *c) {
-    int i;
+    StackEntry &e = c->stackEntry();
     int layer = c->layer();
-    for (i = 0; i < m_orderedClients[layer].count(); ++i) {
-        if (m_orderedClients[layer].item(i) == c) {
-            m_orderedClients[layer].move_to_end(i);
-            netwmUpdateWindowList();
-            return;
-        }
+    if (e.linked && e.layer == layer && m_stackBottom[layer] == c) {
+        return;
     }
-    m_orderedClients[layer].append(c);
+    unlinkFromStack(c);
+    e.layer = layer;
+    e.below = 0;
+    e.above = m_stackBottom[layer];
+    if (e.above) {
+        e.above->stackEntry().below = c;
+    } else {
+        m_stackTop[layer] = c;
+    }
+    m_stackBottom[layer] = c;
+    e.linked = True;
+    e.moved = True;
     netwmUpdateWindowList();
 }
 
 void WindowManager::removeFromOrderedList(Client *c) {
-    int layer = c->layer();
-    // fprintf(stderr, "WindowManager::removeFromOrderedList(%p) [layer %d]\n", c, layer);
-    for (int i = 0; i < m_orderedClients[layer].count(); ++i) {
-        if (m_orderedClients[layer].item(i) == c) {
-            m_orderedClients[layer].remove(i);
-            netwmUpdateWindowList();
-            return;
-        }
+    // fprintf(stderr, "WindowManager::removeFromOrderedList(%p) [layer %d]\n", c, c->layer());
+    // the others keep their order, so nothing need be restacked
+    if (c->stackEntry().linked) {
+        unlinkFromStack(c);
+        c->stackEntry().moved = False;
+        netwmUpdateWindowList();
     }
 }
+
 Boolean WindowManager::isTop(Client *c) {
     int layer = c->layer();
-    if (m_orderedClients[layer].count() == 0) {
+    if (!m_stackTop[layer]) {
         fprintf(stderr, "Warning: ordered clients list for layer %d is empty even though client %p thinks it's in this layer\n", layer, c);
         return False;
     }
-    return (m_orderedClients[layer].item(0) == c) ? True : False;
+    return (m_stackTop[layer] == c) ? True : False;
+}
+
+// Clients rewrite WM_HINTS far more often than they change group
+// (every urgency flash does it), and the group can only be learnt by
+// reading the property back.  So a change just marks the client, and
+// the marked ones are read again together, in one round trip, when
+// a group is next walked.
+
+void WindowManager::groupChanged(Client *c) {
+    RelationEntry &r = c->relations();
+    if (!r.groupStale) {
+        r.groupStale = True;
+        m_staleGroups.append(c);
+    }
+}
+
+void WindowManager::refreshGroups() {
+    long n = m_staleGroups.count();
+    long i;
+
+    if (n == 0) {
+        return;
+    }
+
+    xcb_get_property_cookie_t *cookies = (xcb_get_property_cookie_t*)
+    malloc(n * sizeof(xcb_get_property_cookie_t));
+
+    for (i = 0; i < n; ++i) {
+        cookies[i] = xcb_get_property(m_xcb, False, m_staleGroups.item(i)->window(),
+            XA_WM_HINTS, XA_WM_HINTS, 0, WM_HINTS_ELEMENTS);
+    }
+    noteRoundTrip();
+
+    for (i = 0; i < n; ++i) {
+        xcb_generic_error_t *error = 0;
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(m_xcb, cookies[i], &error);
+        free(error);
+
+        Window group = None;
+        if (reply && reply->format == 32 && reply->value_len >= WM_HINTS_ELEMENTS) {
+            uint32_t *hints = (uint32_t*) xcb_get_property_value(reply);
+            if (hints[0] & WindowGroupHint) {
+                group = hints[8];
+            }
+        }
+        free(reply);
+
+        Client *c = m_staleGroups.item(i);
+        c->relations().groupStale = False;
+        setWindowGroup(c, group);
+    }
+
+    m_staleGroups.remove_all();
+    free(cookies);
 }
 
 Boolean WindowManager::raiseTransients(Client *c) {
@@ -708,17 +1420,34 @@ Boolean WindowManager::raiseTransients(Client *c) {
     if (!c->isNormal()) {
         return False;
     }
-    for (int i = 0; i < m_clients.count(); ++i) {
-        if (m_clients.item(i)->isNormal() && m_clients.item(i)->isTransient()) {
-            if (c->hasWindow(m_clients.item(i)->transientFor())) {
+    RelationEntry &r = c->relations();
+    for (long i = 0; i < r.transients.count(); ++i) {
+        Client *t = r.transients.item(i);
+        if (t->isNormal()) {
+            if (!first) {
+                first = t;
+            } else {
+                t->mapRaised();
+            }
+        }
+    }
+
+    // and the dialogs that are transient for the group as a whole,
+    // unless this is one of them itself.  Bringing the groups up to
+    // date may take this one out of its own.
+    if (r.group != None && c->transientFor() == None) {
+        refreshGroups();
+        for (Client *t = r.groupNext; t && t != c; t = t->relations().groupNext) {
+            if (t->isNormal() && t->transientFor() == t->root()) {
                 if (!first) {
-                    first = m_clients.item(i);
+                    first = t;
                 } else {
-                    m_clients.item(i)->mapRaised();
+                    t->mapRaised();
                 }
             }
         }
     }
+
     if (first) {
         first->mapRaised();
         return True;
@@ -727,48 +1456,85 @@ Boolean WindowManager::raiseTransients(Client *c) {
     }
 }
 
+// Commands are started with posix_spawn, which doesn't copy our
+// address space as fork would, and they're reaped by the kernel
+// (SA_NOCLDWAIT), so neither starting nor losing one ever holds up
+// the event loop.
+
+void WindowManager::initialiseLauncher() {
+    struct sigaction sa;
+    memset((void*) &sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &sa, 0);
+
+    // any that exited while we were restarting
+    while (waitpid(-1, 0, WNOHANG) > 0);
+
+    // the children mustn't inherit our connection
+    fcntl(ConnectionNumber(m_display), F_SETFD, FD_CLOEXEC);
+
+    // "DISPLAY=host:0.<screen>", one per screen
+    const char *displayName = DisplayString(m_display);
+    m_displayEnv = (char**) malloc(m_screensTotal * sizeof(char*));
+
+    for (int i = 0; i < m_screensTotal; ++i) {
+        m_displayEnv[i] = 0;
+        if (!displayName || displayName[0] == '\0') {
+            continue;
+        }
+        const char *colon = strrchr(displayName, ':');
+        const char *dot = colon ? strchr(colon, '.') : 0;
+        int length = dot ? dot - displayName : strlen(displayName);
+        m_displayEnv[i] = (char*) malloc(length + 11 + numdigits(i));
+        sprintf(m_displayEnv[i], "DISPLAY=%.*s.%d", length, displayName, i);
+    }
+}
+
 void WindowManager::spawn(char *name, char *file) {
-    // strange code thieved from 9wm to avoid leaving zombies
-    char *displayName = DisplayString(m_display);
-    if (fork() == 0) {
-        if (fork() == 0) {
-            close(ConnectionNumber(m_display));
-            // if you don't have putenv, miss out this next conditional and its contents
-            if (displayName && (displayName[0] != '\0')) {
-                char *c;
-                char *pstring = (char*) malloc(strlen(displayName) + 11 + numdigits(screen()));
-                sprintf(pstring, "DISPLAY=%s", displayName);
-                c = strrchr(pstring, '.');
-                if (c) {
-                    sprintf(c + 1, "%d", screen());
-                    putenv(pstring);
-                }
-            }
-            if (CONFIG_EXEC_USING_SHELL) {
-                if (file) {
-                    execl(m_shell, m_shell, "-c", file, NULL);
-                } else {
-                    execl(m_shell, m_shell, "-c", name, NULL);
-                }
-                fprintf(stderr, "wmx: exec %s", m_shell);
-                perror(" failed");
-            }
-            if (file) {
-                execl(file, name, NULL);
-            } else {
-                if (strcmp(CONFIG_NEW_WINDOW_COMMAND, name)) {
-                    execlp(name, name, NULL);
-                } else {
-                    execlp(name, name, CONFIG_NEW_WINDOW_COMMAND_OPTIONS, NULL);
-                }
-            }
+    // our environment, but with DISPLAY pointing at this screen
+    int i, n;
+    for (n = 0; environ[n]; ++n);
+    char **env = (char**) malloc((n + 2) * sizeof(char*));
+    char *displayEnv = m_displayEnv[screen()];
+    for (i = n = 0; environ[i]; ++i) {
+        if (!displayEnv || strncmp(environ[i], "DISPLAY=", 8)) {
+            env[n++] = environ[i];
+        }
+    }
+    if (displayEnv) {
+        env[n++] = displayEnv;
+    }
+    env[n] = 0;
+
+    pid_t pid;
+    int error = 0;
+
+    if (CONFIG_EXEC_USING_SHELL) {
+        const char *argv[] = { m_shell, "-c", file ? file : name, 0 };
+        error = posix_spawn(&pid, m_shell, 0, 0, (char* const*) argv, env);
+        if (error) {
+            fprintf(stderr, "wmx: exec %s failed: %s\n", m_shell, strerror(error));
+        }
+    }
+    if (!CONFIG_EXEC_USING_SHELL || error) {
+        if (file) {
+            const char *argv[] = { name, 0 };
+            error = posix_spawn(&pid, file, 0, 0, (char* const*) argv, env);
+        } else if (strcmp(CONFIG_NEW_WINDOW_COMMAND, name)) {
+            const char *argv[] = { name, 0 };
+            error = posix_spawnp(&pid, name, 0, 0, (char* const*) argv, env);
+        } else {
+            const char *argv[] = { name, CONFIG_NEW_WINDOW_COMMAND_OPTIONS, 0 };
+            error = posix_spawnp(&pid, name, 0, 0, (char* const*) argv, env);
+        }
+        if (error) {
             XBell(display(), 70);
-            fprintf(stderr, "wmx: exec %s:%s failed (errno %d)\n", name, file, errno);
-            exit(1);
+            fprintf(stderr, "wmx: exec %s:%s failed: %s\n", name, file, strerror(error));
         }
-        exit(0);
     }
-    wait((int*) 0);
+
+    free(env);
 }
 
 void WindowManager::netwmInitialiseCompliance() {
@@ -811,109 +1577,174 @@ void WindowManager::netwmInitialiseCompliance() {
     supported.append(Atoms::netwm_winType);
     supported.append(Atoms::netwm_winDesktopButtonProxy);
     supported.append(Atoms::netwm_supportingWmCheck);
+    supported.append(Atoms::netwm_wmName);
+    if (m_syncEvent) {
+        supported.append(Atoms::netwm_syncRequest);
+    }
 
     XChangeProperty(m_display, m_root[0], Atoms::netwm_supported, XA_ATOM, 32,
     PropModeReplace, (unsigned char*) supported.array(0, supported.count()), supported.count());
+
+    // whatever a previous manager left there goes, even with no clients
+    netwmUpdateWindowList();
 }
 
 void WindowManager::updateStackingOrder() {
-    int orderedCount = 0;
-    for (int i = MAX_LAYER; i >= 0; --i) {
-        orderedCount += m_orderedClients[i].count();
+    // Walking down from the top, each moved client goes directly
+    // below the nearest client above it on the same screen, which by
+    // then is known to be in the right place.  A moved client with
+    // nothing above it goes directly above the first unmoved one
+    // below it; if there isn't one, it can stay where it is, as
+    // everything else on that screen is about to be put under it.
+
+    Client **above = new Client*[m_screensTotal];
+    for (int i = 0; i < m_screensTotal; ++i) {
+        above[i] = 0;
     }
-    Window *windows = new Window[orderedCount];
-    Window *windowIter = windows;
+
     for (int layer = MAX_LAYER; layer >= 0; --layer) {
-        int top = m_orderedClients[layer].count();
-        for (int i = 0; i < top; ++i) {
-            Client *c = m_orderedClients[layer].item(i);
-            if (!c->isKilled() || (c->isSticky() && !c->isHidden())) {
-                *(windowIter++) = c->parent();
+        for (Client *c = m_stackTop[layer]; c; c = c->stackEntry().below) {
+            StackEntry &e = c->stackEntry();
+            if (c->isKilled() && !(c->isSticky() && !c->isHidden())) {
+                e.moved = False;
+                continue;
+            }
+            int s = c->screen();
+
+            if (e.moved) {
+                XWindowChanges wc;
+                if (above[s]) {
+                    wc.sibling = above[s]->parent();
+                    wc.stack_mode = Below;
+                    XConfigureWindow(display(), c->parent(), CWSibling | CWStackMode, &wc);
+                } else {
+                    for (Client *d = stackNext(c); d; d = stackNext(d)) {
+                        if (!d->stackEntry().moved && !d->isKilled() && d->screen() == s) {
+                            wc.sibling = d->parent();
+                            wc.stack_mode = Above;
+                            XConfigureWindow(display(), c->parent(), CWSibling | CWStackMode, &wc);
+                            break;
+                        }
+                    }
+                }
+                e.moved = False;
             }
+            above[s] = c;
         }
     }
-    XRestackWindows(display(), windows, windowIter - windows);
-    delete[] windows;
+
+    delete[] above;
     netwmUpdateStackingOrder();
 }
 
 void WindowManager::netwmUpdateWindowList() {
-    int count = m_clients.count() + m_hiddenClients.count();
-    Window *byAge = new Window[count];
-    count = 0;
-    for (int i = 0; i < m_hiddenClients.count(); ++i) {
-        Client *c = m_hiddenClients.item(i);
-        if (c->isKilled()) {
-            continue;
-        }
-        byAge[count++] = c->window();
-        // fprintf(stderr, "[netwm] client %d [%p] [H] window %lx, \"%s\"\n", count, c, c->window(), c->name());
-    }
-    for (int i = 0; i < m_clients.count(); ++i) {
-        Client *c = m_clients.item(i);
-        if (!c->isNormal() || c->isKilled()) {
-            continue;
-        }
-        byAge[count++] = c->window();
-        // fprintf(stderr, "[netwm] client %d [%p] window %lx, \"%s\"\n", count, c, c->window(), c->name());
-    }
-    // fprintf(stderr, "[netwm] %d client(s) total, setting to root window %lx\n", count, m_root[0]);
-    XChangeProperty(m_display, m_root[0], Atoms::netwm_clientList, XA_WINDOW, 32, PropModeReplace, (unsigned char*) byAge, count);
-    delete[] byAge;
-    netwmUpdateStackingOrder();
-    netwmUpdateActiveClient();
+    m_netwmDirty |= NetwmClientList | NetwmStacking | NetwmActive;
 }
 
 void WindowManager::netwmUpdateStackingOrder() {
-    int count = m_hiddenClients.count();
-    for (int i = MAX_LAYER; i >= 0; --i) {
-        count += m_orderedClients[i].count();
+    m_netwmDirty |= NetwmStacking;
+}
+
+void WindowManager::netwmUpdateActiveClient() {
+    m_netwmDirty |= NetwmActive;
+}
+
+void WindowManager::netwmPublish(Atom property, Window *&published, int &publishedCount, Window *w, int count) {
+    if (count == publishedCount && (count == 0 || !memcmp(published, w, count * sizeof(Window)))) {
+        ++m_netwmSkips;
+        return;
     }
-    Window *byStacking = new Window[count];
-    count = 0;
+    XChangeProperty(m_display, m_root[0], property, XA_WINDOW, 32, PropModeReplace, (unsigned char*) w, count);
+    ++m_netwmWrites;
 
-    // Looks like panels and things will test to make sure the client
-    // list and stacking list have the same windows in them, before
-    // they trust either.  So we'd better include the hidden windows
-    // in the stacking list as well as in the client list, otherwise
-    // nobody will ever believe anything we say.
+    published = (Window*) realloc(published, (count ? count : 1) * sizeof(Window));
+    memcpy(published, w, count * sizeof(Window));
+    publishedCount = count;
+}
 
-    for (int i = 0; i < m_hiddenClients.count(); ++i) {
-        Client *c = m_hiddenClients.item(i);
-        if (c->isKilled()) {
-            continue;
-        }
-        byStacking[count++] = c->window();
-        // fprintf(stderr, "[netwm] stacking order: hidden client %d\n", c);
+void WindowManager::netwmFlush() {
+    if (!m_netwmDirty) {
+        return;
     }
 
-    for (int layer = 0; layer < MAX_LAYER; ++layer) {
-        int top = m_orderedClients[layer].count();
-        for (int i = top - 1; i >= 0; --i) {
-            Client *c = m_orderedClients[layer].item(i);
-            if (c->isWithdrawn() || c->isKilled() || c->isHidden()) {
+    if (m_netwmDirty & NetwmClientList) {
+        int count = m_clients.count() + m_hiddenClients.count();
+        Window *byAge = new Window[count];
+        count = 0;
+        for (int i = 0; i < m_hiddenClients.count(); ++i) {
+            Client *c = m_hiddenClients.item(i);
+            if (c->isKilled()) {
+                continue;
+            }
+            byAge[count++] = c->window();
+            // fprintf(stderr, "[netwm] client %d [%p] [H] window %lx, \"%s\"\n", count, c, c->window(), c->name());
+        }
+        for (int i = 0; i < m_clients.count(); ++i) {
+            Client *c = m_clients.item(i);
+            if (!c->isNormal() || c->isKilled()) {
+                continue;
+            }
+            byAge[count++] = c->window();
+            // fprintf(stderr, "[netwm] client %d [%p] window %lx, \"%s\"\n", count, c, c->window(), c->name());
+        }
+        // fprintf(stderr, "[netwm] %d client(s) total, setting to root window %lx\n", count, m_root[0]);
+        netwmPublish(Atoms::netwm_clientList, m_netwmClientList, m_netwmClientListCount, byAge, count);
+        delete[] byAge;
+    }
+
+    if (m_netwmDirty & NetwmStacking) {
+        // every client in the stacking lists is also in m_clients
+        int count = m_hiddenClients.count() + m_clients.count();
+        Window *byStacking = new Window[count];
+        count = 0;
+
+        // Looks like panels and things will test to make sure the client
+        // list and stacking list have the same windows in them, before
+        // they trust either.  So we'd better include the hidden windows
+        // in the stacking list as well as in the client list, otherwise
+        // nobody will ever believe anything we say.
+
+        for (int i = 0; i < m_hiddenClients.count(); ++i) {
+            Client *c = m_hiddenClients.item(i);
+            if (c->isKilled()) {
                 continue;
             }
             byStacking[count++] = c->window();
-            // fprintf(stderr, "[netwm] stacking order: item %d is window %lx, client \"%s\"\n", count, c->window(), c->name());
+            // fprintf(stderr, "[netwm] stacking order: hidden client %d\n", c);
         }
-    }
-    // fprintf(stderr, "[netwm] stacking order: %d client(s) total\n", count);
 
-    XChangeProperty(m_display, m_root[0], Atoms::netwm_clientListStacking, XA_WINDOW, 32, PropModeReplace, (unsigned char*) byStacking, count);
-    delete[] byStacking;
-}
+        for (int layer = 0; layer < MAX_LAYER; ++layer) {
+            for (Client *c = m_stackBottom[layer]; c; c = c->stackEntry().above) {
+                if (c->isWithdrawn() || c->isKilled() || c->isHidden()) {
+                    continue;
+                }
+                byStacking[count++] = c->window();
+                // fprintf(stderr, "[netwm] stacking order: item %d is window %lx, client \"%s\"\n", count, c->window(), c->name());
+            }
+        }
+        // fprintf(stderr, "[netwm] stacking order: %d client(s) total\n", count);
 
-void WindowManager::netwmUpdateActiveClient() {
-    if (!m_activeClient) {
-        return;
+        netwmPublish(Atoms::netwm_clientListStacking, m_netwmStacking, m_netwmStackingCount, byStacking, count);
+        delete[] byStacking;
+    }
+
+    if ((m_netwmDirty & NetwmActive) && m_activeClient) {
+        Window active = m_activeClient->window();
+        netwmPublish(Atoms::netwm_activeWindow, m_netwmActive, m_netwmActiveCount, &active, 1);
     }
-    CARD32 val;
-    val = m_activeClient->window();
-    XChangeProperty(m_display, m_root[0], Atoms::netwm_activeWindow, XA_WINDOW, 32, PropModeReplace, (unsigned char*) &val, 1);
+
+    m_netwmDirty = 0;
 }
 
 void WindowManager::printClientList() {
+    printf("wmx: %ld NETWM property write(s), %ld skipped as unchanged, over %ld event(s) (%.3f per event)\n",
+        m_netwmWrites, m_netwmSkips, m_eventCount, m_eventCount ? (double) m_netwmWrites / m_eventCount : 0.0);
+    printf("wmx: %ld list allocation(s)\n", ListStats::allocations);
+    printf("wmx: text extents: %ld cache hit(s), %ld miss(es)\n",
+        m_textCache.hits(), m_textCache.misses());
+    if (CONFIG_EVENT_STATS) {
+        m_eventStats.print();
+    }
     printf("wmx: %ld client(s)\n", m_clients.count());
     for (int i = 0; i < m_clients.count(); ++i) {
         bool inHidden = false;
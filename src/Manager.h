@@ -2,10 +2,67 @@
 #define _MANAGER_H_
 
 #include "General.h"
-#include "listmacro.h"
+#include "List.h"
+#include "WindowMap.h"
+#include "EdgeIndex.h"
+#include "EventStats.h"
+#include "TextCache.h"
 
 class Client;
-declarePList(ClientList, Client);
+class Compositor;
+class Theme;
+class CommandTree;
+typedef List<Client*> ClientList;
+
+struct xcb_connection_t;
+
+// A client's place in the manager's stacking lists, one list per
+// layer, top first.  Kept inside the Client so that hoisting and
+// removal don't have to search for it.  A client is "moved" from the
+// time its position in the list changes until updateStackingOrder
+// has told the server.
+
+class StackEntry {
+public:
+    StackEntry() : above(0), below(0), layer(0), linked(False), moved(False) { }
+    Client *above;
+    Client *below;
+    int layer;
+    Boolean linked;
+    Boolean moved;
+};
+
+// A client's links to the clients related to it: the one it's a
+// transient for and those that are transients for it, the others in
+// its WM_HINTS window group (a ring, with one member of each group
+// kept in the manager's group map), and whichever clients revert
+// focus to it.  The manager keeps them up to date as the properties
+// change and clients go, so that raising or releasing a client only
+// visits its relations.
+
+class RelationEntry {
+public:
+    RelationEntry() : parent(0), revert(0), group(None), groupNext(0), groupPrev(0),
+                      groupStale(False) { }
+    Client *parent;
+    ClientList transients;
+    Client *revert;
+    ClientList revertedBy;
+    Window group;
+    Client *groupNext;
+    Client *groupPrev;
+    Boolean groupStale; // WM_HINTS changed since the group was read
+};
+
+// Anything other than the X connection that the event loop should
+// wait on (inotify watches, IPC sockets) registers one of these
+// together with its file descriptor
+
+class EventSource {
+public:
+    virtual ~EventSource() { }
+    virtual void readable() = 0;
+};
 
 class WindowManager {
 
@@ -15,16 +72,74 @@ public:
 
     void fatal(const char*);
 
+    // Requests sent between these two calls may fail with any of the
+    // given errors (a mask of core error codes) without complaint,
+    // usually because the client has already destroyed its window.
+    // Nothing waits for the server: errorHandler matches what comes
+    // back against the ranges of request serial numbers.  Nests.
+    void ignoreErrors(unsigned long codes = 1L << BadWindow);
+    void endIgnoringErrors();
+
     // for call from Client and within:
 
     Client* windowToClient(Window, Boolean create = False);
 
+    // every window we own or manage on behalf of a client is
+    // registered here, so that windowToClient needn't scan
+    void registerWindow(Window w, Client *c) {
+        m_windowMap.insert(w, c);
+    }
+    void unregisterWindow(Window w, Client *c) {
+        m_windowMap.remove(w, c);
+    }
+    Boolean isRegisteredWindow(Window w) {
+        return m_windowMap.find(w) != 0;
+    }
+
     Client* activeClient() {
         return m_activeClient;
     }
 
+    // Xlib's own connection, for queries we want to pipeline
+    xcb_connection_t* xcbConnection() {
+        return m_xcb;
+    }
+    // to be called on waiting for an xcb reply, which the round trip
+    // count wouldn't otherwise see
+    static void noteRoundTrip() {
+        ++m_roundTrips;
+    }
+
+    // type of an XSync alarm event, or 0 if there's no XSync extension
+    int syncAlarmEvent() {
+        return m_syncEvent ? m_syncEvent + XSyncAlarmNotify : 0;
+    }
+
+    EdgeIndex& edgeIndex() {
+        return m_edgeIndex;
+    }
+
+    TextCache& textCache() {
+        return m_textCache;
+    }
+
+    Theme& theme() {
+        return *m_theme;
+    }
+
+    CommandTree& commandTree() {
+        return *m_commandTree;
+    }
+
     Boolean raiseTransients(Client*); // true if raised any
+
+    // The time of the event being handled if it has one, else (or if
+    // reset) an estimate of the server's time now
     Time timestamp(Boolean reset);
+
+    // Learn the server's time from any event carrying it; returns
+    // the event's time, or CurrentTime if it has none
+    Time noteServerTime(XEvent*);
     void clearFocus();
 
     void setActiveClient(Client *const c);
@@ -33,6 +148,19 @@ public:
     void removeFromHiddenList(Client*);
     void skipInRevert(Client*, Client*);
 
+    // a client whose title can't be redrawn before the given time
+    void retitleLater(Client*, long long due);
+    void cancelRetitle(Client*);
+
+    // maintain the clients' RelationEntries
+    void linkClient(Client*);   // once its window is registered
+    void unlinkClient(Client*); // as it's released
+    void setTransientFor(Client*, Window);
+    void setWindowGroup(Client*, Window);
+    void groupChanged(Client*); // re-read when a group is next walked
+    void refreshGroups();
+    void setRevertTo(Client*, Client*);
+
     Display* display() {
         return m_display;
     }
@@ -66,10 +194,33 @@ public:
     void installCursorOnWindow(RootCursor, Window);
     void installColormap(Colormap);
     unsigned long allocateColour(int, const char*, const char*);
+    void allocateXftColour(int, const char*, XftColor*);
 
-    void considerFocusChange(Client*, Window, Time timestamp);
+    void considerFocusChange(Client*, Window);
     void stopConsideringFocus();
 
+    // All deadlines share one timerfd.  An expired timer stays
+    // flagged until somebody asks about it, so that a modal loop can
+    // wait for its own timer without the others being acted on
+    // underneath it.
+    enum Timer {
+        FocusTimer, FeedbackTimer, DestroyTimer, FrameTimer,
+        SyncTimer, CompositeTimer, WakeupReportTimer, TitleTimer, TimerCount
+    };
+
+    void setTimer(Timer, int ms);
+    void cancelTimer(Timer);
+    Boolean timerExpired(Timer); // clears the flag
+    static long long monotonicTime(); // microseconds
+
+    void addEventSource(int fd, EventSource*);
+    void removeEventSource(int fd);
+
+    // Flush, then block until the X connection, a timer or an event
+    // source needs attention.  For modal loops that poll with
+    // XCheckMaskEvent; the main loop goes through nextEvent.
+    void waitForActivity();
+
     // shouldn't really be public
     int attemptGrab(Window, Window, int, int);
     int attemptGrabKey(Window, int);
@@ -88,6 +239,9 @@ public:
     ClientList& hiddenClients() {
         return m_hiddenClients;
     }
+    ClientList& focusOrder() { // most recently active first
+        return m_focusOrder;
+    }
 
     void hoistToTop(Client*);
     void hoistToBottom(Client*);
@@ -95,7 +249,9 @@ public:
     Boolean isTop(Client*);
 
     // Instruct the X-Server to reorder the windows to match our ordering.
-    // Takes account of layering.
+    // Takes account of layering.  Only clients that have moved since
+    // the last call are restacked, each with one request relative to
+    // a neighbour whose position is already right.
     void updateStackingOrder();
 
     // for exposures during client grab, and window map/unmap/destroy during menu display:
@@ -104,9 +260,13 @@ public:
     // debug output:
     void printClientList();
 
+    // these only mark the root properties as out of date; they're
+    // written (if they've actually changed) by netwmFlush, once the
+    // current batch of events has been dealt with
     void netwmUpdateWindowList();
     void netwmUpdateStackingOrder();
     void netwmUpdateActiveClient();
+    void netwmFlush();
 
     // Stupid little helper function
     static int numdigits(int);
@@ -134,38 +294,119 @@ private:
 
     ClientList m_clients;
     ClientList m_hiddenClients;
-
-    ClientList m_orderedClients[MAX_LAYER + 1];
-    // One list for each netwm/MWM layer
-    // Layer 4 (NORMAL_LAYER) is the default.
+    ClientList m_focusOrder;
+    WindowMap m_windowMap;
+    WindowMap m_groupMap;            // group leader to one member
+    ClientList m_orphanTransients;   // transient for a window we don't have (yet)
+    ClientList m_staleGroups;        // whose WM_HINTS are yet to be re-read
+    EdgeIndex m_edgeIndex;
+    TextCache m_textCache;
+    Theme *m_theme;
+
+    Client *m_stackTop[MAX_LAYER + 1];
+    Client *m_stackBottom[MAX_LAYER + 1];
+    // One list for each netwm/MWM layer, linked through the clients'
+    // StackEntries.  Layer 4 (NORMAL_LAYER) is the default.
+    void unlinkFromStack(Client*);
+    Client* stackNext(Client*); // next one down, across layers
     Client *m_activeClient;
 
     int m_shapeEvent;
-    int m_currentTime;
+    int m_syncEvent; // event base, 0 if there's no XSync extension
+    Time m_currentTime;
+
+    // the newest server time we know of, and our clock when we saw it
+    Time m_serverTime;
+    long long m_serverTimeAt; // 0 if we've never seen one
+    Window m_timeWindow;      // for asking, when we must
 
     Boolean m_looping;
     int m_returnCode;
 
     static Boolean m_initialising;
     static int errorHandler(Display*, XErrorEvent*);
+
+    class IgnoredErrors {
+    public:
+        unsigned long first;
+        unsigned long last;  // ~0 while still open
+        unsigned long codes;
+    };
+    static List<IgnoredErrors> m_ignoredErrors;
+    static int m_ignoringErrors; // depth
     static void sigHandler(int);
     static int m_signalled;
     static int m_restart;
 
+    // for CONFIG_EVENT_STATS: SIGUSR1 prints, SIGUSR2 starts afresh
+    EventStats m_eventStats;
+    static void statsSigHandler(int);
+    static volatile sig_atomic_t m_printStats;
+    static volatile sig_atomic_t m_resetStats;
+    void handleEvent(XEvent*);
+
+    void initialiseAtoms();
     void initialiseScreen();
     void scanInitialWindows();
+    void adoptWindows(Window*, unsigned int);
+    Client* createClient(Window, Boolean shaped, XWindowAttributes*);
+    Boolean isShaped(Window);
+
+    // The connection Xlib runs over, for queries we want to pipeline:
+    // Xlib waits for each reply before sending the next request, xcb
+    // doesn't.  Requests made through it are numbered in sequence with
+    // Xlib's own, so error handling and NextRequest still see them.
+    xcb_connection_t *m_xcb;
+
+    Compositor *m_compositor; // for CONFIG_MANUAL_COMPOSITE; 0 if not
+    CommandTree *m_commandTree;
+
+    char **m_displayEnv; // per screen, for spawn; 0 if no DISPLAY
+    void initialiseLauncher();
+
+    // Colours looked up by name in one batch at startup, so that on
+    // TrueColor visuals allocateColour needn't ask the server at all
+    class ColourEntry {
+    public:
+        int screen;
+        char *name;
+        XColor exact;
+    };
+    List<ColourEntry> m_colours;
+    void prefetchColours();
+    Boolean findColour(int screen, const char *name, XColor &exact);
+
+    // for CONFIG_REPORT_STARTUP
+    long long m_startTime;
+    static long m_roundTrips;
+    static unsigned long m_lastKnownRequest;
+    static int countRoundTrips(Display*);
+
+    class PendingTitle {
+    public:
+        Client *client;
+        long long due;
+    };
+    List<PendingTitle> m_pendingTitles; // waiting on TitleTimer
+    void checkTitles();
 
-    void circulate(Boolean activeFirst);
-
-    Boolean m_focusChanging; // checking times for focus change
+    Boolean m_focusChanging; // waiting on FocusTimer
     Client *m_focusCandidate;
     Window m_focusCandidateWindow;
-    Time m_focusTimestamp; // time of last crossing event
     Boolean m_focusPointerMoved;
-    Boolean m_focusPointerNowStill;
     void checkDelaysForFocus();
 
-    void nextEvent(XEvent*); // return
+    int m_epollFd;
+    int m_timerFd;
+    long long m_timerDeadline[TimerCount]; // 0 if not set
+    Boolean m_timerFired[TimerCount];
+    long long m_timerArmed; // deadline the timerfd is set for
+    long m_wakeups;
+    void initialiseEventLoop();
+    Boolean checkTimers(); // true if any newly expired
+    void armTimerFd();
+
+    Boolean nextEvent(XEvent*); // false if we should stop looping
 
     void eventButton(XButtonEvent*, XEvent*);
     void eventKeyRelease(XKeyEvent*);
@@ -184,13 +425,74 @@ private:
     void eventExposure(XExposeEvent*);
 
     Boolean m_altPressed;
-    Boolean m_altStateRetained;
     void eventKeyPress(XKeyEvent*);
 
     void netwmInitialiseCompliance();
     Window m_netwmCheckWin;
 
+    enum {
+        NetwmClientList = 1, NetwmStacking = 2, NetwmActive = 4
+    };
+    int m_netwmDirty;
+
+    // last values written, so as to skip rewriting unchanged ones;
+    // the counts start at -1 so that even an empty list is written
+    // the first time
+    Window *m_netwmClientList;
+    int m_netwmClientListCount;
+    Window *m_netwmStacking;
+    int m_netwmStackingCount;
+    Window *m_netwmActive;
+    int m_netwmActiveCount;
+    void netwmPublish(Atom, Window*&, int&, Window*, int);
+
+    long m_eventCount; // for the debug output
+    long m_netwmWrites;
+    long m_netwmSkips;
+
     int m_altModMask;
 };
 
+// Event source for the modal loops that run while we hold a grab
+// (moving, resizing, menus, the tab button).  Blocks rather than
+// polling, folds queued motion into the newest event, and hands
+// motion out at most once per CONFIG_GRAB_FRAME_RATE frame.  Other
+// events are delivered straight away; button and key events discard
+// any motion still held, as the old polling loops did.
+
+class GrabEvents {
+
+public:
+    GrabEvents(WindowManager*, long mask);
+    ~GrabEvents();
+
+    // False if woken without an event, so the caller can look at its
+    // timers and come back
+    Boolean next(XEvent*);
+
+    // also hand out events of this (extension) type, which the mask
+    // can't select
+    void alsoDeliver(int type) {
+        m_extraType = type;
+    }
+
+private:
+    WindowManager *m_windowManager;
+    long m_mask;
+    int m_extraType;
+
+    XEvent m_motion;
+    Boolean m_haveMotion;
+    long long m_lastDelivery; // of motion
+
+    long m_motionCount;     // for CONFIG_REPORT_GRAB_STATS
+    long m_deliveredCount;
+    Time m_deliveredTime;   // of the motion being acted on, if any
+    long long m_latency;    // summed, input to configure, in ms
+    long m_latencyCount;
+    long long m_started;
+    long long m_startCpu;
+    void noteLatency();
+};
+
 #endif
@@ -1,19 +1,18 @@
 #include "Menu.h"
 #include "Manager.h"
 #include "Client.h"
+#include "Theme.h"
+#include "CommandTree.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <X11/XKBlib.h>
 
 Boolean Menu::m_initialised = False;
-GC *Menu::m_menuGC;
-XftFont *Menu::m_font;
-XftColor *Menu::m_xftColour;
-XftDraw **Menu::m_xftDraw;
-unsigned long Menu::m_foreground;
-unsigned long Menu::m_background;
-unsigned long Menu::m_border;
+Pixmap *Menu::m_pixmap;
+int *Menu::m_pixmapWidth;
+int *Menu::m_pixmapHeight;
+XftDraw **Menu::m_pixmapDraw;
 Window *Menu::m_window;
 
 #if MENU_ENTRY_MAXLENGTH > 0
@@ -22,89 +21,49 @@ Window *Menu::m_window;
 #define STRLEN_MITEMS(i) (strlen(m_items[(i)]))
 #endif
 
-#ifndef FC_WEIGHT_REGULAR
-#define FC_WEIGHT_REGULAR FC_WEIGHT_MEDIUM
-#endif
-
 Menu::Menu(WindowManager *manager, XEvent *e) :
     m_items(0),
     m_nItems(0),
     m_nHidden(0),
     m_hasSubmenus(False),
+    m_itemsWidth(-1),
+    m_width(0),
+    m_height(0),
+    m_entryHeight(0),
+    m_rows(0),
+    m_top(0),
+    m_selected(-1),
     m_windowManager(manager),
     m_event(e)
 {
     if (!m_initialised) {
-        XGCValues *values;
-        XSetWindowAttributes *attr;
-
-        m_menuGC = (GC*) malloc(m_windowManager->screensTotal() * sizeof(GC));
         m_window = (Window*) malloc(m_windowManager->screensTotal() * sizeof(Window));
-        char *fi = strdup(CONFIG_MENU_FONT);
-        char *ffi = fi, *tokstr = fi;
-
-        while ((fi = strtok(tokstr, ","))) {
-            // fprintf(stderr, "fi = \"%s\"\n", fi);
-            tokstr = 0;
-
-            FcPattern *pattern = FcPatternCreate();
-            FcPatternAddString(pattern, FC_FAMILY, (FcChar8*) fi);
-            FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
-            FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_REGULAR);
-            FcPatternAddInteger(pattern, FC_PIXEL_SIZE, CONFIG_MENU_FONT_SIZE);
-            FcConfigSubstitute(FcConfigGetCurrent(), pattern, FcMatchPattern);
-
-            FcResult result = FcResultMatch;
-            FcPattern *match = FcFontMatch(FcConfigGetCurrent(), pattern, &result);
-            FcPatternDestroy(pattern);
-
-            if (!match || result != FcResultMatch) {
-                if (match) {
-                    FcPatternDestroy(match);
-                }
-                continue;
-            }
-
-            m_font = XftFontOpenPattern(display(), match);
-            if (m_font) {
-                break;
-            }
-            FcPatternDestroy(match);
-        }
-        free(ffi);
-        if (!m_font) {
-            m_windowManager->fatal("couldn't load menu Xft font");
-        }
-        m_xftColour = (XftColor*) malloc(m_windowManager->screensTotal() * sizeof(XftColor));
-        m_xftDraw = (XftDraw**) malloc(m_windowManager->screensTotal() * sizeof(XftDraw*));
-        values = (XGCValues*) malloc(m_windowManager->screensTotal() * sizeof(XGCValues));
-        attr = (XSetWindowAttributes*) malloc(m_windowManager->screensTotal() * sizeof(XSetWindowAttributes));
+        m_pixmap = (Pixmap*) malloc(m_windowManager->screensTotal() * sizeof(Pixmap));
+        m_pixmapWidth = (int*) malloc(m_windowManager->screensTotal() * sizeof(int));
+        m_pixmapHeight = (int*) malloc(m_windowManager->screensTotal() * sizeof(int));
+        m_pixmapDraw = (XftDraw**) malloc(m_windowManager->screensTotal() * sizeof(XftDraw*));
 
         for (int i = 0; i < m_windowManager->screensTotal(); i++) {
-            m_foreground = m_windowManager->allocateColour(i, CONFIG_MENU_FOREGROUND, "menu foreground");
-            m_background = m_windowManager->allocateColour(i, CONFIG_MENU_BACKGROUND, "menu background");
-            m_border = m_windowManager->allocateColour(i, CONFIG_MENU_BORDERS, "menu border");
-
-            values[i].background = m_background;
-            values[i].foreground = m_foreground ^ m_background;
-            values[i].function = GXxor;
-            values[i].line_width = 0;
-            values[i].subwindow_mode = IncludeInferiors;
-            m_menuGC[i] = XCreateGC(display(), m_windowManager->mroot(i),
-            GCForeground | GCBackground | GCFunction |
-            GCLineWidth | GCSubwindowMode, &values[i]);
-
-            m_window[i] = XCreateSimpleWindow(display(), m_windowManager->mroot(i), 0, 0, 1, 1, 1, m_border, m_background);
+            m_window[i] = None;
+            m_pixmap[i] = None;
+            m_pixmapWidth[i] = m_pixmapHeight[i] = 0;
+            m_pixmapDraw[i] = 0;
+        }
+        m_initialised = True;
+    }
 
-            attr[i].save_under = (DoesSaveUnders(ScreenOfDisplay(display(), i)) ? True : False);
+    int s = screen();
+    if (!m_window[s]) {
+        XSetWindowAttributes attr;
 
-            XChangeWindowAttributes(display(), m_window[i], CWSaveUnder, &attr[i]);
+        m_window[s] = XCreateSimpleWindow(display(), root(), 0, 0, 1, 1, 1, theme().menuBorder, theme().menuBackground);
 
-            XftColorAllocName(display(), XDefaultVisual(display(), i), XDefaultColormap(display(), i), CONFIG_MENU_FOREGROUND, &m_xftColour[i]);
+        attr.save_under = (DoesSaveUnders(ScreenOfDisplay(display(), s)) ? True : False);
+        // everything comes from the pixmap, so there's no point in
+        // the server clearing it first
+        attr.background_pixmap = None;
 
-            m_xftDraw[i] = XftDrawCreate(display(), m_window[i], XDefaultVisual(display(), i), XDefaultColormap(display(), i));
-        }
-        m_initialised = True;
+        XChangeWindowAttributes(display(), m_window[s], CWSaveUnder | CWBackPixmap, &attr);
     }
 }
 
@@ -112,18 +71,39 @@ Menu::~Menu() {
     XUnmapWindow(display(), m_window[screen()]);
 }
 
+ThemeScreen& Menu::theme() {
+    return m_windowManager->theme().screen(screen());
+}
+
+XftFont* Menu::font() {
+    return m_windowManager->theme().menuFont();
+}
+
 int Menu::getTextWidth(char *text, unsigned int len) {
-    XGlyphInfo extents;
-    XftTextExtentsUtf8(display(), m_font, (FcChar8*) text, len, &extents);
-    return extents.width;
+    return m_windowManager->textCache().extents(display(), font(), text, len).width;
+}
+
+int Menu::measureItems() {
+    int width, maxWidth = 10;
+    for (int i = 0; i < m_nItems; i++) {
+        width = getTextWidth(m_items[i], STRLEN_MITEMS(i));
+        if (width > maxWidth) {
+            maxWidth = width;
+        }
+    }
+    return maxWidth;
 }
 
 void Menu::cleanup(WindowManager *const wm) {
     if (m_initialised) { // fix due to Eric Marsden
-        XftFontClose(wm->display(), m_font);
         for (int i = 0; i < wm->screensTotal(); i++) {
-            XftDrawDestroy(m_xftDraw[i]);
-            XFreeGC(wm->display(), m_menuGC[i]);
+            if (m_window[i]) {
+                XDestroyWindow(wm->display(), m_window[i]);
+            }
+            if (m_pixmap[i]) {
+                wm->theme().releaseDraw(m_pixmap[i]);
+                XFreePixmap(wm->display(), m_pixmap[i]);
+            }
         }
     }
 }
@@ -134,6 +114,171 @@ int nobuttons(XButtonEvent *e) { // straight outta 9wm
     return (e->type == ButtonRelease) && (state & (state - 1)) == 0;
 }
 
+// Rows are drawn into a pixmap and copied to the window from there.
+// Only the rows in view are ever drawn: a menu too tall for the
+// screen shows as many as fit, and scrolls.
+
+void Menu::ensurePixmap(int width, int height) {
+    int s = screen();
+    if (m_pixmap[s] && m_pixmapWidth[s] >= width && m_pixmapHeight[s] >= height) {
+        return;
+    }
+    if (m_pixmap[s]) {
+        m_windowManager->theme().releaseDraw(m_pixmap[s]);
+        XFreePixmap(display(), m_pixmap[s]);
+        if (width < m_pixmapWidth[s]) {
+            width = m_pixmapWidth[s];
+        }
+        if (height < m_pixmapHeight[s]) {
+            height = m_pixmapHeight[s];
+        }
+    }
+    m_pixmap[s] = XCreatePixmap(display(), root(), width, height, DefaultDepth(display(), s));
+    m_pixmapWidth[s] = width;
+    m_pixmapHeight[s] = height;
+    m_pixmapDraw[s] = m_windowManager->theme().acquireDraw(s, m_pixmap[s]);
+}
+
+void Menu::drawMenu() {
+    XFillRectangle(display(), m_pixmap[screen()], theme().menuFillGC, 0, 0, m_width, m_height);
+    XDrawRectangle(display(), m_pixmap[screen()], theme().menuGC, 2, 7, m_width - 5, m_height - 10);
+    for (int i = m_top; i < m_top + m_rows; ++i) {
+        drawRow(i);
+    }
+}
+
+void Menu::drawRow(int i) {
+    int row = i - m_top;
+    if (row < 0 || row >= m_rows || i >= m_nItems) {
+        return;
+    }
+
+    int y = row * m_entryHeight + 9;
+    XFillRectangle(display(), m_pixmap[screen()], theme().menuFillGC, 3, y, m_width - 6, m_entryHeight);
+
+    int dx = getTextWidth(m_items[i], STRLEN_MITEMS(i));
+    int dy = row * m_entryHeight + font()->ascent + 10;
+    if (i >= m_nHidden) {
+        XftDrawStringUtf8(m_pixmapDraw[screen()], &theme().menuText, font(), m_width - 8 - dx, dy, (FcChar8*) m_items[i], STRLEN_MITEMS(i));
+    } else {
+        XftDrawStringUtf8(m_pixmapDraw[screen()], &theme().menuText, font(), 8, dy, (FcChar8*) m_items[i], STRLEN_MITEMS(i));
+    }
+
+    if (i == m_selected) {
+        XFillRectangle(display(), m_pixmap[screen()], theme().menuGC, 4, y, m_width - 8, m_entryHeight);
+    }
+}
+
+void Menu::showRow(int i) {
+    int row = i - m_top;
+    if (row < 0 || row >= m_rows) {
+        return;
+    }
+    int y = row * m_entryHeight + 9;
+    XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC, 3, y, m_width - 6, m_entryHeight, 3, y);
+}
+
+// The highlight moves from one row to another; nothing else changes,
+// unless the new one has to be scrolled into view
+
+void Menu::select(int i) {
+    int prev = m_selected;
+    m_selected = (i >= 0 && i < m_nItems) ? i : -1;
+
+    if (m_selected >= 0 && m_selected < m_top) {
+        scrollTo(m_selected);
+    } else if (m_selected >= m_top + m_rows) {
+        scrollTo(m_selected - m_rows + 1);
+    }
+
+    drawRow(prev);
+    showRow(prev);
+    drawRow(m_selected);
+    showRow(m_selected);
+}
+
+// Rows still in view after the scroll are moved within the pixmap,
+// and only those coming into view are drawn
+
+void Menu::scrollTo(int top) {
+    if (top > m_nItems - m_rows) {
+        top = m_nItems - m_rows;
+    }
+    if (top < 0) {
+        top = 0;
+    }
+    int delta = top - m_top;
+    if (delta == 0) {
+        return;
+    }
+
+    int i;
+    int kept = m_rows - (delta > 0 ? delta : -delta);
+    m_top = top;
+
+    if (kept <= 0) {
+        for (i = m_top; i < m_top + m_rows; ++i) {
+            drawRow(i);
+        }
+    } else if (delta > 0) {
+        XCopyArea(display(), m_pixmap[screen()], m_pixmap[screen()], theme().menuFillGC,
+            3, 9 + delta * m_entryHeight, m_width - 6, kept * m_entryHeight, 3, 9);
+        for (i = m_top + kept; i < m_top + m_rows; ++i) {
+            drawRow(i);
+        }
+    } else {
+        XCopyArea(display(), m_pixmap[screen()], m_pixmap[screen()], theme().menuFillGC,
+            3, 9, m_width - 6, kept * m_entryHeight, 3, 9 - delta * m_entryHeight);
+        for (i = m_top; i < m_top - delta; ++i) {
+            drawRow(i);
+        }
+    }
+
+    XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC,
+        3, 9, m_width - 6, m_rows * m_entryHeight, 3, 9);
+}
+
+// The item under the given position (relative to the first row), or
+// -1; near the top or bottom of a scrolling menu, scroll it on first
+
+int Menu::itemAt(int x, int y, int current) {
+    if (x < 0 || x > m_width || y < -3) {
+        return -1;
+    }
+    int row = y / m_entryHeight;
+    if (current >= m_top && current < m_top + m_rows &&
+        y >= (current - m_top) * m_entryHeight - 3 && y <= (current - m_top + 1) * m_entryHeight - 3) {
+        row = current - m_top;
+    }
+    if (row < 0 || row >= m_rows) {
+        return -1;
+    }
+    return m_top + row;
+}
+
+// Size the menu for m_items, with as many rows as fit on the screen
+// and the selected one in view
+
+void Menu::layout(int selected) {
+    if (m_itemsWidth < 0) {
+        m_itemsWidth = measureItems();
+    }
+    int my = DisplayHeight(display(), screen()) - 1;
+
+    m_entryHeight = font()->ascent + font()->descent + 4;
+    m_rows = (my - 13) / m_entryHeight;
+    if (m_rows > m_nItems) {
+        m_rows = m_nItems;
+    }
+    if (m_rows < 1) {
+        m_rows = 1;
+    }
+    m_top = (selected >= m_rows) ? selected - m_rows + 1 : 0;
+    m_width = m_itemsWidth + 32;
+    m_height = m_entryHeight * m_rows + 13;
+    m_selected = selected;
+}
+
 int Menu::getSelection() {
     m_items = getItems(&m_nItems, &m_nHidden);
     XButtonEvent *xbev = (XButtonEvent*) m_event; // KeyEvent is similar enough
@@ -141,23 +286,16 @@ int Menu::getSelection() {
     if (xbev->window == m_window[screen()] || m_nItems == 0) {
         return -1;
     }
-    int width, maxWidth = 10;
-    for (int i = 0; i < m_nItems; i++) {
-        width = getTextWidth(m_items[i], STRLEN_MITEMS(i));
-        if (width > maxWidth) {
-            maxWidth = width;
-        }
-    }
-    maxWidth += 32;
 
     Boolean isKeyboardMenu = isKeyboardMenuEvent(m_event);
     int selecting = isKeyboardMenu ? 0 : -1, prev = -1;
-    int entryHeight = m_font->ascent + m_font->descent + 4;
-    int totalHeight = entryHeight * m_nItems + 13;
 
     int mx = DisplayWidth (display(), screen()) - 1;
     int my = DisplayHeight(display(), screen()) - 1;
 
+    layout(selecting);
+    int maxWidth = m_width;
+    int totalHeight = m_height;
     int x, y;
 
     if (isKeyboardMenu) {
@@ -194,9 +332,15 @@ int Menu::getSelection() {
         }
     }
 
+    // laid out and drawn before it's mapped, so that it's complete
+    // as soon as it appears
+    ensurePixmap(maxWidth, totalHeight);
+    drawMenu();
+
     XMoveResizeWindow(display(), m_window[screen()], x, y, maxWidth, totalHeight);
     XSelectInput(display(), m_window[screen()], MenuMask);
     XMapRaised(display(), m_window[screen()]);
+    XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC, 0, 0, maxWidth, totalHeight, 0, 0);
 
     if (m_windowManager->attemptGrab(m_window[screen()], None, MenuGrabMask, xbev->time) != GrabSuccess) {
         XUnmapWindow(display(), m_window[screen()]);
@@ -213,16 +357,18 @@ int Menu::getSelection() {
     Boolean done = False;
     Boolean drawn = False;
     XEvent event;
-    struct timeval sleepval;
-    unsigned long tdiff = 0L;
     Boolean speculating = False;
-    Boolean foundEvent;
+    //!!! MenuMask | ??? suggests MenuMask is wrong
+    GrabEvents events(m_windowManager, MenuMask | StructureNotifyMask | KeyPressMask | KeyReleaseMask);
+
+    if (CONFIG_FEEDBACK_DELAY >= 0 && !isKeyboardMenu) {
+        m_windowManager->setTimer(WindowManager::FeedbackTimer, CONFIG_FEEDBACK_DELAY);
+    }
 
     while (!done) {
         int i;
-        foundEvent = False;
 
-        if (CONFIG_FEEDBACK_DELAY >= 0 && tdiff > (unsigned long) CONFIG_FEEDBACK_DELAY && !isKeyboardMenu && !speculating) {
+        if (m_windowManager->timerExpired(WindowManager::FeedbackTimer) && !speculating) {
             // removeFeedback didn't seem to work for it
             if (selecting >= 0 && selecting < m_nItems) {
                 raiseFeedbackLevel(selecting);
@@ -231,49 +377,32 @@ int Menu::getSelection() {
             speculating = True;
         }
 
-        //!!! MenuMask | ??? suggests MenuMask is wrong
-        while (XCheckMaskEvent(display(), MenuMask | StructureNotifyMask | KeyPressMask | KeyReleaseMask, &event)) {
-            foundEvent = True;
-            if (event.type != MotionNotify) {
-                break;
-            }
-        }
-
-        if (!foundEvent) {
-            sleepval.tv_sec = 0;
-            sleepval.tv_usec = 10000;
-            select(0, 0, 0, 0, &sleepval);
-            tdiff += 10;
+        if (!events.next(&event)) {
             continue;
         }
 
         switch (event.type) {
 
           case ButtonPress: {
+            if (event.xbutton.button == Button4) {
+                scrollTo(m_top - 3);
+            } else if (event.xbutton.button == Button5) {
+                scrollTo(m_top + 3);
+            }
             break;
           }
           case ButtonRelease: {
-            if (isKeyboardMenu) {
+            if (isKeyboardMenu || event.xbutton.button == Button4 || event.xbutton.button == Button5) {
                 break;
             }
             if (drawn) {
                 if (event.xbutton.button != xbev->button) {
                     break;
                 }
-                x = event.xbutton.x;
-                y = event.xbutton.y - 11;
-                i = y / entryHeight;
-                if (selecting >= 0 && y >= selecting * entryHeight - 3 && y <= (selecting + 1) * entryHeight - 3) {
-                    i = selecting;
-                }
+                i = itemAt(event.xbutton.x, event.xbutton.y - 11, selecting);
                 if (m_hasSubmenus && (i >= 0 && i < m_nHidden)) {
                     i = -i;
                 }
-                if (x < 0 || x > maxWidth || y < -3) {
-                    i = -1;
-                } else if (i < 0 || i >= m_nItems) {
-                    i = -1;
-                }
             } else {
                 i = -1;
             }
@@ -293,10 +422,19 @@ int Menu::getSelection() {
             x = event.xbutton.x;
             y = event.xbutton.y - 11;
             prev = selecting;
-            selecting = y / entryHeight;
-            if (prev >= 0 && y >= prev * entryHeight - 3 && y <= (prev + 1) * entryHeight - 3) {
-                selecting = prev;
+
+            // pointing at the first or last row in view brings the
+            // next one in, for as long as the pointer keeps moving
+            if (x >= 0 && x <= maxWidth && y >= -3) {
+                int row = y / m_entryHeight;
+                if (row <= 0 && m_top > 0) {
+                    scrollTo(m_top - 1);
+                } else if (row == m_rows - 1 && m_top + m_rows < m_nItems) {
+                    scrollTo(m_top + 1);
+                }
             }
+
+            selecting = itemAt(x, y, prev);
             if (m_hasSubmenus && (selecting >= 0 && selecting < m_nHidden) && x >= maxWidth - 32 && x < maxWidth) {
                 xbev->x += event.xbutton.x - 32;
                 xbev->y += event.xbutton.y;
@@ -304,25 +442,21 @@ int Menu::getSelection() {
                 done = True;
                 break;
             }
-            if (x < 0 || x > maxWidth || y < -3) {
-                selecting = -1;
-            } else if (selecting < 0 || selecting > m_nItems) {
-                selecting = -1;
-            }
             if (selecting == prev) {
                 break;
             }
-            tdiff = 0;
+            if (CONFIG_FEEDBACK_DELAY >= 0) {
+                m_windowManager->setTimer(WindowManager::FeedbackTimer, CONFIG_FEEDBACK_DELAY);
+            }
             speculating = False;
             if (prev >= 0 && prev < m_nItems) {
                 removeFeedback(prev, speculating);
-                XFillRectangle(display(), m_window[screen()], m_menuGC[screen()], 4, prev * entryHeight + 9, maxWidth - 8, entryHeight);
             }
             if (selecting >= 0 && selecting < m_nItems) {
                 showFeedback(selecting);
                 XRaiseWindow(display(), m_window[screen()]);
-                XFillRectangle(display(), m_window[screen()], m_menuGC[screen()], 4, selecting * entryHeight + 9, maxWidth - 8, entryHeight);
             }
+            select(selecting);
             break;
           }
           case Expose: {
@@ -330,20 +464,9 @@ int Menu::getSelection() {
                 m_windowManager->dispatchEvent(&event);
                 break;
             }
-            XClearWindow(display(), m_window[screen()]);
-            XDrawRectangle(display(), m_window[screen()], m_menuGC[screen()], 2, 7, maxWidth - 5, totalHeight - 10);
-            for (i = 0; i < m_nItems; i++) {
-                int dx = getTextWidth(m_items[i], STRLEN_MITEMS(i));
-                int dy = i * entryHeight + m_font->ascent + 10;
-                if (i >= m_nHidden) {
-                    XftDrawStringUtf8(m_xftDraw[screen()], &m_xftColour[screen()], m_font, maxWidth - 8 - dx, dy, (FcChar8*) m_items[i], STRLEN_MITEMS(i));
-                } else {
-                    XftDrawStringUtf8(m_xftDraw[screen()], &m_xftColour[screen()], m_font, 8, dy, (FcChar8*) m_items[i], STRLEN_MITEMS(i));
-                }
-            }
-            if (selecting >= 0 && selecting < m_nItems) {
-                XFillRectangle(display(), m_window[screen()], m_menuGC[screen()], 4, selecting * entryHeight + 9, maxWidth - 8, entryHeight);
-            }
+            XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC,
+                event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height,
+                event.xexpose.x, event.xexpose.y);
             drawn = True;
             break;
           }
@@ -393,17 +516,15 @@ int Menu::getSelection() {
                     selecting = prev + 1;
                 }
             }
-            tdiff = 0;
             speculating = False;
             if (prev >= 0 && prev < m_nItems) {
                 removeFeedback(prev, speculating);
-                XFillRectangle(display(), m_window[screen()], m_menuGC[screen()], 4, prev * entryHeight + 9, maxWidth - 8, entryHeight);
             }
             if (selecting >= 0 && selecting < m_nItems) {
                 showFeedback(selecting);
                 XRaiseWindow(display(), m_window[screen()]);
-                XFillRectangle(display(), m_window[screen()], m_menuGC[screen()], 4, selecting * entryHeight + 9, maxWidth - 8, entryHeight);
             }
+            select(selecting);
             break;
           }
           case KeyRelease: {
@@ -419,6 +540,8 @@ int Menu::getSelection() {
         } // switch
     }
 
+    m_windowManager->cancelTimer(WindowManager::FeedbackTimer);
+
     if (selecting >= 0) {
         removeFeedback(selecting, speculating);
     }
@@ -584,35 +707,158 @@ void ClientMenu::raiseFeedbackLevel(int item) {
     }
 }
 
+ClientSwitcher::ClientSwitcher(WindowManager *manager, XEvent *e) :
+    Menu(manager, e)
+{
+    Client *c = choose();
+    if (c) {
+        c->activateAndWarp();
+    }
+}
+
+ClientSwitcher::~ClientSwitcher() {
+    m_clients.remove_all();
+    free(m_items);
+}
+
+char** ClientSwitcher::getItems(int *niR, int *nhR) {
+    ClientList &order = m_windowManager->focusOrder();
+    for (int i = 0; i < order.count(); ++i) {
+        Client *c = order.item(i);
+        if (c->isNormal() && !c->isTransient() && !c->skipsFocus()) {
+            m_clients.append(c);
+        }
+    }
+
+    const char **items = (const char**) malloc((m_clients.count() + 1) * sizeof(char*));
+    for (int i = 0; i < m_clients.count(); ++i) {
+        items[i] = m_clients.item(i)->label();
+    }
+    *niR = m_clients.count();
+    *nhR = m_clients.count(); // drawn flush left, as in the client menu
+    return (char**) items;
+}
+
+// Nothing but our own window's exposures and the keyboard are
+// handled until the switch is over, so no client can go away
+// underneath us
+
+Client* ClientSwitcher::choose() {
+    XKeyEvent *xkev = &m_event->xkey;
+    m_items = getItems(&m_nItems, &m_nHidden);
+
+    if (m_nItems == 0) {
+        return 0;
+    }
+    int selecting = (m_nItems > 1 && m_clients.item(0)->isActive()) ? 1 : 0;
+    if (m_nItems == 1) {
+        return m_clients.item(selecting);
+    }
+
+    int mx = DisplayWidth (display(), screen()) - 1;
+    int my = DisplayHeight(display(), screen()) - 1;
+
+    layout(selecting);
+    ensurePixmap(m_width, m_height);
+    drawMenu();
+
+    XMoveResizeWindow(display(), m_window[screen()], (mx - m_width) / 2, (my - m_height) / 2, m_width, m_height);
+    XSelectInput(display(), m_window[screen()], ExposureMask);
+    XMapRaised(display(), m_window[screen()]);
+    XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC, 0, 0, m_width, m_height, 0, 0);
+
+    if (m_windowManager->attemptGrabKey(m_window[screen()], xkev->time) != GrabSuccess) {
+        XUnmapWindow(display(), m_window[screen()]);
+        return 0;
+    }
+    showFeedback(selecting);
+
+    // the modifier may have gone up before we had the keyboard, in
+    // which case its release went to whoever had it then
+    XkbStateRec state;
+    Boolean done = (XkbGetState(display(), XkbUseCoreKbd, &state) == Success &&
+                    !(state.base_mods & m_windowManager->altModMask()));
+    XEvent event = *m_event;
+    GrabEvents events(m_windowManager, ExposureMask | KeyPressMask | KeyReleaseMask);
+
+    while (!done) {
+        if (!events.next(&event)) {
+            continue;
+        }
+
+        switch (event.type) {
+
+          case Expose: {
+            if (event.xexpose.window != m_window[screen()]) {
+                m_windowManager->dispatchEvent(&event);
+                break;
+            }
+            XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC,
+                event.xexpose.x, event.xexpose.y, event.xexpose.width, event.xexpose.height,
+                event.xexpose.x, event.xexpose.y);
+            break;
+          }
+          case KeyPress: {
+            KeySym key = XkbKeycodeToKeysym(display(), event.xkey.keycode, 0, 0);
+            if (key == CONFIG_MENU_CANCEL_KEY) {
+                removeFeedback(selecting, False);
+                selecting = -1;
+                done = True;
+                break;
+            } else if (key != CONFIG_CIRCULATE_KEY) {
+                break;
+            }
+            removeFeedback(selecting, False);
+            if (event.xkey.state & ShiftMask) {
+                selecting = (selecting + m_nItems - 1) % m_nItems;
+            } else {
+                selecting = (selecting + 1) % m_nItems;
+            }
+            showFeedback(selecting);
+            select(selecting);
+            break;
+          }
+          case KeyRelease: {
+            if (XkbKeycodeToKeysym(display(), event.xkey.keycode, 0, 0) == CONFIG_ALT_KEY) {
+                m_windowManager->dispatchEvent(&event);
+                done = True;
+            }
+            break;
+          }
+
+        } // switch
+    }
+
+    m_windowManager->releaseGrabKeyMode(&event.xkey);
+    XUnmapWindow(display(), m_window[screen()]);
+
+    if (selecting < 0) {
+        return 0;
+    }
+    removeFeedback(selecting, False);
+    return m_clients.item(selecting);
+}
+
+void ClientSwitcher::showFeedback(int item) {
+    m_clients.item(item)->showFeedback();
+}
+
+void ClientSwitcher::removeFeedback(int item, Boolean mapped) {
+    m_clients.item(item)->removeFeedback(mapped);
+}
+
 CommandMenu::CommandMenu(WindowManager *manager, XEvent *e, char *otherdir) :
     Menu(manager, e)
 {
-    const char *home = getenv("HOME");
-    const char *wmxdir = getenv("WMXDIR");
+    const char *dir = otherdir ? otherdir : m_windowManager->commandTree().root();
 
     m_commandDir = NULL;
     m_hasSubmenus = True;
 
-    if (otherdir == NULL) {
-        if (wmxdir == NULL) {
-            if (home == NULL) {
-                return;
-            }
-            m_commandDir = (char*) malloc(strlen(home) + strlen(CONFIG_COMMAND_MENU) + 2);
-            sprintf(m_commandDir, "%s/%s", home, CONFIG_COMMAND_MENU);
-        } else { // wmxdir != NULL
-            if (wmxdir[0] == '/') {
-                m_commandDir = (char*) malloc(strlen(wmxdir) + 1);
-                strcpy(m_commandDir, wmxdir);
-            } else { // wmxdir doesn't start with /
-                m_commandDir = (char*) malloc(strlen(home) + strlen(wmxdir) + 2);
-                sprintf(m_commandDir, "%s/%s", home, wmxdir);
-            }
-        }
-    } else { // otherdir != NULL
-        m_commandDir = (char*) malloc(strlen(otherdir) + 1);
-        strcpy(m_commandDir, otherdir);
+    if (dir == NULL) {
+        return;
     }
+    m_commandDir = NewString(dir);
 
     int i = getSelection();
     if (i >= 0 && i < m_nHidden) {
@@ -634,12 +880,6 @@ CommandMenu::~CommandMenu() {
     free(m_items);
 }
 
-static int sortstrs(const void *va, const void *vb) {
-    char **a = (char**) va;
-    char **b = (char**) vb;
-    return strcmp(*a, *b);
-}
-
 void CommandMenu::createSubmenu(XEvent *e, int i) {
     char *new_directory;
     int dirlen = strlen(m_commandDir);
@@ -653,72 +893,30 @@ void CommandMenu::createSubmenu(XEvent *e, int i) {
     free(new_directory);
 }
 
+// The names come from the command tree, already sorted.  They're
+// copied, as the tree may be refreshed while the menu is up.
+
 char** CommandMenu::getItems(int *niR, int *nhR) {
     *niR = *nhR = 0;
-    DIR *dir;
-    const char *home;
-    char *dirpath;
 
-    if ((home = getenv("HOME")) == NULL) {
+    CommandTree::Directory *d = m_windowManager->commandTree().find(m_commandDir);
+    if (!d || d->count == 0) {
         return NULL;
     }
-    int dirlen = strlen(m_commandDir);
-    dir = opendir(m_commandDir);
 
-    if (dir == NULL) {
-        return NULL;
+    char **items = (char**) malloc(d->count * sizeof(char*));
+    for (int i = 0; i < d->count; ++i) {
+        items[i] = NewString(d->names[i]);
     }
-    dirpath = (char*) malloc(dirlen + 1024 + 2); // NAME_MAX guess
-    strcpy(dirpath, m_commandDir);
-
-    int count = 0;
-    struct dirent *ent;
-
-    // We already assume efficient realloc() in Border.C, so we may as well assume it here too.
+    *niR = d->count;
+    *nhR = d->directories;
 
-    char **items = 0;
-
-    while ((ent = readdir(dir)) != NULL) {
-        struct stat st;
-        sprintf(dirpath + dirlen, "/%s", ent->d_name);
-
-        if (stat(dirpath, &st) == -1) {
-            continue;
-        }
-        if (!S_ISDIR(st.st_mode) || !(st.st_mode & 0444)) {
-            continue;
-        }
-        if (ent->d_name[0] == '.') {
-            continue;
-        }
-        items = ( !items ? (char**) malloc(sizeof(char*)) : (char**) realloc(items, (count + 1) * sizeof(char*)));
-        items[count++] = NewString(ent->d_name);
-    }
-
-    qsort(items, count, sizeof(char*), sortstrs);
-    *nhR = count;
-
-    rewinddir(dir);
-
-    while ((ent = readdir(dir)) != NULL) {
-        struct stat st;
-        sprintf(dirpath + dirlen, "/%s", ent->d_name);
-
-        if (stat(dirpath, &st) == -1) {
-            continue;
-        }
-        if (!S_ISREG(st.st_mode) || !(st.st_mode & 0111)) {
-            continue;
-        }
-        items = (!items ? (char**) malloc(sizeof(char*)) : (char**) realloc(items, (count + 1) * sizeof(char*)));
-        items[count++] = NewString(ent->d_name);
+    if (d->width < 0) {
+        m_items = items;
+        m_nItems = d->count;
+        d->width = measureItems();
     }
-
-    *niR = count;
-    qsort(items + *nhR, *niR - *nhR, sizeof(char*), sortstrs);
-
-    free(dirpath);
-    closedir(dir);
+    m_itemsWidth = d->width;
 
     return items;
 }
@@ -734,15 +932,17 @@ void ShowGeometry::update(int x, int y) {
     sprintf(string, "%d %d", x, y);
 
     int width = getTextWidth(string, strlen(string)) + 8;
-    int height = m_font->ascent + m_font->descent + 8;
+    int height = font()->ascent + font()->descent + 8;
     int mx = DisplayWidth (display(), screen()) - 1;
     int my = DisplayHeight(display(), screen()) - 1;
 
-    XMoveResizeWindow(display(), m_window[screen()], (mx-width)/2, (my-height)/2 , width, height);
+    ensurePixmap(width, height);
+    XFillRectangle(display(), m_pixmap[screen()], theme().menuFillGC, 0, 0, width, height);
+    XftDrawStringUtf8(m_pixmapDraw[screen()], &theme().menuText, font(), 4, 4 + font()->ascent, (FcChar8*) string, strlen(string));
 
-    XClearWindow(display(), m_window[screen()]);
+    XMoveResizeWindow(display(), m_window[screen()], (mx-width)/2, (my-height)/2 , width, height);
     XMapRaised(display(), m_window[screen()]);
-    XftDrawStringUtf8(m_xftDraw[screen()], &m_xftColour[screen()], m_font, 4, 4 + m_font->ascent, (FcChar8*) string, strlen(string));
+    XCopyArea(display(), m_pixmap[screen()], m_window[screen()], theme().menuFillGC, 0, 0, width, height, 0, 0);
 }
 
 void ShowGeometry::remove() {
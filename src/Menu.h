@@ -5,6 +5,8 @@
 #include "Manager.h"
 #include <dirent.h>
 
+class ThemeScreen;
+
 class Menu {
 
 public:
@@ -19,23 +21,43 @@ public:
     }
 
 protected:
-    static Window *m_window;
+    static Window *m_window; // per screen, made when first needed
     static Boolean m_initialised;
-    static GC *m_menuGC;
-    static XftFont *m_font;
-    static XftColor *m_xftColour;
-    static XftDraw **m_xftDraw;
-    static unsigned long m_foreground;
-    static unsigned long m_background;
-    static unsigned long m_border;
+
+    // colours, GCs and font come from the manager's Theme
+    ThemeScreen& theme();
+    XftFont* font();
+
+    // what's shown in the window is drawn here first (per screen)
+    static Pixmap *m_pixmap;
+    static int *m_pixmapWidth;
+    static int *m_pixmapHeight;
+    static XftDraw **m_pixmapDraw;
+    void ensurePixmap(int width, int height);
 
     int getTextWidth(char *text, unsigned int len);
+    int measureItems(); // widest of m_items
 
     char **m_items;
     int m_nItems;
     int m_nHidden;
 
     Boolean m_hasSubmenus;
+    int m_itemsWidth; // widest item, if getItems knew it; else -1
+
+    int m_width;
+    int m_height;
+    int m_entryHeight;
+    int m_rows;     // in view
+    int m_top;      // first item in view
+    int m_selected; // highlighted, or -1
+    void layout(int selected);
+    void drawMenu();
+    void drawRow(int);
+    void showRow(int);
+    void select(int);
+    void scrollTo(int top);
+    int itemAt(int x, int y, int current);
     virtual void createSubmenu(XEvent *e, int i) {}
 
     WindowManager *m_windowManager;
@@ -76,6 +98,26 @@ private:
     virtual void raiseFeedbackLevel(int);
 };
 
+// Alt-Tab.  The clients are listed most recently active first, and
+// the one that would be switched to is highlighted and outlined on
+// the screen; nothing else happens until the modifier is let go,
+// when that client alone is raised and focused.
+
+class ClientSwitcher: public Menu {
+
+public:
+    ClientSwitcher(WindowManager*, XEvent *e);
+    virtual ~ClientSwitcher();
+
+private:
+    virtual char** getItems(int*, int*);
+    ClientList m_clients;
+
+    Client* choose();
+    virtual void showFeedback(int);
+    virtual void removeFeedback(int, Boolean);
+};
+
 class CommandMenu: public Menu {
 
 public:
@@ -0,0 +1,147 @@
+#include "TextCache.h"
+
+#include <string.h>
+
+TextCache::TextCache(int capacity) :
+    m_capacity(capacity),
+    m_used(0),
+    m_newest(-1),
+    m_oldest(-1),
+    m_free(-1),
+    m_hits(0),
+    m_misses(0)
+{
+    m_entries = (Entry*) calloc(m_capacity, sizeof(Entry));
+    assert(m_entries);
+
+    // at least twice as many buckets as entries, a power of two
+    unsigned long buckets = 1;
+    while (buckets < (unsigned long) m_capacity * 2) {
+        buckets *= 2;
+    }
+    m_mask = buckets - 1;
+    m_buckets = (int*) malloc(buckets * sizeof(int));
+    assert(m_buckets);
+    for (unsigned long i = 0; i < buckets; ++i) {
+        m_buckets[i] = -1;
+    }
+}
+
+TextCache::~TextCache() {
+    for (int i = 0; i < m_used; ++i) {
+        free(m_entries[i].text);
+    }
+    free((void*) m_entries);
+    free((void*) m_buckets);
+}
+
+// FNV-1a over the string, starting from the font
+unsigned long TextCache::hash(XftFont *font, const char *text, int length) const {
+    unsigned long h = 2166136261UL ^ (unsigned long) font;
+    for (int i = 0; i < length; ++i) {
+        h ^= (unsigned char) text[i];
+        h *= 16777619UL;
+    }
+    return h ^ (h >> 16);
+}
+
+void TextCache::unlink(int i) {
+    Entry &e = m_entries[i];
+    if (e.newer >= 0) {
+        m_entries[e.newer].older = e.older;
+    } else {
+        m_newest = e.older;
+    }
+    if (e.older >= 0) {
+        m_entries[e.older].newer = e.newer;
+    } else {
+        m_oldest = e.newer;
+    }
+    e.newer = e.older = -1;
+}
+
+void TextCache::makeNewest(int i) {
+    Entry &e = m_entries[i];
+    e.newer = -1;
+    e.older = m_newest;
+    if (m_newest >= 0) {
+        m_entries[m_newest].newer = i;
+    }
+    m_newest = i;
+    if (m_oldest < 0) {
+        m_oldest = i;
+    }
+}
+
+void TextCache::unchain(int i) {
+    int *link = &m_buckets[m_entries[i].hash & m_mask];
+    while (*link != i) {
+        assert(*link >= 0);
+        link = &m_entries[*link].chain;
+    }
+    *link = m_entries[i].chain;
+    m_entries[i].chain = -1;
+}
+
+const XGlyphInfo &TextCache::extents(Display *d, XftFont *font, const char *text, int length) {
+    unsigned long h = hash(font, text, length);
+    int i;
+
+    for (i = m_buckets[h & m_mask]; i >= 0; i = m_entries[i].chain) {
+        Entry &e = m_entries[i];
+        if (e.hash == h && e.font == font && e.length == length && !memcmp(e.text, text, length)) {
+            if (m_newest != i) {
+                unlink(i);
+                makeNewest(i);
+            }
+            ++m_hits;
+            return e.extents;
+        }
+    }
+
+    ++m_misses;
+
+    // a forgotten entry, a never-used one, or else the oldest
+    if (m_free >= 0) {
+        i = m_free;
+        m_free = m_entries[i].chain;
+    } else if (m_used < m_capacity) {
+        i = m_used++;
+    } else {
+        i = m_oldest;
+        unlink(i);
+        unchain(i);
+    }
+
+    Entry &e = m_entries[i];
+    if (e.size < length) {
+        free(e.text);
+        e.size = length < 32 ? 32 : length;
+        e.text = (char*) malloc(e.size);
+        assert(e.text);
+    }
+    memcpy(e.text, text, length);
+    e.length = length;
+    e.font = font;
+    e.hash = h;
+    XftTextExtentsUtf8(d, font, (FcChar8*) text, length, &e.extents);
+
+    e.chain = m_buckets[h & m_mask];
+    m_buckets[h & m_mask] = i;
+    makeNewest(i);
+
+    return e.extents;
+}
+
+void TextCache::forget(XftFont *font) {
+    for (int i = 0; i < m_used; ++i) {
+        Entry &e = m_entries[i];
+        if (e.font == font) {
+            unlink(i);
+            unchain(i);
+            e.font = 0;
+            e.chain = m_free;
+            m_free = i;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+#include "General.h"
+
+// Remembers XftTextExtentsUtf8 results by (font, string), so that
+// redrawing a menu or reconfiguring a frame doesn't shape the same
+// labels over and over.  Holds a fixed number of entries and drops
+// the least recently used one to make room; entries are chained into
+// hash buckets and an LRU list by index, so a lookup that hits never
+// allocates.  Nothing goes stale unless a font is closed, when forget
+// must be called for it.
+
+class TextCache {
+
+public:
+    TextCache(int capacity);
+    ~TextCache();
+
+    const XGlyphInfo &extents(Display*, XftFont*, const char *text, int length);
+    void forget(XftFont*);
+
+    long hits() const { return m_hits; }
+    long misses() const { return m_misses; }
+
+private:
+    class Entry {
+    public:
+        XftFont *font;
+        unsigned long hash;
+        char *text;       // not NUL-terminated
+        int length;
+        int size;         // allocated for text
+        XGlyphInfo extents;
+        int newer, older; // LRU list, -1 at the ends
+        int chain;        // next in bucket, -1 at the end
+    };
+
+    unsigned long hash(XftFont*, const char*, int) const;
+    void unlink(int);     // from the LRU list
+    void makeNewest(int);
+    void unchain(int);
+
+    Entry *m_entries;
+    int m_capacity;
+    int m_used;           // entries ever filled; the rest are free
+    int *m_buckets;
+    unsigned long m_mask;
+    int m_newest;
+    int m_oldest;
+    int m_free;           // list of forgotten entries, through chain
+
+    long m_hits;
+    long m_misses;
+};
+
+#endif
@@ -0,0 +1,294 @@
+#include "Theme.h"
+#include "Manager.h"
+#include "Border.h"
+
+#ifndef FC_WEIGHT_REGULAR
+#define FC_WEIGHT_REGULAR FC_WEIGHT_MEDIUM
+#endif
+
+Theme::Theme(WindowManager *wm) :
+    m_windowManager(wm),
+    m_display(wm->display()),
+    m_screenCount(wm->screensTotal()),
+    m_tabFont(0),
+    m_menuFont(0)
+{
+    m_screens = (ThemeScreen*) malloc(m_screenCount * sizeof(ThemeScreen));
+    for (int i = 0; i < m_screenCount; ++i) {
+        m_screens[i].initialised = False;
+    }
+}
+
+Theme::~Theme() {
+    for (int i = 0; i < m_draws.count(); ++i) {
+        XftDrawDestroy(m_draws.item(i).draw);
+    }
+    for (int i = 0; i < m_screenCount; ++i) {
+        if (m_screens[i].initialised) {
+            freeColours(i);
+            XFreeGC(m_display, m_screens[i].drawGC);
+            XFreeGC(m_display, m_screens[i].tabGC);
+            XFreeGC(m_display, m_screens[i].menuGC);
+            XFreeGC(m_display, m_screens[i].menuFillGC);
+        }
+    }
+    closeFonts();
+    free(m_screens);
+}
+
+ThemeScreen& Theme::screen(int i) {
+    ThemeScreen &s = m_screens[i];
+    if (s.initialised) {
+        return s;
+    }
+
+    allocateColours(i);
+
+    XGCValues values;
+    Window root = m_windowManager->mroot(i);
+
+    values.foreground = s.tabForeground;
+    values.background = s.tabBackground;
+    values.function = GXcopy;
+    values.line_width = 0;
+    values.subwindow_mode = IncludeInferiors;
+    s.drawGC = XCreateGC(m_display, root, GCForeground | GCBackground | GCFunction | GCLineWidth | GCSubwindowMode, &values);
+    if (!s.drawGC) {
+        m_windowManager->fatal("couldn't allocate border GC");
+    }
+
+    values.foreground = s.tabBackground;
+    values.graphics_exposures = False;
+    s.tabGC = XCreateGC(m_display, root, GCForeground | GCFunction | GCGraphicsExposures, &values);
+    if (!s.tabGC) {
+        m_windowManager->fatal("couldn't allocate tab GC");
+    }
+
+    values.foreground = s.menuForeground ^ s.menuBackground;
+    values.background = s.menuBackground;
+    values.function = GXxor;
+    s.menuGC = XCreateGC(m_display, root, GCForeground | GCBackground | GCFunction | GCLineWidth | GCSubwindowMode, &values);
+
+    values.foreground = s.menuBackground;
+    s.menuFillGC = XCreateGC(m_display, root, GCForeground | GCGraphicsExposures, &values);
+
+    s.initialised = True;
+    return s;
+}
+
+void Theme::allocateColours(int i) {
+    ThemeScreen &s = m_screens[i];
+    WindowManager *wm = m_windowManager;
+
+    s.tabForeground = wm->allocateColour(i, CONFIG_TAB_FOREGROUND, "tab foreground");
+    s.tabBackground = wm->allocateColour(i, CONFIG_TAB_BACKGROUND, "tab background");
+    s.frameBackground = wm->allocateColour(i, CONFIG_FRAME_BACKGROUND, "frame background");
+    s.buttonBackground = wm->allocateColour(i, CONFIG_BUTTON_BACKGROUND, "button background");
+    s.border = wm->allocateColour(i, CONFIG_BORDERS, "border");
+    wm->allocateXftColour(i, CONFIG_TAB_FOREGROUND, &s.tabText);
+
+    s.menuForeground = wm->allocateColour(i, CONFIG_MENU_FOREGROUND, "menu foreground");
+    s.menuBackground = wm->allocateColour(i, CONFIG_MENU_BACKGROUND, "menu background");
+    s.menuBorder = wm->allocateColour(i, CONFIG_MENU_BORDERS, "menu border");
+    wm->allocateXftColour(i, CONFIG_MENU_FOREGROUND, &s.menuText);
+
+    s.tabWidth = tabFont()->height + (CONFIG_TAB_MARGIN * 2);
+    if (s.tabWidth < TAB_TOP_HEIGHT * 2 + 8) {
+        s.tabWidth = TAB_TOP_HEIGHT * 2 + 8;
+    }
+}
+
+void Theme::freeColours(int i) {
+    ThemeScreen &s = m_screens[i];
+    Visual *visual = DefaultVisual(m_display, i);
+    Colormap colormap = DefaultColormap(m_display, i);
+    unsigned long pixels[] = {
+        s.tabForeground, s.tabBackground, s.frameBackground, s.buttonBackground,
+        s.border, s.menuForeground, s.menuBackground, s.menuBorder
+    };
+
+    // a TrueColor colormap holds nothing on our behalf
+    if (visual->c_class != TrueColor) {
+        XFreeColors(m_display, colormap, pixels, sizeof(pixels) / sizeof(pixels[0]), 0);
+    }
+    XftColorFree(m_display, visual, colormap, &s.tabText);
+    XftColorFree(m_display, visual, colormap, &s.menuText);
+}
+
+XftFont* Theme::tabFont() {
+    if (!m_tabFont) {
+        m_tabFont = loadTabFont();
+    }
+    return m_tabFont;
+}
+
+XftFont* Theme::menuFont() {
+    if (!m_menuFont) {
+        m_menuFont = loadMenuFont();
+    }
+    return m_menuFont;
+}
+
+void Theme::closeFonts() {
+    if (m_tabFont) {
+        m_windowManager->textCache().forget(m_tabFont);
+        XftFontClose(m_display, m_tabFont);
+        m_tabFont = 0;
+    }
+    if (m_menuFont) {
+        m_windowManager->textCache().forget(m_menuFont);
+        XftFontClose(m_display, m_menuFont);
+        m_menuFont = 0;
+    }
+}
+
+XftFont* Theme::loadTabFont() {
+    XftFont *font = 0;
+    char *fi = strdup(CONFIG_FRAME_FONT);
+    char *ffi = fi, *tokstr = fi;
+    while ((fi = strtok(tokstr, ","))) {
+
+        // fprintf(stderr, "fi = \"%s\"\n", fi);
+        tokstr = 0;
+        int ascent = 0, height = 0;
+
+        // We have to query the font twice, because ascent and height
+        // are not returned properly when querying with a rotated matrix
+
+        FcPattern *pattern = FcPatternCreate();
+        FcPatternAddString(pattern, FC_FAMILY, (FcChar8*) fi);
+        FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
+        FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_DEMIBOLD);
+        FcPatternAddInteger(pattern, FC_PIXEL_SIZE, CONFIG_FRAME_FONT_SIZE);
+        FcConfigSubstitute(FcConfigGetCurrent(), pattern, FcMatchPattern);
+
+        FcResult result = FcResultMatch;
+        FcPattern *match = FcFontMatch(FcConfigGetCurrent(), pattern, &result);
+
+        if (!match || result != FcResultMatch) {
+            FcPatternDestroy(pattern);
+            if (match) {
+                FcPatternDestroy(match);
+            }
+            continue;
+        }
+
+        XftFont *refFont = XftFontOpenPattern(m_display, match);
+        if (!refFont) {
+            FcPatternDestroy(pattern);
+            FcPatternDestroy(match);
+            continue;
+        }
+
+        ascent = refFont->ascent;
+        height = refFont->height;
+        // fprintf(stderr, "tab font ascent=%d, height=%d\n", ascent, height);
+
+        XftFontClose(m_display, refFont);
+
+        FcMatrix matrix;
+        FcMatrixInit(&matrix);
+        FcMatrixRotate(&matrix, 0, 1);
+        FcPatternAddMatrix(pattern, FC_MATRIX, &matrix);
+
+        result = FcResultMatch;
+        match = FcFontMatch(FcConfigGetCurrent(), pattern, &result);
+
+        FcPatternDestroy(pattern);
+
+        if (!match || result != FcResultMatch) {
+            if (match) {
+                FcPatternDestroy(match);
+            }
+            continue;
+        }
+
+        font = XftFontOpenPattern(m_display, match);
+        // fprintf(stderr, "tab font ascent = %d\n", font->ascent);
+        if (!font) {
+            FcPatternDestroy(match);
+        } else {
+            font->ascent = ascent;
+            font->height = height;
+            break;
+        }
+    }
+
+    free(ffi);
+
+    if (!font) {
+        m_windowManager->fatal("couldn't load default rotated Xft font, bailing out");
+    }
+    return font;
+}
+
+XftFont* Theme::loadMenuFont() {
+    XftFont *font = 0;
+    char *fi = strdup(CONFIG_MENU_FONT);
+    char *ffi = fi, *tokstr = fi;
+
+    while ((fi = strtok(tokstr, ","))) {
+        // fprintf(stderr, "fi = \"%s\"\n", fi);
+        tokstr = 0;
+
+        FcPattern *pattern = FcPatternCreate();
+        FcPatternAddString(pattern, FC_FAMILY, (FcChar8*) fi);
+        FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
+        FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_REGULAR);
+        FcPatternAddInteger(pattern, FC_PIXEL_SIZE, CONFIG_MENU_FONT_SIZE);
+        FcConfigSubstitute(FcConfigGetCurrent(), pattern, FcMatchPattern);
+
+        FcResult result = FcResultMatch;
+        FcPattern *match = FcFontMatch(FcConfigGetCurrent(), pattern, &result);
+        FcPatternDestroy(pattern);
+
+        if (!match || result != FcResultMatch) {
+            if (match) {
+                FcPatternDestroy(match);
+            }
+            continue;
+        }
+
+        font = XftFontOpenPattern(m_display, match);
+        if (font) {
+            break;
+        }
+        FcPatternDestroy(match);
+    }
+    free(ffi);
+
+    if (!font) {
+        m_windowManager->fatal("couldn't load menu Xft font");
+    }
+    return font;
+}
+
+XftDraw* Theme::acquireDraw(int screen, Drawable d) {
+    for (int i = 0; i < m_draws.count(); ++i) {
+        DrawEntry &e = m_draws.item(i);
+        if (e.drawable == d) {
+            ++e.references;
+            return e.draw;
+        }
+    }
+
+    DrawEntry e;
+    e.drawable = d;
+    e.draw = XftDrawCreate(m_display, d, DefaultVisual(m_display, screen), DefaultColormap(m_display, screen));
+    e.references = 1;
+    m_draws.append(e);
+    return e.draw;
+}
+
+void Theme::releaseDraw(Drawable d) {
+    for (int i = 0; i < m_draws.count(); ++i) {
+        DrawEntry &e = m_draws.item(i);
+        if (e.drawable == d) {
+            if (--e.references == 0) {
+                XftDrawDestroy(e.draw);
+                m_draws.swap_remove(i);
+            }
+            return;
+        }
+    }
+}
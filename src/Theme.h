@@ -0,0 +1,79 @@
+#ifndef _THEME_H_
+#define _THEME_H_
+
+#include "General.h"
+#include "List.h"
+
+class WindowManager;
+
+// The colours, GCs and fonts for frames, menus and the geometry
+// display, one set per screen, made the first time the screen is
+// asked for.  They all come from Config.h, so they last as long as
+// the manager does.
+
+class ThemeScreen {
+public:
+    Boolean initialised;
+
+    unsigned long tabForeground;
+    unsigned long tabBackground;
+    unsigned long frameBackground;
+    unsigned long buttonBackground;
+    unsigned long border;
+    XftColor tabText;
+    int tabWidth; // depends on the tab font
+
+    GC drawGC;  // tab foreground
+    GC tabGC;   // fills with the tab background
+
+    unsigned long menuForeground;
+    unsigned long menuBackground;
+    unsigned long menuBorder;
+    XftColor menuText;
+
+    GC menuGC;      // xors, for the menu highlight
+    GC menuFillGC;  // fills with the menu background
+};
+
+class Theme {
+
+public:
+    Theme(WindowManager*);
+    ~Theme();
+
+    ThemeScreen& screen(int);
+
+    XftFont* tabFont();  // rotated
+    XftFont* menuFont();
+
+    // XftDraws are shared by everything drawing on one drawable, and
+    // destroyed when the last of them lets go
+    XftDraw* acquireDraw(int screen, Drawable);
+    void releaseDraw(Drawable);
+
+private:
+    WindowManager *m_windowManager;
+    Display *m_display;
+
+    ThemeScreen *m_screens;
+    int m_screenCount;
+
+    XftFont *m_tabFont;
+    XftFont *m_menuFont;
+    XftFont* loadTabFont();
+    XftFont* loadMenuFont();
+    void closeFonts();
+
+    void allocateColours(int);
+    void freeColours(int);
+
+    class DrawEntry {
+    public:
+        Drawable drawable;
+        XftDraw *draw;
+        int references;
+    };
+    List<DrawEntry> m_draws;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "WindowMap.h"
+
+#include <string.h>
+
+#define WINDOWMAP_INITIAL_SIZE 64
+
+WindowMap::WindowMap() :
+    m_entries(0),
+    m_mask(WINDOWMAP_INITIAL_SIZE - 1),
+    m_count(0)
+{
+    m_entries = (Entry*) calloc(WINDOWMAP_INITIAL_SIZE, sizeof(Entry));
+    assert(m_entries);
+}
+
+WindowMap::~WindowMap() {
+    free((void*) m_entries);
+}
+
+Client* WindowMap::find(Window w) const {
+    if (w == None) {
+        return 0;
+    }
+    for (unsigned long i = slot(w); m_entries[i].window != None; i = (i + 1) & m_mask) {
+        if (m_entries[i].window == w) {
+            return m_entries[i].client;
+        }
+    }
+    return 0;
+}
+
+void WindowMap::insert(Window w, Client *c) {
+    if (w == None) {
+        return;
+    }
+    // keep the load factor under a half so probe runs stay short
+    if ((unsigned long) (m_count + 1) * 2 > m_mask + 1) {
+        grow();
+    }
+    unsigned long i;
+    for (i = slot(w); m_entries[i].window != None; i = (i + 1) & m_mask) {
+        if (m_entries[i].window == w) {
+            m_entries[i].client = c;
+            return;
+        }
+    }
+    m_entries[i].window = w;
+    m_entries[i].client = c;
+    ++m_count;
+}
+
+void WindowMap::remove(Window w, Client *c) {
+    if (w == None) {
+        return;
+    }
+    unsigned long i;
+    for (i = slot(w); m_entries[i].window != w; i = (i + 1) & m_mask) {
+        if (m_entries[i].window == None) {
+            return;
+        }
+    }
+    if (m_entries[i].client != c) {
+        return;
+    }
+
+    // backward-shift deletion: pull later members of the probe run
+    // into the hole unless that would move them before their home slot
+    unsigned long hole = i;
+    for (unsigned long j = (i + 1) & m_mask; m_entries[j].window != None; j = (j + 1) & m_mask) {
+        unsigned long home = slot(m_entries[j].window);
+        if (((j - home) & m_mask) >= ((j - hole) & m_mask)) {
+            m_entries[hole] = m_entries[j];
+            hole = j;
+        }
+    }
+    m_entries[hole].window = None;
+    m_entries[hole].client = 0;
+    --m_count;
+}
+
+void WindowMap::grow() {
+    Entry *old = m_entries;
+    unsigned long oldSize = m_mask + 1;
+
+    m_mask = oldSize * 2 - 1;
+    m_entries = (Entry*) calloc(oldSize * 2, sizeof(Entry));
+    assert(m_entries);
+    m_count = 0;
+
+    for (unsigned long i = 0; i < oldSize; ++i) {
+        if (old[i].window != None) {
+            insert(old[i].window, old[i].client);
+        }
+    }
+    free((void*) old);
+}
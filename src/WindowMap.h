@@ -0,0 +1,46 @@
+#ifndef _WINDOWMAP_H_
+#define _WINDOWMAP_H_
+
+#include "General.h"
+
+class Client;
+
+// Hash index from X window id to the client that owns or manages the
+// window.  Open addressing with linear probing; removal shifts the
+// following entries back, so there are no tombstones to clean up.
+
+class WindowMap {
+
+public:
+    WindowMap();
+    ~WindowMap();
+
+    Client *find(Window w) const;
+
+    void insert(Window w, Client *c); // replaces any existing entry
+    void remove(Window w, Client *c); // only if w currently maps to c
+
+    long count() const { return m_count; }
+
+private:
+    class Entry {
+    public:
+        Window window;
+        Client *client;
+    };
+
+    unsigned long slot(Window w) const {
+        // XIDs are resource-base | counter, so mix the high bits down
+        unsigned long h = w ^ (w >> 16);
+        h *= 0x45d9f3bUL;
+        return (h ^ (h >> 16)) & m_mask;
+    }
+
+    void grow();
+
+    Entry *m_entries;
+    unsigned long m_mask;
+    long m_count;
+};
+
+#endif
@@ -0,0 +1,873 @@
+// Synthetic client for benchmarking wmx.  Creates a number of
+// windows, works the window manager through a set of phases, and
+// prints one JSON object per line for each measurement:
+//
+//   {"windows":100,"phase":"map","metric":"map_to_frame_us","mean":...}
+//
+// Run by run-bench.sh, which starts Xvfb and wmx and passes wmx's
+// pid so that its CPU time and RSS can be read from /proc around
+// each phase.  Needs the XTest extension for the pointer drags.
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#include "WindowMap.h"
+#include "List.h"
+
+long ListStats::allocations = 0;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+
+static Display *display;
+static int windowCount = 10;
+static int wmPid = 0;
+static KeySym altKey = XK_Super_L;
+static KeySym menuKey = XK_Super_R;
+static int timeoutMs = 5000;
+
+static long long now() { // microseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Wait for an event on window w of the given type, optionally only a
+// synthetic one; anything else that arrives meanwhile is dropped.
+// Returns False on timeout.
+
+static Bool waitFor(Window w, int type, Bool synthetic, XEvent *ev) {
+    long long deadline = now() + timeoutMs * 1000LL;
+    for (;;) {
+        while (XPending(display)) {
+            XNextEvent(display, ev);
+            if (ev->type == type && ev->xany.window == w && (!synthetic || ev->xany.send_event)) {
+                return True;
+            }
+        }
+        long long left = deadline - now();
+        if (left <= 0) {
+            return False;
+        }
+        struct pollfd pfd;
+        pfd.fd = ConnectionNumber(display);
+        pfd.events = POLLIN;
+        poll(&pfd, 1, (int) (left / 1000) + 1);
+    }
+}
+
+static void drain() {
+    XEvent ev;
+    XSync(display, False);
+    while (XPending(display)) {
+        XNextEvent(display, &ev);
+    }
+}
+
+// --- wmx's own usage, from /proc
+
+class Usage {
+public:
+    Usage() : cpuMs(0), rssKb(0) { }
+    void sample();
+    double cpuMs;
+    long rssKb;
+};
+
+void Usage::sample() {
+    if (!wmPid) {
+        return;
+    }
+    char path[64], buffer[1024];
+    FILE *f;
+
+    sprintf(path, "/proc/%d/stat", wmPid);
+    if ((f = fopen(path, "r"))) {
+        if (fgets(buffer, sizeof(buffer), f)) {
+            // skip past the command name, which may contain spaces
+            char *p = strrchr(buffer, ')');
+            unsigned long utime = 0, stime = 0;
+            if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                            &utime, &stime) == 2) {
+                cpuMs = (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+            }
+        }
+        fclose(f);
+    }
+
+    sprintf(path, "/proc/%d/status", wmPid);
+    if ((f = fopen(path, "r"))) {
+        while (fgets(buffer, sizeof(buffer), f)) {
+            if (!strncmp(buffer, "VmRSS:", 6)) {
+                rssKb = atol(buffer + 6);
+            }
+        }
+        fclose(f);
+    }
+}
+
+// --- reporting
+
+static int compareLongLong(const void *a, const void *b) {
+    long long x = *(const long long*) a, y = *(const long long*) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void reportSamples(const char *phase, const char *metric, long long *samples, int n) {
+    if (n == 0) {
+        printf("{\"windows\":%d,\"phase\":\"%s\",\"metric\":\"%s\",\"count\":0}\n",
+               windowCount, phase, metric);
+        return;
+    }
+    qsort(samples, n, sizeof(long long), compareLongLong);
+    long long total = 0;
+    for (int i = 0; i < n; ++i) {
+        total += samples[i];
+    }
+    printf("{\"windows\":%d,\"phase\":\"%s\",\"metric\":\"%s\",\"count\":%d,"
+           "\"mean\":%.1f,\"p50\":%lld,\"p95\":%lld,\"max\":%lld}\n",
+           windowCount, phase, metric, n, (double) total / n,
+           samples[n / 2], samples[(n * 95) / 100], samples[n - 1]);
+}
+
+static void reportRate(const char *phase, const char *metric, int count, long long micros) {
+    printf("{\"windows\":%d,\"phase\":\"%s\",\"metric\":\"%s\",\"count\":%d,\"per_second\":%.1f}\n",
+           windowCount, phase, metric, count, micros > 0 ? count * 1000000.0 / micros : 0.0);
+}
+
+static void reportCount(const char *phase, const char *metric, long count, long long micros) {
+    printf("{\"windows\":%d,\"phase\":\"%s\",\"metric\":\"%s\",\"count\":%ld,\"us\":%lld}\n",
+           windowCount, phase, metric, count, micros);
+}
+
+static void reportUsage(const char *phase, const Usage &before, const Usage &after, long long micros) {
+    if (!wmPid) {
+        return;
+    }
+    printf("{\"windows\":%d,\"phase\":\"%s\",\"metric\":\"wm_usage\",\"wall_ms\":%.1f,"
+           "\"cpu_ms\":%.1f,\"rss_kb\":%ld}\n",
+           windowCount, phase, micros / 1000.0, after.cpuMs - before.cpuMs, after.rssKb);
+}
+
+static int timeouts = 0;
+
+static void timedOut(const char *phase, Window w) {
+    if (timeouts++ < 10) {
+        fprintf(stderr, "wmxbench: %s: timed out waiting on window 0x%lx\n", phase, w);
+    }
+}
+
+// --- the phases
+
+static Window *windows;
+static Window *frames;
+
+static void mapPhase() {
+    long long *samples = new long long[windowCount];
+    long long *visible = new long long[windowCount];
+    int n = 0, v = 0;
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int i = 0; i < windowCount; ++i) {
+        XSetWindowAttributes attr;
+        attr.event_mask = StructureNotifyMask | PropertyChangeMask;
+        attr.background_pixel = WhitePixel(display, DefaultScreen(display));
+        int x = (i * 37) % 600, y = (i * 23) % 400;
+        windows[i] = XCreateWindow(display, DefaultRootWindow(display), x, y, 200, 120, 0,
+                                   CopyFromParent, InputOutput, CopyFromParent,
+                                   CWEventMask | CWBackPixel, &attr);
+        char name[32];
+        sprintf(name, "bench %d", i);
+        XStoreName(display, windows[i], name);
+
+        long long mapped = now();
+        XMapWindow(display, windows[i]);
+        XFlush(display);
+
+        XEvent ev;
+        frames[i] = None;
+        if (waitFor(windows[i], ReparentNotify, False, &ev)) {
+            samples[n++] = now() - mapped;
+            frames[i] = ev.xreparent.parent;
+            XSelectInput(display, frames[i], StructureNotifyMask);
+        } else {
+            timedOut("map", windows[i]);
+        }
+        // reparenting comes after manage has read the properties;
+        // the map of the window itself once its frame is up
+        if (waitFor(windows[i], MapNotify, False, &ev)) {
+            visible[v++] = now() - mapped;
+        } else {
+            timedOut("map", windows[i]);
+        }
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportSamples("map", "map_to_frame_us", samples, n);
+    reportSamples("map", "map_to_visible_us", visible, v);
+    reportUsage("map", before, after, elapsed);
+    delete[] samples;
+    delete[] visible;
+}
+
+// Everything wmx was sent before this has been dealt with once it
+// answers a configure request, as it handles events in order
+
+static void fence(Window w) {
+    XEvent ev;
+    XRaiseWindow(display, w);
+    XFlush(display);
+    if (!waitFor(w, ConfigureNotify, True, &ev)) {
+        timedOut("fence", w);
+    }
+}
+
+static void titlePhase() {
+    const int rounds = 10;
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < windowCount; ++i) {
+            char name[64];
+            sprintf(name, "bench %d, title %d", i, r);
+            XStoreName(display, windows[i], name);
+        }
+        fence(windows[0]);
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportRate("titles", "title_updates", rounds * windowCount, elapsed);
+    reportUsage("titles", before, after, elapsed);
+    drain();
+}
+
+static void restackPhase() {
+    const int count = windowCount < 500 ? 500 : windowCount;
+    long long *samples = new long long[count];
+    int n = 0;
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int k = 0; k < count; ++k) {
+        Window w = windows[(k * 7919) % windowCount];
+        long long sent = now();
+        if (k % 2) {
+            XLowerWindow(display, w);
+        } else {
+            XRaiseWindow(display, w);
+        }
+        XFlush(display);
+        XEvent ev;
+        if (waitFor(w, ConfigureNotify, True, &ev)) {
+            samples[n++] = now() - sent;
+        } else {
+            timedOut("restack", w);
+        }
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportRate("restack", "restacks", n, elapsed);
+    reportSamples("restack", "restack_us", samples, n);
+    reportUsage("restack", before, after, elapsed);
+    delete[] samples;
+    drain();
+}
+
+static void configurePhase() {
+    const int count = windowCount < 500 ? 500 : windowCount;
+    long long *samples = new long long[count];
+    int n = 0;
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int k = 0; k < count; ++k) {
+        Window w = windows[(k * 104729) % windowCount];
+        long long sent = now();
+        XMoveResizeWindow(display, w, 20 + (k * 13) % 500, 20 + (k * 17) % 300,
+                          150 + (k * 11) % 200, 100 + (k * 7) % 150);
+        XFlush(display);
+        XEvent ev;
+        if (waitFor(w, ConfigureNotify, True, &ev)) {
+            samples[n++] = now() - sent;
+        } else {
+            timedOut("configure", w);
+        }
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportRate("configure", "configures", n, elapsed);
+    reportSamples("configure", "configure_us", samples, n);
+    reportUsage("configure", before, after, elapsed);
+    delete[] samples;
+    drain();
+}
+
+static void mapStormPhase() {
+    const int count = windowCount < 200 ? 200 : windowCount;
+    long long *samples = new long long[count];
+    int n = 0;
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int k = 0; k < count; ++k) {
+        Window w = windows[(k * 31) % windowCount];
+        XEvent ev;
+
+        // withdraw as ICCCM asks, then map again
+        XUnmapWindow(display, w);
+        ev.xunmap.type = UnmapNotify;
+        ev.xunmap.event = DefaultRootWindow(display);
+        ev.xunmap.window = w;
+        ev.xunmap.from_configure = False;
+        XSendEvent(display, DefaultRootWindow(display), False,
+                   SubstructureRedirectMask | SubstructureNotifyMask, &ev);
+        XFlush(display);
+        if (!waitFor(w, UnmapNotify, False, &ev)) {
+            timedOut("mapstorm", w);
+            continue;
+        }
+
+        long long sent = now();
+        XMapWindow(display, w);
+        XFlush(display);
+        if (waitFor(w, MapNotify, False, &ev)) {
+            samples[n++] = now() - sent;
+        } else {
+            timedOut("mapstorm", w);
+        }
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportRate("mapstorm", "map_unmap_cycles", n, elapsed);
+    reportSamples("mapstorm", "remap_us", samples, n);
+    reportUsage("mapstorm", before, after, elapsed);
+    delete[] samples;
+    drain();
+}
+
+// Map a few hundred extra windows, then destroy them all at once, as
+// when a test run's windows exit together, and time how long wmx
+// takes to catch up
+
+static void destroyStormPhase() {
+    const int count = windowCount < 300 ? 300 : windowCount;
+    Window *burst = new Window[count];
+    int n = 0;
+
+    for (int i = 0; i < count; ++i) {
+        XSetWindowAttributes attr;
+        attr.event_mask = StructureNotifyMask;
+        burst[n] = XCreateWindow(display, DefaultRootWindow(display), (i * 41) % 600, (i * 29) % 400,
+                                 120, 80, 0, CopyFromParent, InputOutput, CopyFromParent,
+                                 CWEventMask, &attr);
+        XMapWindow(display, burst[n]);
+        XFlush(display);
+        XEvent ev;
+        if (waitFor(burst[n], MapNotify, False, &ev)) {
+            ++n;
+        } else {
+            timedOut("destroystorm", burst[n]);
+            XDestroyWindow(display, burst[n]);
+        }
+    }
+    drain();
+
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int i = 0; i < n; ++i) {
+        XDestroyWindow(display, burst[i]);
+    }
+    XFlush(display);
+    fence(windows[0]);
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportRate("destroystorm", "destroys", n, elapsed);
+    reportUsage("destroystorm", before, after, elapsed);
+    delete[] burst;
+    drain();
+}
+
+// Alt-drag a window about with XTest for five seconds, a pointer step
+// every millisecond, and time each move of its frame from the motion
+// it followed.  wmx moves the frame by as much as the pointer has
+// moved, so the frame's offset says which step it's answering; the
+// latest step with that offset is taken to be the one.  Moves that
+// match no step (snapped to an edge, say) aren't timed.
+
+static void dragPhase() {
+    int event, error, major, minor;
+    if (!XTestQueryExtension(display, &event, &error, &major, &minor)) {
+        fprintf(stderr, "wmxbench: no XTest extension, skipping drags\n");
+        return;
+    }
+
+    const long long duration = 5000000LL, step = 1000;
+    const int maxSteps = (int) (duration / step) + 1;
+    Window w = windows[0];
+    Window frame = frames[0];
+    if (frame == None) {
+        return;
+    }
+
+    int *stepX = new int[maxSteps];
+    int *stepY = new int[maxSteps];
+    long long *stepAt = new long long[maxSteps];
+    long long *samples = new long long[maxSteps];
+    int steps = 0, n = 0, frameMoves = 0;
+    KeyCode alt = XKeysymToKeycode(display, altKey);
+    fence(w);
+
+    Window root, child;
+    int x, y, fx, fy;
+    unsigned int width, height, border, depth;
+    XGetGeometry(display, frame, &root, &fx, &fy, &width, &height, &border, &depth);
+    XGetGeometry(display, w, &root, &x, &y, &width, &height, &border, &depth);
+    XTranslateCoordinates(display, w, root, width / 2, height / 2, &x, &y, &child);
+
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    XTestFakeMotionEvent(display, -1, x, y, 0);
+    XTestFakeKeyEvent(display, alt, True, 0);
+    XTestFakeButtonEvent(display, 1, True, 0);
+    XFlush(display);
+
+    long long next = now(), t;
+    while ((t = now()) - start < duration) {
+        if (t >= next && steps < maxSteps) {
+            // back and forth along a diagonal, 100 pixels each way
+            int phase = steps % 200;
+            stepX[steps] = phase < 100 ? phase : 200 - phase;
+            stepY[steps] = stepX[steps] / 2;
+            stepAt[steps] = t;
+            XTestFakeMotionEvent(display, -1, x + stepX[steps], y + stepY[steps], 0);
+            XFlush(display);
+            ++steps;
+            next += step;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = ConnectionNumber(display);
+        pfd.events = POLLIN;
+        long long wait = next - now();
+        poll(&pfd, 1, wait > 0 ? (int) ((wait + 999) / 1000) : 0);
+
+        while (XPending(display)) {
+            XEvent ev;
+            XNextEvent(display, &ev);
+            if (ev.type != ConfigureNotify || ev.xconfigure.window != frame) {
+                continue;
+            }
+            long long arrived = now();
+            ++frameMoves;
+            int dx = ev.xconfigure.x - fx, dy = ev.xconfigure.y - fy;
+            for (int i = steps - 1; i >= 0 && i >= steps - 200; --i) {
+                if (stepX[i] == dx && stepY[i] == dy) {
+                    samples[n++] = arrived - stepAt[i];
+                    break;
+                }
+            }
+        }
+    }
+
+    XTestFakeButtonEvent(display, 1, False, 0);
+    XTestFakeKeyEvent(display, alt, False, 0);
+    XFlush(display);
+    fence(w);
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportSamples("drag", "input_to_configure_us", samples, n);
+    reportRate("drag", "frame_updates", frameMoves, elapsed);
+    reportUsage("drag", before, after, elapsed);
+    delete[] stepX;
+    delete[] stepY;
+    delete[] stepAt;
+    delete[] samples;
+    drain();
+}
+
+// Start a command from the keyboard command menu, and time how long
+// wmx takes to get back to its event loop: from the select key going
+// in to the answer to a raise sent straight after it.  The menu is up
+// once wmx's keyboard grab takes the focus from our window.
+// run-bench.sh points WMXDIR at a directory holding a single command
+// that exits at once.
+
+static void launchPhase() {
+    int event, error, major, minor;
+    if (!XTestQueryExtension(display, &event, &error, &major, &minor)) {
+        fprintf(stderr, "wmxbench: no XTest extension, skipping launches\n");
+        return;
+    }
+
+    const int launches = 50;
+    long long *samples = new long long[launches];
+    int n = 0;
+    KeyCode alt = XKeysymToKeycode(display, altKey);
+    KeyCode menu = XKeysymToKeycode(display, menuKey);
+    KeyCode select = XKeysymToKeycode(display, XK_Return);
+    Window w = windows[0];
+    XSelectInput(display, w, StructureNotifyMask | PropertyChangeMask | FocusChangeMask);
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int k = 0; k < launches; ++k) {
+        XSetInputFocus(display, w, RevertToPointerRoot, CurrentTime);
+        fence(w);
+
+        XTestFakeKeyEvent(display, alt, True, 0);
+        XTestFakeKeyEvent(display, menu, True, 0);
+        XTestFakeKeyEvent(display, menu, False, 0);
+        XTestFakeKeyEvent(display, alt, False, 0);
+        XFlush(display);
+
+        XEvent ev;
+        Bool up;
+        while ((up = waitFor(w, FocusOut, False, &ev)) && ev.xfocus.mode != NotifyGrab);
+        if (!up) {
+            timedOut("launch", w);
+            continue;
+        }
+
+        long long sent = now();
+        XTestFakeKeyEvent(display, select, True, 0);
+        XTestFakeKeyEvent(display, select, False, 0);
+        XRaiseWindow(display, w);
+        XFlush(display);
+        if (waitFor(w, ConfigureNotify, True, &ev)) {
+            samples[n++] = now() - sent;
+        } else {
+            timedOut("launch", w);
+        }
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportSamples("launch", "launch_to_return_us", samples, n);
+    reportUsage("launch", before, after, elapsed);
+    delete[] samples;
+    drain();
+}
+
+// Alt-Tab past several windows and let go, counting how many frames
+// (other than the one used for the fence) were restacked on the way,
+// and timing the release to the fence's answer
+
+static void switchPhase() {
+    int event, error, major, minor;
+    if (!XTestQueryExtension(display, &event, &error, &major, &minor)) {
+        fprintf(stderr, "wmxbench: no XTest extension, skipping switches\n");
+        return;
+    }
+    if (windowCount < 2) {
+        return;
+    }
+
+    const int switches = 20;
+    const int tabs = windowCount - 1 < 20 ? windowCount - 1 : 20;
+    long long *samples = new long long[switches];
+    int n = 0, restacks = 0;
+    KeyCode alt = XKeysymToKeycode(display, altKey);
+    KeyCode tab = XKeysymToKeycode(display, XK_Tab);
+    Window w = windows[0];
+    Usage before, after;
+    before.sample();
+    long long start = now();
+
+    for (int k = 0; k < switches; ++k) {
+        XSetInputFocus(display, w, RevertToPointerRoot, CurrentTime);
+        fence(w);
+
+        XTestFakeKeyEvent(display, alt, True, 0);
+        for (int t = 0; t < tabs; ++t) {
+            XTestFakeKeyEvent(display, tab, True, 0);
+            XTestFakeKeyEvent(display, tab, False, 0);
+        }
+        XFlush(display);
+        usleep(20000);
+
+        long long released = now();
+        XTestFakeKeyEvent(display, alt, False, 0);
+        XRaiseWindow(display, w);
+        XFlush(display);
+
+        long long deadline = now() + timeoutMs * 1000LL;
+        Bool answered = False;
+        while (!answered && now() < deadline) {
+            XEvent ev;
+            if (!XPending(display)) {
+                struct pollfd pfd;
+                pfd.fd = ConnectionNumber(display);
+                pfd.events = POLLIN;
+                poll(&pfd, 1, 10);
+                continue;
+            }
+            XNextEvent(display, &ev);
+            if (ev.type != ConfigureNotify) {
+                continue;
+            }
+            if (ev.xconfigure.window == w && ev.xany.send_event) {
+                samples[n++] = now() - released;
+                answered = True;
+            } else if (ev.xconfigure.window != frames[0]) {
+                for (int i = 1; i < windowCount; ++i) {
+                    if (ev.xconfigure.window == frames[i]) {
+                        ++restacks;
+                        break;
+                    }
+                }
+            }
+        }
+        if (!answered) {
+            timedOut("switch", w);
+        }
+    }
+
+    long long elapsed = now() - start;
+    after.sample();
+    reportRate("switch", "frame_restacks", restacks, elapsed);
+    reportSamples("switch", "release_to_return_us", samples, n);
+    reportUsage("switch", before, after, elapsed);
+    delete[] samples;
+    drain();
+}
+
+// Not wmx at all: its window-to-client index on its own, against the
+// scan of every client that it replaced, with as many clients as
+// there are windows in the run.  Each client has six windows, as a
+// framed one does, numbered the way a server numbers them.
+
+static const int windowsPerClient = 6; // client, frame, tab, button, resize, feedback
+
+class ScannedClient {
+public:
+    Window windows[windowsPerClient];
+};
+
+static Client* scan(ScannedClient *clients, int count, Window w) {
+    for (int i = 0; i < count; ++i) {
+        for (int j = 0; j < windowsPerClient; ++j) {
+            if (clients[i].windows[j] == w) {
+                return (Client*) &clients[i];
+            }
+        }
+    }
+    return 0;
+}
+
+static void lookupPhase() {
+    const int n = windowCount * windowsPerClient;
+    const int lookups = 1000000;
+    ScannedClient *clients = new ScannedClient[windowCount];
+    Window *ids = new Window[n];
+    WindowMap map;
+    volatile long found = 0;
+    int i, k;
+
+    for (i = 0; i < n; ++i) {
+        // two clients' worth of resource bases, as for the client
+        // windows and wmx's own
+        ids[i] = ((i % windowsPerClient) ? 0x1200000 : 0x3400000) + i;
+        clients[i / windowsPerClient].windows[i % windowsPerClient] = ids[i];
+        map.insert(ids[i], (Client*) &clients[i / windowsPerClient]);
+    }
+
+    long long start = now();
+    for (k = 0; k < lookups; ++k) {
+        found += map.find(ids[(long) k * 7919 % n]) != 0;
+    }
+    reportRate("lookup", "hashed_hits", lookups, now() - start);
+
+    start = now();
+    for (k = 0; k < lookups; ++k) {
+        found += map.find(0x5600000 + k) != 0; // windows that aren't ours
+    }
+    reportRate("lookup", "hashed_misses", lookups, now() - start);
+
+    // the scan is so much slower that fewer rounds do
+    const int scans = lookups / windowCount;
+    start = now();
+    for (k = 0; k < scans; ++k) {
+        found += scan(clients, windowCount, ids[(long) k * 7919 % n]) != 0;
+    }
+    reportRate("lookup", "scanned_hits", scans, now() - start);
+
+    start = now();
+    for (k = 0; k < scans; ++k) {
+        found += scan(clients, windowCount, 0x5600000 + k) != 0;
+    }
+    reportRate("lookup", "scanned_misses", scans, now() - start);
+
+    delete[] clients;
+    delete[] ids;
+}
+
+// Also not wmx: the lists it fills and empties most, replayed through
+// List and through the listmacro.h list it replaced, which resized its
+// block on every append and every remove.  For each client, as when
+// each is configured once: the rectangles of its frame shape, the
+// NETWM client list, and the edges that snapping looks through.
+
+static long oldAllocations = 0;
+
+template <class T>
+class OldList {
+public:
+    OldList() : m_items(0), m_count(0) { }
+    ~OldList() { remove_all(); }
+
+    long count() const { return m_count; }
+
+    void append(const T &item) {
+        m_items = (T*) realloc(m_items, (m_count + 1) * sizeof(T));
+        ++oldAllocations;
+        m_items[m_count++] = item;
+    }
+    void remove(long index) {
+        memmove(m_items + index, m_items + index + 1, (m_count - index - 1) * sizeof(T));
+        if (m_count == 1) {
+            free(m_items);
+            m_items = 0;
+        } else {
+            m_items = (T*) realloc(m_items, (m_count - 1) * sizeof(T));
+            ++oldAllocations;
+        }
+        --m_count;
+    }
+    void remove_all() {
+        while (m_count > 0) {
+            remove(0);
+        }
+    }
+
+private:
+    T *m_items;
+    long m_count;
+};
+
+class Rect {
+public:
+    short x, y;
+    unsigned short width, height;
+};
+
+template <class RectList, class WindowList>
+static void replayLists(RectList &shape, WindowList &clients, RectList &edges) {
+    Rect r = { 0, 0, 10, 10 };
+    for (int c = 0; c < windowCount; ++c) {
+        for (int i = 0; i < 10; ++i) {
+            shape.append(r);
+        }
+        shape.remove_all();
+
+        for (int i = 0; i < windowCount; ++i) {
+            clients.append((Window) i);
+        }
+        clients.remove_all();
+
+        for (int i = 0; i < windowCount * 4 && i < 400; ++i) {
+            edges.append(r);
+        }
+        edges.remove_all();
+    }
+}
+
+static void listPhase() {
+    long long start = now();
+    {
+        OldList<Rect> shape, edges;
+        OldList<Window> clients;
+        replayLists(shape, clients, edges);
+    }
+    reportCount("lists", "listmacro_allocations", oldAllocations, now() - start);
+
+    long before = ListStats::allocations;
+    start = now();
+    {
+        List<Rect> shape, edges;
+        List<Window> clients;
+        replayLists(shape, clients, edges);
+    }
+    reportCount("lists", "list_allocations", ListStats::allocations - before, now() - start);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n windows] [-p wm-pid] [-k alt-keysym] [-m menu-keysym] [-t timeout-ms]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    while ((c = getopt(argc, argv, "n:p:k:m:t:")) != -1) {
+        switch (c) {
+          case 'n': windowCount = atoi(optarg); break;
+          case 'p': wmPid = atoi(optarg); break;
+          case 'k': altKey = XStringToKeysym(optarg); break;
+          case 'm': menuKey = XStringToKeysym(optarg); break;
+          case 't': timeoutMs = atoi(optarg); break;
+          default: usage(argv[0]);
+        }
+    }
+    if (windowCount < 1 || altKey == NoSymbol || menuKey == NoSymbol) {
+        usage(argv[0]);
+    }
+
+    // these need no server
+    lookupPhase();
+    listPhase();
+
+    if (!(display = XOpenDisplay(NULL))) {
+        fprintf(stderr, "wmxbench: can't open display\n");
+        return 1;
+    }
+
+    windows = new Window[windowCount];
+    frames = new Window[windowCount];
+
+    mapPhase();
+    titlePhase();
+    restackPhase();
+    configurePhase();
+    mapStormPhase();
+    destroyStormPhase();
+    dragPhase();
+    launchPhase();
+    switchPhase();
+
+    Usage final;
+    final.sample();
+    if (wmPid) {
+        printf("{\"windows\":%d,\"phase\":\"total\",\"metric\":\"wm_usage\",\"cpu_ms\":%.1f,\"rss_kb\":%ld,\"timeouts\":%d}\n",
+               windowCount, final.cpuMs, final.rssKb, timeouts);
+    }
+
+    for (int i = 0; i < windowCount; ++i) {
+        XDestroyWindow(display, windows[i]);
+    }
+    XCloseDisplay(display);
+    return timeouts ? 1 : 0;
+}
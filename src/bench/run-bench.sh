@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Start Xvfb, run wmx on it, and drive it with wmxbench at each of
+# the window counts given (10, 100 and 1000 by default).  Results go
+# to stdout as JSON lines, one per measurement; wmx's own output goes
+# to a log under $TMPDIR (or /tmp), named on stderr at the end.
+#
+#   sh bench/run-bench.sh [count ...]
+#
+# "make bench" builds everything and runs this from the src directory.
+
+cd "$(dirname "$0")/.." || exit 1
+
+counts="${*:-10 100 1000}"
+display=":${BENCH_DISPLAY:-97}"
+status=0
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+    echo "run-bench: Xvfb not found" >&2
+    exit 1
+fi
+
+# a command menu holding one command that does nothing, for the
+# launch phase
+commands=$(mktemp -d) || exit 1
+trap 'rm -rf "$commands"' EXIT
+printf '#!/bin/sh\nexit 0\n' >"$commands/launch"
+chmod +x "$commands/launch"
+
+log=$(mktemp "${TMPDIR:-/tmp}/wmx-bench.XXXXXX") || exit 1
+
+for n in $counts; do
+    Xvfb "$display" -screen 0 1280x1024x24 -nolisten tcp >/dev/null 2>&1 &
+    xvfb=$!
+
+    # wait for the server to come up
+    tries=0
+    while ! DISPLAY="$display" xdpyinfo >/dev/null 2>&1; do
+        tries=$((tries + 1))
+        if [ $tries -gt 50 ]; then
+            echo "run-bench: Xvfb didn't start" >&2
+            kill $xvfb
+            exit 1
+        fi
+        sleep 0.1
+    done
+
+    WMXDIR="$commands" DISPLAY="$display" ./wmx >>"$log" 2>&1 &
+    wm=$!
+    sleep 1
+
+    DISPLAY="$display" bench/wmxbench -n "$n" -p "$wm" || status=1
+
+    kill $wm 2>/dev/null
+    wait $wm 2>/dev/null
+    kill $xvfb 2>/dev/null
+    wait $xvfb 2>/dev/null
+done
+
+echo "run-bench: wmx output is in $log" >&2
+exit $status